@@ -0,0 +1,162 @@
+/*
+ * Accelerometer (LIS3DH) for physics driven rolls
+ *
+ * MIT license, see LICENSE.txt.
+ *
+ * The sensor shares SCL and SDA with dots 4 and 6 (the USI pins are fixed
+ * to PA4 and PA6). The display only changes SDA while SCL is low, so the
+ * sensor never sees a start condition from the animation.
+ */
+
+#include "config.h"
+
+#include <avr/io.h>
+#include "usi_i2c.h"
+#include "accel.h"
+
+#if ACCELEROMETER
+
+#define ADDRESS 0x18
+
+#define CTRL_REG1 0x20
+#define CTRL_REG3 0x22
+#define CTRL_REG4 0x23
+#define CTRL_REG5 0x24
+#define OUT_X_L 0x28
+#define INT1_CFG 0x30
+#define INT1_SRC 0x31
+#define INT1_THS 0x32
+#define INT1_DURATION 0x33
+
+// Set on the register address to read consecutive registers
+#define AUTO_INCREMENT 0x80
+
+// 100 Hz, all axes. At 10 kHz SCL a six byte read takes about as long as a sample period
+#define ODR_100HZ_XYZ 0x57
+#define INT1_ON_IA1 0x40
+#define SCALE_16G 0x30
+#define LATCH_INT1 0x08
+#define HIGH_EVENTS_XYZ 0x2A
+
+// About 1.5 g at 186 mg per count
+#define WAKE_THRESHOLD 8
+
+// High bytes at +-16 g are roughly 128 mg per count
+#define ONE_G 8
+
+// Energy units per count above 1 g. Saturates at about 8 g
+#define ENERGY_PER_COUNT 16
+
+#define BURST 4
+#define SAMPLE_SIZE 6
+
+// Timer1 counts between reads while spinning. A read keeps the bit ISR
+// busy for about 5 ms, so every 40 ms leaves spin() nearly all the CPU
+// and the burst still spans the last 160 ms of the throw
+#define POLL_INTERVAL (F_CPU / 25)
+
+static uint8_t samples[BURST][SAMPLE_SIZE];
+static uint8_t head;
+static uint16_t polled_at;
+
+
+static void write(uint8_t reg, uint8_t value) {
+	i2c_write(ADDRESS, reg, value);
+	i2c_wait();
+}
+
+void accel_init(void) {
+	i2c_init();
+
+	write(CTRL_REG1, ODR_100HZ_XYZ);
+	write(CTRL_REG4, SCALE_16G);
+	write(CTRL_REG5, LATCH_INT1);
+	write(INT1_THS, WAKE_THRESHOLD);
+	write(INT1_DURATION, 0);
+	write(INT1_CFG, HIGH_EVENTS_XYZ);
+	write(CTRL_REG3, INT1_ON_IA1);
+}
+
+static void read_sample(void) {
+	if (++head >= BURST) {
+		head = 0;
+	}
+
+	i2c_read(ADDRESS, OUT_X_L | AUTO_INCREMENT, samples[head], SAMPLE_SIZE);
+}
+
+void accel_poll(void) {
+	if (i2c_busy() || (uint16_t)(TCNT1 - polled_at) < POLL_INTERVAL) {
+		return;
+	}
+
+	polled_at = TCNT1;
+	read_sample();
+}
+
+void accel_capture(void) {
+	for (uint8_t s = 0; s < BURST; s++) {
+		read_sample();
+		i2c_wait();
+	}
+}
+
+static uint8_t magnitude(int8_t axis) {
+	return axis < 0 ? -axis : axis;
+}
+
+uint16_t accel_energy(void) {
+	i2c_wait();
+
+	// Length approximated as the largest axis plus a quarter of the others;
+	// within 15 % of the true length and the core has no multiplier
+	uint16_t peak = 0;
+	for (uint8_t s = 0; s < BURST; s++) {
+		uint16_t sum = 0;
+		uint8_t largest = 0;
+		for (uint8_t a = 1; a < SAMPLE_SIZE; a += 2) {
+			uint8_t m = magnitude(samples[s][a]);
+			sum += m;
+			if (m > largest) {
+				largest = m;
+			}
+		}
+
+		uint16_t length = largest + (sum - largest) / 4;
+		if (length > peak) {
+			peak = length;
+		}
+	}
+
+	if (peak <= ONE_G) {
+		return 0;
+	}
+
+	uint16_t energy = (peak - ONE_G) * ENERGY_PER_COUNT;
+	return energy > 1023 ? 1023 : energy;
+}
+
+uint16_t accel_entropy(void) {
+	i2c_wait();
+
+	uint16_t entropy = 0;
+	for (uint8_t s = 0; s < BURST; s++) {
+		for (uint8_t a = 0; a < SAMPLE_SIZE; a++) {
+			entropy = (entropy << 1 | entropy >> 15) ^ samples[s][a];
+		}
+	}
+
+	return entropy;
+}
+
+bool accel_motion(void) {
+	return PINA & _BV(MOTION);
+}
+
+void accel_rearm(void) {
+	uint8_t source;
+	i2c_read(ADDRESS, INT1_SRC, &source, 1);
+	i2c_wait();
+}
+
+#endif /* ACCELEROMETER */
@@ -0,0 +1,49 @@
+/*
+ * Accelerometer (LIS3DH) for physics driven rolls
+ *
+ * MIT license, see LICENSE.txt.
+ */
+
+#ifndef ACCEL_H
+#define ACCEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// INT1 of the sensor, PCINT7
+#define MOTION PA7
+
+void accel_init(void);
+
+/*
+ * Keeps a burst of recent samples flowing in while the dice spins.
+ * Call often; starts a read every 40 ms or so and otherwise returns at once.
+ */
+void accel_poll(void);
+
+/*
+ * Reads a fresh burst. Used when the dice was shaken rather than spun.
+ */
+void accel_capture(void);
+
+/*
+ * Throw energy from the latest burst, scaled to 0 - 1023
+ */
+uint16_t accel_energy(void);
+
+/*
+ * Folds all bits of the latest burst, including the noisy low bytes
+ */
+uint16_t accel_entropy(void);
+
+/*
+ * True when the motion wake interrupt is latched
+ */
+bool accel_motion(void);
+
+/*
+ * Clears the latched motion interrupt
+ */
+void accel_rearm(void);
+
+#endif
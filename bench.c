@@ -0,0 +1,148 @@
+/*
+ * Microbenchmarks of the firmware's routines
+ *
+ * MIT license, see LICENSE.txt.
+ *
+ * Builds dice.c with its main() taken over and calls each routine
+ * BENCH_CALLS times, every call between two markers in GPIOR0, for
+ * host/avrbench to time in the simulation. GPIOR2:GPIOR1 hold the word
+ * address of the routine's wrapper, which names it. Inputs are set up
+ * before the first marker so they aren't counted, and interrupts are off.
+ * A wrapper that does nothing is timed first; the host takes its cycles
+ * off the others.
+ *
+ * "make bench" builds and runs this and keeps a history of the results.
+ */
+
+#define main dice_main
+#include "dice.c"
+#undef main
+
+#ifndef BENCH_CALLS
+#define BENCH_CALLS 64
+#endif
+
+// Markers, above the phases of debug_mark()
+#define BENCH_BEGIN 0x80
+#define BENCH_END 0x81
+#define BENCH_DONE 0x82
+
+#define BENCH(name) static __attribute__((noinline, used)) void bench_##name(void)
+
+static volatile uint16_t bench_arg;     // Spread over the range of inputs
+static volatile uint8_t bench_small;    // 1 - 6
+static volatile uint16_t bench_sink;
+
+BENCH(nothing) {
+	bench_sink = bench_arg;
+}
+
+BENCH(reduce) {
+	bench_sink = reduce(bench_arg, FACES);
+}
+
+BENCH(decelerate) {
+	bench_sink = decelerate(bench_arg, bench_small);
+}
+
+BENCH(show) {
+	display_figure(faces[bench_small - 1]);
+}
+
+#if CROSSFADE || FLOOR_LIGHT
+BENCH(gamma) {
+	bench_sink = pgm_read_byte(&(intensity_table[bench_arg % sizeof(intensity_table)]));
+}
+#endif
+
+#if CROSSFADE
+/* One crossfade edge after another, in every phase */
+static void edge_setup() {
+	if (!(TIMSK1 & (1 << OCIE1A))) {
+		crossfade(faces[bench_small - 1], bench_small * 8);
+	}
+}
+
+// The handler's body: calling the handler would run its reti and let interrupts in
+BENCH(edge) {
+	bench_sink = crossfade_edge();
+}
+#endif
+
+#if CURRENT_ARBITER
+static void arbiter_setup() {
+	shown = bench_arg;
+}
+
+BENCH(arbiter) {
+	bench_sink = dots_this_frame();
+}
+#endif
+
+#if FUEL_GAUGE
+BENCH(gauge) {
+	bench_sink = gauge_dots();
+}
+
+/* A new count every time, so that every byte is written */
+static void eeprom_setup() {
+	used_charge += 0x01010101 * bench_small;
+}
+
+BENCH(eeprom) {
+	eeprom_update_dword(&saved_charge, used_charge);
+}
+#endif
+
+#if KEYPAD
+BENCH(keypad) {
+	bench_sink = keypad_classify(bench_arg);
+}
+#endif
+
+static __attribute__((noinline)) void run(void (*bench)(void), void (*setup)(void)) {
+	uint16_t address = (uintptr_t)bench;
+	for (uint16_t i = 0; i < BENCH_CALLS; i++) {
+		bench_arg = i * 37;
+		bench_small = 1 + i % 6;
+		if (setup) {
+			setup();
+		}
+		cli();
+		GPIOR1 = address;
+		GPIOR2 = address >> 8;
+		GPIOR0 = BENCH_BEGIN;
+		bench();
+		GPIOR0 = BENCH_END;
+	}
+}
+
+int main(void) {
+	DDRA = 0x7F;
+
+	run(bench_nothing, NULL);
+	run(bench_reduce, NULL);
+	run(bench_decelerate, NULL);
+	run(bench_show, NULL);
+#if CROSSFADE || FLOOR_LIGHT
+	run(bench_gamma, NULL);
+#endif
+#if CROSSFADE
+	run(bench_edge, edge_setup);
+#endif
+#if CURRENT_ARBITER
+	run(bench_arbiter, arbiter_setup);
+#endif
+#if FUEL_GAUGE
+	run(bench_gauge, NULL);
+	run(bench_eeprom, eeprom_setup);
+#endif
+#if KEYPAD
+	run(bench_keypad, NULL);
+#endif
+
+	GPIOR0 = BENCH_DONE;
+	while (true) {
+	}
+	return 0;
+}
@@ -0,0 +1,146 @@
+# Generates config.h from a feature list, see features.cfg
+#
+# Usage: awk -f config.awk features.cfg > config.h
+#        awk -v mode=costs -f config.awk features.cfg
+#
+# The costs mode prints each enabled feature followed by the -D flags that
+# build the image without it and without everything that needs it.
+
+function fail(message) {
+	print FILENAME ":" FNR ": " message > "/dev/stderr"
+	failed = 1
+	exit 1
+}
+
+/^[ \t]*(#|$)/ {
+	next
+}
+
+{
+	line = $0
+	comment = ""
+	if (index(line, "#")) {
+		comment = substr(line, index(line, "#") + 1)
+		sub(/^[ \t]+/, "", comment)
+		line = substr(line, 1, index(line, "#") - 1)
+	}
+
+	n = split(line, field, /[ \t]+/)
+	first = field[1] == "" ? 2 : 1
+	name = field[first]
+	if (name !~ /^[A-Z][A-Z0-9_]*$/) {
+		fail("bad feature name '" name "'")
+	}
+	if (name in value) {
+		fail(name " defined twice")
+	}
+	if (field[first + 1] != "0" && field[first + 1] != "1") {
+		fail(name " must be 0 or 1")
+	}
+
+	names[++count] = name
+	value[name] = field[first + 1]
+	description[name] = comment
+	requires[name] = ""
+	for (i = first + 2; i <= n; i++) {
+		if (field[i] != "") {
+			requires[name] = requires[name] " " field[i]
+		}
+	}
+}
+
+END {
+	if (failed) {
+		exit 1
+	}
+
+	for (i = 1; i <= count; i++) {
+		name = names[i]
+		n = split(requires[name], need, " ")
+		for (j = 1; j <= n; j++) {
+			other = need[j]
+			sub(/^!/, "", other)
+			if (!(other in value)) {
+				print FILENAME ": " name " refers to unknown feature " other > "/dev/stderr"
+				exit 1
+			}
+			if (value[name] == "1" && need[j] ~ /^!/ && value[other] == "1") {
+				print FILENAME ": " name " can't be combined with " other > "/dev/stderr"
+				exit 1
+			}
+			if (value[name] == "1" && need[j] !~ /^!/ && value[other] != "1") {
+				print FILENAME ": " name " requires " other > "/dev/stderr"
+				exit 1
+			}
+		}
+	}
+
+	if (mode == "costs") {
+		for (i = 1; i <= count; i++) {
+			name = names[i]
+			if (value[name] != "1") {
+				continue
+			}
+
+			split("", off)
+			off[name] = 1
+			flags = "-D" name "=0"
+			do {
+				changed = 0
+				for (k = 1; k <= count; k++) {
+					other = names[k]
+					if (value[other] != "1" || (other in off)) {
+						continue
+					}
+					n = split(requires[other], need, " ")
+					for (j = 1; j <= n; j++) {
+						if (need[j] in off) {
+							off[other] = 1
+							flags = flags " -D" other "=0"
+							changed = 1
+							break
+						}
+					}
+				}
+			} while (changed)
+
+			print name, flags
+		}
+		exit 0
+	}
+
+	print "/* Generated from " FILENAME " by config.awk. Do not edit. */"
+	print ""
+	print "#ifndef CONFIG_H"
+	print "#define CONFIG_H"
+	for (i = 1; i <= count; i++) {
+		name = names[i]
+		print ""
+		if (description[name] != "") {
+			print "/* " description[name] " */"
+		}
+		print "#ifndef " name
+		print "#define " name " " value[name]
+		print "#endif"
+	}
+
+	# Repeated here so that -D overrides are checked too
+	print ""
+	for (i = 1; i <= count; i++) {
+		name = names[i]
+		n = split(requires[name], need, " ")
+		for (j = 1; j <= n; j++) {
+			other = need[j]
+			if (sub(/^!/, "", other)) {
+				print "#if " name " && " other
+				print "#error \"" name " can't be combined with " other "\""
+			} else {
+				print "#if " name " && !" other
+				print "#error \"" name " requires " other "\""
+			}
+			print "#endif"
+		}
+	}
+	print ""
+	print "#endif"
+}
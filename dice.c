@@ -22,7 +22,11 @@
  * THE SOFTWARE.
  */
 
+#ifndef F_CPU
 #define F_CPU 1000000UL
+#endif
+
+#include "config.h"
 
 #include <stdint.h>
 #include <stdbool.h>
@@ -32,17 +36,60 @@
 #include <avr/pgmspace.h>
 #include <avr/interrupt.h>
 #include <avr/sleep.h>
+#include <avr/eeprom.h>
+#include <util/atomic.h>
+
+#if ACCELEROMETER
+#include "usi_i2c.h"
+#include "accel.h"
+#endif
 
 /* Convenience macros */
 #define set_low(reg, bit) reg &= ~(1 << bit)
 #define set_high(reg, bit) reg |= (1 << bit)
 
+// Phase markers for simulators and debuggers. A single out instruction. Host harnesses define their own
+#ifndef debug_mark
+#if DEBUG_HOOKS
+#define debug_mark(phase) GPIOR0 = (phase)
+#else
+#define debug_mark(phase)
+#endif
+#endif
+
+#define MARK_WAIT 1
+#define MARK_SPIN 2
+#define MARK_THROW 3
+#define MARK_FADE 4
+#define MARK_SLEEP 5
+
 #define FACES 6
 #define WAIT_BEFORE_SLEEP 10
 
+_Static_assert(1000L * WAIT_BEFORE_SLEEP <= INT16_MAX, "wait_or_sleep() counts milliseconds in an int16_t");
+
+// The roll stops when the delay between faces reaches 250 - 758 ms
+#define STOP_AT_MIN 250
+#define STOP_AT_STEPS 128
+#define STOP_AT_STEP 4
+#define STOP_AT_MAX (STOP_AT_MIN + (STOP_AT_STEPS - 1) * STOP_AT_STEP)
+
+// The last step at most doubles the delay, plus three
+#define DELAY_MAX (2 * (STOP_AT_MAX - 1) + 3)
+
+_Static_assert(DELAY_MAX <= UINT16_MAX, "throw() keeps the delay in an uint16_t");
+_Static_assert(STOP_AT_STEPS <= UINT8_MAX, "reduce() takes the range as an uint8_t");
+
 #define BUTTON PB1
 #define BEEPER PB0
 
+// Load currents in microamperes at 3 V
+#define CURRENT_CPU 550
+#define CURRENT_DOT 2500
+#define CURRENT_BEEPER 8000
+#define CURRENT_FLOOR 20000
+#define CURRENT_WATCHDOG 4
+
 
 /*
  * LED layout:
@@ -80,6 +127,7 @@ static const uint8_t spin_sequence[] = {
 	DOT_0 | DOT_2
 };
 
+#if CROSSFADE || FLOOR_LIGHT
 /* Gamma correction for led intensity */
 static const uint8_t PROGMEM intensity_table[] = {
 	0, 0, 0, 0,
@@ -99,6 +147,7 @@ static const uint8_t PROGMEM intensity_table[] = {
 	179, 189, 199, 209,
 	220, 231, 243, 255
 };
+#endif
 
 
 /*
@@ -108,35 +157,519 @@ static bool button_down() {
 	return PINB & _BV(BUTTON);
 }
 
-static void display_figure(int8_t figure) {
+// The figure on display, or the one being faded in
+static uint8_t shown;
+
+#if CURRENT_ARBITER
+// The figure last written, and whether the floor light has the dots' turn.
+// Shared with the Timer0 interrupts.
+static volatile uint8_t lit;
+static volatile bool dots_blanked;
+#endif
+
+static void write_dots(uint8_t figure) {
+#if ACCELEROMETER
+	// Dots 4 and 6 are SCL and SDA. Leave them to the USI during transfers
+	// and otherwise change SDA only while SCL is low.
+	if (i2c_busy()) {
+		PORTA = (PORTA & (DOT_4 | DOT_6)) | (figure & ~(DOT_4 | DOT_6));
+		return;
+	}
+	PORTA &= ~DOT_4;
+	PORTA = (figure & ~DOT_4) | (PORTA & DOT_4);
+#endif
 	PORTA = figure;
 }
 
+/*
+ * Writes the dots. Used by the display interrupts too.
+ */
+static void show(uint8_t figure) {
+#if CURRENT_ARBITER
+	// Timer0 may hand the floor light its turn between reading dots_blanked
+	// and writing PORTA, and the write would light the dots beside it
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		lit = figure;
+		write_dots(dots_blanked ? 0 : figure);
+	}
+#else
+	write_dots(figure);
+#endif
+}
+
+
+#if CROSSFADE
+/*
+ * Crossfade between faces
+ *
+ * Dots shared by both figures stay lit. Within each PWM frame the incoming
+ * dots are lit at the beginning and the outgoing ones at the end, for
+ * on-times taken from the gamma table, so the two never overlap. That is
+ * at most three Timer1 compare interrupts per frame and nothing for the
+ * main loop to do.
+ */
+
+// Timer1 cycles per PWM frame, about 540 Hz at 1 MHz
+#define FRAME 1856
+
+// Timer1 cycles per gamma table step. 255 * 7 leaves a gap of at least MIN_PULSE
+#define PULSE_SCALE 7
+
+// Shorter pulses are dropped; the interrupt needs time to return
+#define MIN_PULSE 64
+
+// An edge due sooner than this after its compare is written is handled at once
+#define COMPARE_MARGIN 16
+
+_Static_assert(255 * PULSE_SCALE + MIN_PULSE <= FRAME, "the incoming and outgoing pulses must fit in a frame");
+_Static_assert(DELAY_MAX / 8 <= UINT8_MAX, "crossfade() takes the frame count as an uint8_t");
+
+enum fade_phase {
+	INCOMING,
+	DARK,
+	OUTGOING
+};
+
+static uint8_t fade_common;
+static uint8_t fade_in;
+static uint8_t fade_out;
+// Position in the gamma table and the step per frame, both 8.8 fixed point
+static uint16_t fade_progress;
+static uint16_t fade_speed;
+static uint8_t fade_phase;
+static uint16_t frame_start;
+static uint16_t pulse_in;
+static uint16_t pulse_out;
+
+static void stop_crossfade() {
+	set_low(TIMSK1, OCIE1A);
+}
+
+/*
+ * Shows the figure for the frame's next edge and sets the compare for the
+ * one after it. Returns false once the crossfade is over.
+ */
+static bool crossfade_edge() {
+	uint8_t figure = fade_common;
+	uint16_t next;
+
+	if (fade_phase == INCOMING) {
+		fade_progress += fade_speed;
+		uint8_t step = fade_progress >> 8;
+		if (step >= sizeof(intensity_table)) {
+			show(fade_common | fade_in);
+			stop_crossfade();
+			return false;
+		}
+
+		frame_start = OCR1A;
+		pulse_in = pgm_read_byte(&(intensity_table[step])) * PULSE_SCALE;
+		pulse_out = pgm_read_byte(&(intensity_table[sizeof(intensity_table) - 1 - step])) * PULSE_SCALE;
+
+		if (pulse_in >= MIN_PULSE) {
+			figure |= fade_in;
+			next = pulse_in;
+			fade_phase = DARK;
+		} else if (pulse_out >= MIN_PULSE) {
+			next = FRAME - pulse_out;
+			fade_phase = OUTGOING;
+		} else {
+			next = FRAME;
+		}
+
+	} else if (fade_phase == DARK && pulse_out >= MIN_PULSE) {
+		next = FRAME - pulse_out;
+		fade_phase = OUTGOING;
+
+	} else {
+		if (fade_phase == OUTGOING) {
+			figure |= fade_out;
+		}
+		next = FRAME;
+		fade_phase = INCOMING;
+	}
+
+	show(figure);
+	OCR1A = frame_start + next;
+	return true;
+}
+
+ISR(TIM1_COMPA_vect) {
+	while (crossfade_edge()) {
+		if ((int16_t)(OCR1A - TCNT1) >= COMPARE_MARGIN) {
+			// Forget matches of the edges handled early below
+			TIFR1 = (1 << OCF1A);
+			return;
+		}
+		// The edge has passed while it was being worked out, late or behind
+		// another interrupt. Its match would only come after Timer1 wraps.
+	}
+}
+
+/*
+ * Fades from the current figure to a new one over 'frames' PWM frames
+ */
+static void crossfade(uint8_t figure, uint8_t frames) {
+	stop_crossfade();
+
+	fade_common = shown & figure;
+	fade_in = figure & ~shown;
+	fade_out = shown & ~figure;
+	shown = figure;
+
+	if (frames == 0) {
+		frames = 1;
+	}
+	fade_speed = (sizeof(intensity_table) << 8) / frames;
+	fade_progress = 0;
+	fade_phase = INCOMING;
+
+	OCR1A = TCNT1 + MIN_PULSE;
+	TIFR1 = (1 << OCF1A);
+	set_high(TIMSK1, OCIE1A);
+}
+#endif
+
+static void display_figure(int8_t figure) {
+#if CROSSFADE
+	stop_crossfade();
+#endif
+	shown = figure;
+	show(figure);
+}
+
+/*
+ * Returns true if the dice should be rolled: the button is pressed or
+ * the dice was shaken.
+ */
+static bool triggered() {
+#if ACCELEROMETER
+	if (accel_motion()) {
+		return true;
+	}
+#endif
+	return button_down();
+}
+
 /*
  * Beeps for 'len' milliseconds
  */
 static void beep(int len) {
+#if SOUND
 	set_high(PORTB, BEEPER);
+#endif
 
+	// Silent builds keep the pause so the roll has the same rhythm
 	for (int a = 0; a < len; a++) {
 		_delay_us(1000);
 	}
 
+#if SOUND
 	set_low(PORTB, BEEPER);
+#endif
 }
 
+#if ADAPTIVE_DEBOUNCE
+/*
+ * Adaptive debounce
+ *
+ * spin() starts on the first edge, without waiting for the contacts to
+ * settle, and ends once the button has stayed up for the debounce window.
+ * Flips closer together than the window are one bounce. The window is
+ * twice the longest recent bounce plus a margin; the estimate jumps up to
+ * a longer bounce and decays by an eighth of the difference towards
+ * shorter ones, so it follows the switch as it wears. A press that isn't
+ * down for DEBOUNCE_PRESS_MIN in total is noise: the figure goes back and
+ * there is no roll. It may have been bounce longer than the window, so
+ * the estimate grows by a millisecond.
+ */
+
+// Milliseconds. Bounce assumed of a new switch
+#define DEBOUNCE_INITIAL 5
+#define DEBOUNCE_MARGIN 2
+#define DEBOUNCE_MAX 40
+#define DEBOUNCE_PRESS_MIN 15
+
+_Static_assert(2 * DEBOUNCE_MAX + DEBOUNCE_MARGIN <= UINT8_MAX, "the debounce window is an uint8_t");
+
+static uint8_t bounce = DEBOUNCE_INITIAL;
+
+// Set by spin() when the press turned out to be noise
+static bool spun_on_noise;
+
+static uint8_t debounce_window() {
+	uint8_t window = 2 * bounce + DEBOUNCE_MARGIN;
+	return window < DEBOUNCE_MAX ? window : DEBOUNCE_MAX;
+}
+
+static void learn_bounce(uint8_t length) {
+	if (length >= bounce) {
+		bounce = length < DEBOUNCE_MAX ? length : DEBOUNCE_MAX;
+	} else {
+		bounce -= (bounce - length + 7) / 8;
+	}
+}
+#endif
+
+#if LATENCY_REPORT
+/*
+ * Input latency report
+ *
+ * Each press is timed on Timer1 from its pin change interrupt to the first
+ * spin figure, into a histogram of half octaves. Waking from power down
+ * adds the oscillator's start-up time, which the timer doesn't see. Before
+ * going to sleep, the 50th, 90th and 99th percentiles go out of PA7 as
+ * LATENCY_BAUD 8N1. The pin is only ever pulled low, as show() keeps its
+ * PORTA bit clear, so the line needs a pull-up; serial adapters have one.
+ *
+ * Frame: 'L', the three percentiles as the upper bounds of their bins in
+ * microseconds, the number of presses in the histogram (uint16_t, least
+ * significant byte first) and the debounce window in milliseconds (0
+ * without ADAPTIVE_DEBOUNCE). UINT16_MAX is "longer than 24 ms".
+ */
+
+#define LATENCY_BINS 16
+#define LATENCY_BAUD 2400
+
+// Cycles per bit spent outside the delay
+#define LATENCY_BIT_OVERHEAD 8
+
+static uint8_t latency_counts[LATENCY_BINS];
+static bool latency_new;
+static volatile uint16_t pressed_at;
+static volatile bool press_timed;
+
+/* Upper bound of a bin in microseconds: 192, 256, 384, 512, ... */
+static uint16_t latency_bound(uint8_t bin) {
+	return bin & 1 ? 256U << (bin / 2) : 192U << (bin / 2);
+}
+
+/*
+ * Adds the time since the press, if it was timed
+ */
+static void latency_note() {
+	if (!press_timed) {
+		return;
+	}
+	cli();
+	uint16_t latency = TCNT1 - pressed_at;
+	sei();
+	press_timed = false;
+
+	uint8_t bin = 0;
+	while (bin < LATENCY_BINS - 1 && latency >= latency_bound(bin)) {
+		bin++;
+	}
+	if (latency_counts[bin] == UINT8_MAX) {
+		// Keep the shape, forget the oldest
+		for (uint8_t i = 0; i < LATENCY_BINS; i++) {
+			latency_counts[i] /= 2;
+		}
+	}
+	latency_counts[bin]++;
+	latency_new = true;
+}
+
+static uint16_t latency_percentile(uint16_t presses, uint8_t percent) {
+	uint16_t count = 0;
+	for (uint8_t bin = 0; bin < LATENCY_BINS - 1; bin++) {
+		count += latency_counts[bin];
+		if (count * 100UL >= (uint32_t)presses * percent) {
+			return latency_bound(bin);
+		}
+	}
+	return UINT16_MAX;
+}
+
+static void latency_send(uint8_t byte) {
+	// Start bit, data and stop bit
+	uint16_t frame = (byte | 0x100) << 1;
+	for (uint8_t bit = 0; bit < 10; bit++) {
+		if (frame & 1) {
+			set_low(DDRA, PA7);
+		} else {
+			set_high(DDRA, PA7);
+		}
+		frame >>= 1;
+		_delay_us(1000000.0 / LATENCY_BAUD - LATENCY_BIT_OVERHEAD);
+	}
+}
+
+static void latency_send_word(uint16_t word) {
+	latency_send(word);
+	latency_send(word >> 8);
+}
+
+/*
+ * Sends the percentiles if there were presses since the last time. Call
+ * with interrupts disabled.
+ */
+static void latency_report() {
+	if (!latency_new) {
+		return;
+	}
+	latency_new = false;
+
+	uint16_t presses = 0;
+	for (uint8_t bin = 0; bin < LATENCY_BINS; bin++) {
+		presses += latency_counts[bin];
+	}
+
+	latency_send('L');
+	latency_send_word(latency_percentile(presses, 50));
+	latency_send_word(latency_percentile(presses, 90));
+	latency_send_word(latency_percentile(presses, 99));
+	latency_send_word(presses);
+#if ADAPTIVE_DEBOUNCE
+	latency_send(debounce_window());
+#else
+	latency_send(0);
+#endif
+}
+#endif
+
+#if FUEL_GAUGE
+// Milliseconds to hold the button to see the remaining charge
+#define GAUGE_HOLD 2000
+
+// The remaining charge as lit dots, worked out before sleeping
+static uint8_t gauge_figure;
+#endif
+
+/*
+ * Returns the figure to show 'spun' milliseconds into a press, at 'seed'.
+ * A long hold shows the fuel gauge instead, the press still rolls.
+ */
+static uint8_t spin_figure(uint16_t seed, uint16_t spun) {
+#if FUEL_GAUGE
+	if (spun >= GAUGE_HOLD) {
+		return gauge_figure;
+	}
+#else
+	(void)spun;
+#endif
+	return spin_sequence[seed / 32 % sizeof(spin_sequence)];
+}
+
+#if ADAPTIVE_DEBOUNCE
+/*
+ * Spins the dice until the button is released and has settled. Returns a
+ * random number, or 'seed' as it was if the press was noise. The caller
+ * puts back the display.
+ */
+static uint16_t spin(uint16_t seed) {
+	uint16_t start = seed;
+	uint8_t window = debounce_window();
+	bool down = button_down();
+	uint8_t held = 0;       // Milliseconds down, up to DEBOUNCE_PRESS_MIN
+	uint8_t stable = 0;     // Since the last flip
+	uint8_t episode = 0;    // From the first flip of the current bounce to the last
+
+	spun_on_noise = false;
+#if ACCELEROMETER
+	if (!down && accel_motion()) {
+		// Shaken, not pressed
+		return seed;
+	}
+#endif
+
+	// A press already released by now settles like any other, held for
+	// no time at all, and comes out as noise unless it goes down again
+	while (down || stable < window) {
+		display_figure(spin_figure(seed, seed - start));
+#if LATENCY_REPORT
+		latency_note();
+#endif
+#if ACCELEROMETER
+		accel_poll();
+#endif
+		_delay_us(800);
+
+		// Only time held counts towards the seed
+		if (down) {
+			seed++;
+			if (held < DEBOUNCE_PRESS_MIN) {
+				held++;
+			}
+		}
+		if (stable < UINT8_MAX) {
+			stable++;
+		}
+
+		if (button_down() != down) {
+			down = !down;
+			if (stable < window) {
+				episode += stable;
+			} else {
+				learn_bounce(episode);
+				episode = 0;
+			}
+			stable = 0;
+		}
+	}
+	learn_bounce(episode);
+
+	if (held < DEBOUNCE_PRESS_MIN) {
+		learn_bounce(bounce + 1);
+		spun_on_noise = true;
+		return start;
+	}
+
+	return seed;
+}
+#else
 /*
  * Spins the dice until the button is released. Returns a random number.
  */
 static uint16_t spin(uint16_t seed) {
+	uint16_t start = seed;
+
 	while (button_down()) {
-		display_figure(spin_sequence[seed / 32 % sizeof(spin_sequence)]);
+		display_figure(spin_figure(seed, seed - start));
+#if LATENCY_REPORT
+		latency_note();
+#endif
+#if ACCELEROMETER
+		accel_poll();
+#endif
 		_delay_us(800);
 		seed++;
 	}
 
 	return seed;
 }
+#endif
+
+/*
+ * Waits 'delay' milliseconds between two faces. Returns true if the button
+ * was pressed. Kept out of line so that wcet.cfg can bound a step.
+ */
+static __attribute__((noinline)) bool wait_step(uint16_t delay) {
+	for (uint16_t i = 0; i < delay; i++) {
+		_delay_us(1000);
+
+		if (button_down()) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Reduces the seed to 0 - range - 1
+ */
+static uint8_t reduce(uint16_t seed, uint8_t range) {
+	return seed % range;
+}
+
+/*
+ * The next delay between faces, in milliseconds. The roll slows down
+ * exponentially
+ */
+static uint16_t decelerate(uint16_t delay, int8_t quotient) {
+	return delay + 3 + delay / quotient;
+}
 
 /*
  * Tosses the dice. Returns true if the button was pressed during tossing.
@@ -144,12 +677,12 @@ static uint16_t spin(uint16_t seed) {
 static bool throw(uint16_t seed, uint16_t previous_seed) {
 
 	// Randomize initial face
-	int8_t face = seed % FACES;
+	int8_t face = reduce(seed, FACES);
 
 	// Make tossing more exciting by adding some variation
-	int16_t stop_at = 250 + (seed % 128) * 4;
+	int16_t stop_at = STOP_AT_MIN + reduce(seed, STOP_AT_STEPS) * STOP_AT_STEP;
 
-	int8_t quotient = 1 + (seed / 4) % 6;
+	int8_t quotient = 1 + reduce(seed / 4, 6);
 
 	// Initial velocity depends on the duration the button was held down.
 	// Seed was incremented by one per millisecond
@@ -158,22 +691,30 @@ static bool throw(uint16_t seed, uint16_t previous_seed) {
 		duration = 1023;
 	}
 
+#if ACCELEROMETER
+	// ...or on how hard the dice was actually thrown
+	uint16_t energy = accel_energy();
+	if (energy) {
+		duration = energy;
+	}
+#endif
+
 	// Powers of two are preferred in arithmetic constants because they compile to shorter machine code
 	uint16_t delay = 68 - duration * 64 / 1024;
 
 	while (delay < stop_at) {
-		// Increase the delay exponentially
-		delay += 3 + delay / quotient;
-
-		for (int i = 0; i < delay; i++) {
-			_delay_us(1000);
+		delay = decelerate(delay, quotient);
 
-			if (button_down()) {
-				return true;
-			}
+		if (wait_step(delay)) {
+			return true;
 		}
 
+#if CROSSFADE
+		// Crossfade for a fifth to a quarter of the step, in 1.86 ms frames
+		crossfade(faces[face], delay / 8);
+#else
 		display_figure(faces[face]);
+#endif
 
 		beep(3);
 
@@ -188,50 +729,691 @@ static bool throw(uint16_t seed, uint16_t previous_seed) {
 	return false;
 }
 
+#if FLOOR_LIGHT
+/*
+ * Floor light
+ *
+ * Timer0 drives the floor leds with hardware PWM in phase correct mode:
+ * OC0A (PB2) is the white zone and OC0B (PA7) the optional green one.
+ * A sequencer in the overflow interrupt walks the duty down the gamma table,
+ * so the compare registers only change at frame boundaries and the fade
+ * runs in the background.
+ *
+ * Timer1's compare outputs are on dots 5 and 6, so they aren't available.
+ */
+
+#define FLOOR_WHITE (1 << 0)
+#define FLOOR_GREEN (1 << 1)
+
+// Phase correct PWM at CLK/8 gives 1 MHz / 8 / 510 = 245 frames per second
+#define FLOOR_HOLD_FRAMES 122
+#define FLOOR_FRAMES_PER_STEP 5
+
+_Static_assert(FLOOR_HOLD_FRAMES <= UINT8_MAX && FLOOR_FRAMES_PER_STEP <= UINT8_MAX, "the floor light counts frames in uint8_t");
+
+static uint8_t floor_zones;
+static uint8_t floor_level;
+static uint8_t floor_hold;
+static uint8_t floor_frames;
+
+#if CURRENT_ARBITER
+/*
+ * Current arbiter
+ *
+ * Keeps the current drawn at any moment under CURRENT_CEILING, so that a
+ * weak cell doesn't brown out. The CPU, the dots and the beeper always fit
+ * together, as checked below. The floor light soft-starts up the gamma
+ * table and is granted its duty at the start of each Timer0 frame. When it
+ * doesn't fit beside the dots, its duty is capped and the dots are blanked
+ * while its output is high, so the two take turns within the frame. The
+ * compare interrupts follow the output; the few microseconds both are on
+ * after a turn-on edge come from the decoupling capacitor.
+ *
+ * The dots aren't staggered among themselves. They have series resistors,
+ * so there is no inrush to spread, and behind the decoupling capacitor the
+ * cell sees the average over some 150 us (see host/droop.c), which edges a
+ * few microseconds apart wouldn't change.
+ */
+
+#ifndef CURRENT_CEILING
+#define CURRENT_CEILING 30000
+#endif
+
+// Floor light duty while it takes turns with the dots, leaving them the rest of the frame
+#define FLOOR_SHARED_DUTY 128
+
+// Dots that fit beside the floor light
+#define DOTS_BESIDE_FLOOR ((CURRENT_CEILING - CURRENT_CPU - CURRENT_FLOOR) / CURRENT_DOT)
+#define DOTS_BESIDE_FLOOR_AND_BEEPER ((CURRENT_CEILING - CURRENT_CPU - CURRENT_FLOOR - CURRENT_BEEPER) / CURRENT_DOT)
+
+#if GREEN_FLOOR
+#define FLOOR_COMPARE ((1 << OCIE0A) | (1 << OCIE0B))
+#else
+#define FLOOR_COMPARE (1 << OCIE0A)
+#endif
+
+_Static_assert(CURRENT_CPU + 7 * CURRENT_DOT + CURRENT_BEEPER <= CURRENT_CEILING, "the dots and the beeper must fit under the ceiling");
+_Static_assert(CURRENT_CPU + CURRENT_FLOOR + CURRENT_BEEPER <= CURRENT_CEILING, "the floor light and the beeper must fit under the ceiling");
+
+// Set bits per nibble
+static const uint8_t PROGMEM dot_counts[] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+
+static bool floor_rising;
+
+/*
+ * Returns the number of dots that may light up during this frame
+ */
+static uint8_t dots_this_frame() {
+	uint8_t figure = shown;
+#if CROSSFADE
+	// The outgoing dots are lit at the end of each crossfade frame
+	if (TIMSK1 & (1 << OCIE1A)) {
+		figure |= fade_out;
+	}
+#endif
+	return pgm_read_byte(&(dot_counts[figure & 15])) + pgm_read_byte(&(dot_counts[figure >> 4]));
+}
+
+/*
+ * Blanks the dots while the floor light's output is high
+ */
+static void follow_floor() {
+	bool floor_on = PINB & _BV(PB2);
+#if GREEN_FLOOR
+	floor_on = floor_on || (PINA & _BV(PA7));
+#endif
+	dots_blanked = floor_on;
+	show(lit);
+}
+
+ISR(TIM0_COMPA_vect) {
+	follow_floor();
+}
+
+#if GREEN_FLOOR
+ISR(TIM0_COMPB_vect, ISR_ALIASOF(TIM0_COMPA_vect));
+#endif
+
+/*
+ * Gives the dots their turn back
+ */
+static void stop_taking_turns() {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		TIMSK0 &= ~FLOOR_COMPARE;
+		if (dots_blanked) {
+			dots_blanked = false;
+			show(lit);
+		}
+	}
+}
+
+/*
+ * Returns the duty the floor light is granted for the next frame
+ */
+static uint8_t floor_grant(uint8_t duty) {
+	uint8_t room = PORTB & _BV(BEEPER) ? DOTS_BESIDE_FLOOR_AND_BEEPER : DOTS_BESIDE_FLOOR;
+
+	if (dots_this_frame() <= room) {
+		stop_taking_turns();
+		return duty;
+	}
+
+	TIMSK0 |= FLOOR_COMPARE;
+	follow_floor();
+	return duty < FLOOR_SHARED_DUTY ? duty : FLOOR_SHARED_DUTY;
+}
+#endif
+
+static void fade_off() {
+	set_low(TIMSK0, TOIE0);
+	TCCR0A = 0;
+	TCCR0B = 0;
+	set_low(DDRB, PB2);
+#if GREEN_FLOOR
+	set_low(DDRA, PA7);
+#endif
+#if CURRENT_ARBITER
+	stop_taking_turns();
+#endif
+}
+
+ISR(TIM0_OVF_vect) {
+#if CURRENT_ARBITER
+	if (floor_rising) {
+		// Soft start, a step up the gamma table per frame
+		floor_rising = ++floor_level < sizeof(intensity_table) - 1;
+	} else
+#endif
+	if (floor_hold) {
+		floor_hold--;
+	} else if (++floor_frames >= FLOOR_FRAMES_PER_STEP) {
+		floor_frames = 0;
+		if (floor_level == 0) {
+			fade_off();
+			return;
+		}
+		floor_level--;
+	}
+
+	uint8_t duty = pgm_read_byte(&(intensity_table[floor_level]));
+#if CURRENT_ARBITER
+	duty = floor_grant(duty);
+#endif
+	OCR0A = floor_zones & FLOOR_WHITE ? duty : 0;
+	OCR0B = floor_zones & FLOOR_GREEN ? duty : 0;
+}
+
 /*
- * Fade out effect for decoration leds
+ * Fade out effect for decoration leds. Returns immediately.
  */
 static void fade() {
 	// http://startingelectronics.com/tutorials/AVR-8-microcontrollers/ATtiny2313-tutorial/P11-PWM/
+	floor_zones = FLOOR_WHITE;
+#if GREEN_FLOOR
+	// Colour coded result: green for a six
+	if (shown == faces[FACES - 1]) {
+		floor_zones = FLOOR_GREEN;
+	}
+	set_high(DDRA, PA7);                    // PWM output on PA7
+#endif
 	set_high(DDRB, PB2);                    // PWM output on PB2
+
+#if CURRENT_ARBITER
+	floor_level = 0;
+	floor_rising = true;
+#else
+	floor_level = sizeof(intensity_table) - 1;
+#endif
+	floor_hold = FLOOR_HOLD_FRAMES;
+	floor_frames = 0;
+	OCR0A = 0;                              // The sequencer sets the duty from the first frame on
+	OCR0B = 0;
+
 	TCCR0A = (1 << COM0A1) | (1 << WGM00);  // phase correct PWM mode
+#if GREEN_FLOOR
+	set_high(TCCR0A, COM0B1);
+#endif
 	TCCR0B = (1 << CS01);                   // clock source = CLK/8, start PWM
+	TIFR0 = (1 << TOV0);
+	set_high(TIMSK0, TOIE0);
+}
+#endif
+
+#if FUEL_GAUGE
+/*
+ * Fuel gauge
+ *
+ * Counts the charge drawn from the battery. Timer1 overflows every 65.536 ms
+ * and the tick adds whatever draws current at that moment: the CPU, the lit
+ * dots, the beeper and the floor light scaled by its duty. The tick isn't
+ * synchronized with the crossfade or the software PWM, so dimmed dots
+ * average out to their duty.
+ *
+ * Sleep (about 0.1 uA) isn't metered: a year of it is below 1 mAh and
+ * timing it would need the watchdog, which draws 40 times more. The
+ * reminder runs the watchdog anyway and adds its flashes itself.
+ *
+ * The count survives in the EEPROM while sleeping. The battery voltage
+ * is trusted only at the ends of the flat discharge curve: a fresh cell
+ * resets the count and a cell past the knee raises it to 90 %. It is read
+ * on waking, with the cell rested, but only every ANCHOR_WAKES wakes: the
+ * reading holds up the press by a millisecond and the voltage takes weeks
+ * to move.
+ *
+ * The gauge shows at power up and while the button is held for GAUGE_HOLD.
+ */
+
+// mAh, CR2032
+#define BATTERY_CAPACITY 225
+
+// Open circuit millivolts
+#define FRESH_VOLTAGE 3150
+#define KNEE_VOLTAGE 2700
+
+// Sixteenths of a microcoulomb per tick
+#define TICK_CHARGE(ua) ((uint16_t)((ua) * 65536UL / 62500))
 
-	OCR0A = 255;
-	_delay_ms(500);
+// Microcoulombs
+#define CAPACITY (BATTERY_CAPACITY * 3600000UL)
 
-	for (int16_t value = sizeof(intensity_table) - 1; value >= 0 && !button_down(); value--) {
-		OCR0A = pgm_read_byte(&(intensity_table[value]));
-		_delay_ms(1200 / sizeof(intensity_table));
+// What an unwritten EEPROM reads
+#define ERASED 0xFFFFFFFFUL
+
+// Bandgap (1.1 V) reading with VCC as the reference
+#define BANDGAP_AT(mv) (1100UL * 1024 / (mv))
+
+// Wakes from one voltage reading to the next
+#define ANCHOR_WAKES 16
+
+_Static_assert(BATTERY_CAPACITY * 3600000ULL <= UINT32_MAX, "the charge is counted in an uint32_t");
+_Static_assert(CURRENT_FLOOR * 65536ULL / 62500 <= UINT16_MAX, "TICK_CHARGE() is an uint16_t");
+
+static uint32_t EEMEM saved_charge;
+
+static volatile uint32_t used_charge;
+static uint8_t charge_fraction;
+static uint8_t wakes;
+
+ISR(TIM1_OVF_vect) {
+	uint32_t charge = charge_fraction + TICK_CHARGE(CURRENT_CPU);
+
+	for (uint8_t dots = PORTA & 0b01111111; dots; dots >>= 1) {
+		if (dots & 1) {
+			charge += TICK_CHARGE(CURRENT_DOT);
+		}
 	}
 
-	set_low(DDRB, PB2);
+	if (PORTB & _BV(BEEPER)) {
+		charge += TICK_CHARGE(CURRENT_BEEPER);
+	}
+
+#if FLOOR_LIGHT
+	if (TCCR0B) {
+		charge += (TICK_CHARGE(CURRENT_FLOOR) / 256) * (OCR0A + OCR0B);
+	}
+#endif
+
+	used_charge += charge >> 4;
+	charge_fraction = charge & 15;
+}
+
+/*
+ * Returns the bandgap reading. Higher readings mean lower voltage.
+ */
+static uint16_t measure_bandgap() {
+	ADMUX = (1 << MUX5) | (1 << MUX0);     // 1.1 V bandgap, VCC as reference
+	ADCSRA = (1 << ADEN) | (1 << ADPS1) | (1 << ADPS0); // CLK/8
+	_delay_ms(1);                          // Let the bandgap settle
+
+	set_high(ADCSRA, ADSC);
+	loop_until_bit_is_clear(ADCSRA, ADSC);
+	uint16_t reading = ADC;
+
+	ADCSRA = 0;
+	return reading;
 }
 
+/*
+ * Corrects the count with the battery voltage. Call with the loads off.
+ */
+static void gauge_anchor() {
+	uint16_t bandgap = measure_bandgap();
+
+	cli();
+	if (bandgap <= BANDGAP_AT(FRESH_VOLTAGE)) {
+		used_charge = 0;
+	} else if (used_charge > CAPACITY) {
+		// Drawn past the rated capacity: empty as far as the count can tell
+		used_charge = CAPACITY;
+	} else if (bandgap >= BANDGAP_AT(KNEE_VOLTAGE) && used_charge < CAPACITY / 10 * 9) {
+		used_charge = CAPACITY / 10 * 9;
+	}
+	sei();
+}
+
+/*
+ * Returns the remaining charge as 1 - 7 dots
+ */
+static uint8_t gauge_dots() {
+	cli();
+	uint32_t used = used_charge;
+	sei();
+
+	// The tick keeps counting past the capacity until the next anchor
+	uint32_t remaining = used < CAPACITY ? CAPACITY - used : 0;
+	uint8_t dots = remaining / (CAPACITY / 7) + 1;
+	return dots > 7 ? 7 : dots;
+}
+
+/*
+ * Works out the figure a long press shows. Takes a 32 bit division, so
+ * not while spinning.
+ */
+static void gauge_update() {
+	gauge_figure = (1 << gauge_dots()) - 1;
+}
+
+static void gauge_init() {
+	used_charge = eeprom_read_dword(&saved_charge);
+	if (used_charge == ERASED) {
+		// Never saved: a new dice with, presumably, a new cell
+		used_charge = 0;
+	}
+	gauge_anchor();
+	gauge_update();
+	set_high(TIMSK1, TOIE1);
+}
+#endif
+
+#if ADC_ENTROPY
+/*
+ * Entropy from ADC noise
+ *
+ * Converts the internal temperature sensor against the 1.1 V reference
+ * with a faster than accurate ADC clock and keeps the least significant
+ * bit. Von Neumann's trick removes its bias: of each pair of bits, 01 and
+ * 10 give one bit and 00 and 11 are dropped. The CPU sleeps in ADC noise
+ * reduction mode during each conversion.
+ */
+
+// Gives up on a stuck bit. About 100 ms
+#define ENTROPY_MAX_PAIRS 1024
+
+#if !KEYPAD
+// With the keypad, its handler wakes the CPU instead
+EMPTY_INTERRUPT(ADC_vect);
+#endif
+
+static uint8_t convert_lsb() {
+	do {
+		sleep_mode();
+	} while (ADCSRA & (1 << ADSC));
+
+	return ADC & 1;
+}
+
+static uint16_t harvest_entropy() {
+	uint16_t entropy = 0;
+	uint8_t bits = 0;
+
+	ADMUX = (1 << REFS1) | (1 << MUX5) | (1 << MUX1);   // Temperature sensor, 1.1 V reference
+	ADCSRA = (1 << ADEN) | (1 << ADIE) | (1 << ADPS1);  // CLK/4
+	set_sleep_mode(SLEEP_MODE_ADC);
+
+	for (uint16_t pairs = 0; pairs < ENTROPY_MAX_PAIRS && bits < 16; pairs++) {
+		uint8_t first = convert_lsb();
+		if (first != convert_lsb()) {
+			entropy = entropy << 1 | first;
+			bits++;
+		}
+	}
+
+	ADCSRA = 0;
+	set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+	return entropy;
+}
+#endif
+
+#if KEYPAD
+/*
+ * Analog keypad
+ *
+ * Extra keys on a resistor ladder on PA7 (ADC7). A 100 k pull-up holds the
+ * pin at VCC and each key pulls it down through its own resistor: 0, 10 k
+ * and 22 k give 0, 0.09 and 0.18 VCC, all below the digital low level. No
+ * current flows until a key is pressed. A press is a pin change, which
+ * starts a Timer1 tick that runs one conversion per tick until the keys
+ * are released again, so the ADC is off otherwise.
+ *
+ * Readings between the bands keep the previous key, which is the
+ * hysteresis, and a key must read the same KEYPAD_DEBOUNCE times in a row
+ * before key_down() reports it.
+ */
+
+#define KEY_MODE 0
+#define KEY_HOLD 1
+#define KEY_SETTINGS 2
+#define KEY_NONE 3
+
+// Ladder levels in 8 bit readings, indexed by key
+static const uint8_t PROGMEM ladder[] = { 0, 23, 46, 255 };
+
+// A reading this close to a level is that key
+#define KEYPAD_WINDOW 6
+
+// Timer1 cycles per sample, about 4 ms
+#define KEYPAD_TICK 4096
+#define KEYPAD_DEBOUNCE 4
+
+// ADC7 with VCC as the reference
+#define KEYPAD_ADMUX ((1 << MUX2) | (1 << MUX1) | (1 << MUX0))
+
+_Static_assert(KEYPAD_WINDOW * 2 < 23, "the bands must not overlap");
+
+static volatile uint8_t keypad_key = KEY_NONE;
+static uint8_t keypad_candidate = KEY_NONE;
+static uint8_t keypad_agree;
+
+static void keypad_arm() {
+	set_high(PCMSK0, PCINT7);
+	set_high(GIMSK, PCIE0);
+}
+
+/*
+ * Starts sampling when the ladder's voltage changes. Wakes the dice too.
+ */
+ISR(PCINT0_vect) {
+	sleep_disable();
+	set_low(PCMSK0, PCINT7);
+	OCR1B = TCNT1 + KEYPAD_TICK;
+	TIFR1 = (1 << OCF1B);
+	set_high(TIMSK1, OCIE1B);
+}
+
+ISR(TIM1_COMPB_vect) {
+	OCR1B += KEYPAD_TICK;
+
+	// Skip the tick if the fuel gauge or the entropy harvest has the ADC
+	if (ADCSRA == 0) {
+		ADMUX = KEYPAD_ADMUX;
+		ADCSRA = (1 << ADEN) | (1 << ADSC) | (1 << ADIE) | (1 << ADPS1); // CLK/4
+	}
+}
+
+/*
+ * Returns the key a reading belongs to
+ */
+static uint8_t keypad_classify(uint8_t reading) {
+	for (uint8_t key = 0; key < sizeof(ladder); key++) {
+		uint8_t level = pgm_read_byte(&(ladder[key]));
+		uint8_t distance = reading > level ? reading - level : level - reading;
+		if (distance <= KEYPAD_WINDOW) {
+			return key;
+		}
+	}
+	return keypad_candidate;
+}
+
+ISR(ADC_vect) {
+	if (ADMUX != KEYPAD_ADMUX) {
+		// The entropy harvest only needs the wake-up
+		return;
+	}
+
+	uint8_t key = keypad_classify(ADC >> 2);
+	ADCSRA = 0;
+
+	if (key != keypad_candidate) {
+		keypad_candidate = key;
+		keypad_agree = 0;
+	} else if (keypad_agree < KEYPAD_DEBOUNCE && ++keypad_agree == KEYPAD_DEBOUNCE) {
+		keypad_key = key;
+	}
+
+	// Released: stop sampling and wait for the next press
+	if (keypad_key == KEY_NONE && keypad_agree == KEYPAD_DEBOUNCE && (PINA & _BV(PA7))) {
+		set_low(TIMSK1, OCIE1B);
+		keypad_arm();
+	}
+}
+
+/*
+ * Returns true if the key is pressed
+ */
+static bool key_down(uint8_t key) {
+	return keypad_key == key;
+}
+#endif
+
 /*
  * Handle pin change interrupt
  */
 ISR(PCINT1_vect) {
+#if LATENCY_REPORT
+	pressed_at = TCNT1;
+	press_timed = true;
+#endif
 	sleep_disable();
 	set_low(PCMSK1, PCINT9);
 	set_low(GIMSK, PCIE1);
+#if ACCELEROMETER
+	set_low(PCMSK0, MOTION);
+	set_low(GIMSK, PCIE0);
+#endif
 }
 
+#if ACCELEROMETER
+ISR(PCINT0_vect, ISR_ALIASOF(PCINT1_vect));
+#endif
+
+#if REMINDER
+/*
+ * Reminder
+ *
+ * Once the dice has gone to sleep, the last face flashes for REMINDER_FLASH
+ * milliseconds every REMINDER_PERIOD seconds, for REMINDER_TIME minutes.
+ * The watchdog wakes the CPU from power down for each flash. An average
+ * face for 4 ms every 4 s is about 9 uA, plus 4 uA for the watchdog,
+ * against almost 9 mA for staying lit. The pin change handlers disable
+ * sleep, which ends the reminder at the first press.
+ */
+
+#ifndef REMINDER_PERIOD
+#define REMINDER_PERIOD 4
+#endif
+
+#ifndef REMINDER_FLASH
+#define REMINDER_FLASH 4
+#endif
+
+#ifndef REMINDER_TIME
+#define REMINDER_TIME 10
+#endif
+
+// Watchdog prescaler for the period
+#if REMINDER_PERIOD == 1
+#define REMINDER_WDP ((1 << WDP2) | (1 << WDP1))
+#elif REMINDER_PERIOD == 2
+#define REMINDER_WDP ((1 << WDP2) | (1 << WDP1) | (1 << WDP0))
+#elif REMINDER_PERIOD == 4
+#define REMINDER_WDP (1 << WDP3)
+#elif REMINDER_PERIOD == 8
+#define REMINDER_WDP ((1 << WDP3) | (1 << WDP0))
+#else
+#error "REMINDER_PERIOD must be 1, 2, 4 or 8 seconds"
+#endif
+
+#define REMINDER_FLASHES (REMINDER_TIME * 60L / REMINDER_PERIOD)
+
+// Microcoulombs per period with 'dots' lit
+#define REMINDER_CHARGE(dots) ((CURRENT_CPU + (dots) * (uint32_t)CURRENT_DOT) * REMINDER_FLASH / 1000 + CURRENT_WATCHDOG * REMINDER_PERIOD)
+
+_Static_assert(REMINDER_FLASHES <= UINT16_MAX, "remind() counts the flashes in an uint16_t");
+_Static_assert(REMINDER_CHARGE(7) <= UINT16_MAX, "remind() adds the charge as an uint16_t");
+
+EMPTY_INTERRUPT(WDT_vect);
+
 /*
- * Power down
+ * Flashes the figure until a button is pressed or the reminder times out.
+ * Call with interrupts disabled and sleep enabled.
  */
-static void sleep() {
-	PORTA = 0;
+static void remind(uint8_t figure) {
+	if (!figure) {
+		return;
+	}
+
+#if FUEL_GAUGE
+	uint8_t dots = 0;
+	for (uint8_t f = figure; f; f >>= 1) {
+		dots += f & 1;
+	}
+	uint16_t charge = REMINDER_CHARGE(dots);
+#endif
+
+	// Interrupt mode, no reset
+	WDTCSR = (1 << WDCE) | (1 << WDE);
+	WDTCSR = (1 << WDIE) | REMINDER_WDP;
+
+	for (uint16_t flashes = REMINDER_FLASHES; flashes; flashes--) {
+		sleep_bod_disable();
+		sei();
+		sleep_cpu();
+		cli();
+
+		if (!(MCUCR & _BV(SE))) {
+			// Woken by a press
+			break;
+		}
+
+		show(figure);
+		_delay_ms(REMINDER_FLASH);
+		show(0);
+
+#if FUEL_GAUGE
+		// The gauge's tick doesn't run while sleeping
+		used_charge += charge;
+#endif
+	}
+
+	WDTCSR = 0;
+}
+#endif
+
+/*
+ * Power down. Flashes 'figure' now and then if the reminder is on.
+ */
+static void sleep(uint8_t figure) {
+	debug_mark(MARK_SLEEP);
+	display_figure(0);
+#if FLOOR_LIGHT
+	fade_off();
+#endif
+#if FUEL_GAUGE
+	gauge_update();
+#endif
 	cli();
+#if LATENCY_REPORT
+	latency_report();
+#endif
 
 	// Activate pin change interrupt and wake up when button is pressed
 	set_high(PCMSK1, PCINT9);
 	set_high(GIMSK, PCIE1);
+#if ACCELEROMETER
+	set_high(PCMSK0, MOTION);
+	set_high(GIMSK, PCIE0);
+#endif
+#if KEYPAD
+	// Timer1 stops in power down. A key held now would never be seen released
+	set_low(TIMSK1, OCIE1B);
+	keypad_arm();
+#endif
+
+#if FUEL_GAUGE
+	eeprom_update_dword(&saved_charge, used_charge);
+#endif
 
 	sleep_enable();
+
+	// Pressed or shaken before the interrupts were armed: there is no edge to wake on
+	if (triggered()) {
+		sleep_disable();
+	}
+#if REMINDER
+	remind(figure);
+#else
+	(void)figure;
+#endif
 	sleep_bod_disable();
 	sei();
 	sleep_cpu();
+
+#if FUEL_GAUGE
+	if (++wakes == ANCHOR_WAKES) {
+		wakes = 0;
+		gauge_anchor();
+	}
+#endif
 }
 
 /*
@@ -239,13 +1421,26 @@ static void sleep() {
  */
 static void wait_or_sleep() {
 	int16_t wait = 1000 * WAIT_BEFORE_SLEEP;
+#if LATENCY_REPORT
+	// Time the next press from its edge
+	press_timed = false;
+	set_high(PCMSK1, PCINT9);
+	set_high(GIMSK, PCIE1);
+#endif
 	while (wait-- > 0) {
-		if (button_down()) return;
+		if (triggered()) return;
+#if KEYPAD
+		// The hold key keeps the result on display
+		if (key_down(KEY_HOLD)) {
+			wait = 1000 * WAIT_BEFORE_SLEEP;
+		}
+#endif
 		_delay_us(1000);
 	}
 
-	uint8_t figure = PORTA;
+	uint8_t figure = shown;
 
+#if IDLE_DIMMING
 	// Fade dice out using a cheap software PWM
 	for (int8_t a = 0; a < 127; a++) {
 		uint8_t dc = 32 - a / (128 / 32);
@@ -253,19 +1448,28 @@ static void wait_or_sleep() {
 		for (uint8_t d = 0; d < dc; d++) _delay_us(255); 
 		display_figure(0);
 		for (uint8_t d = dc; d < 32; d++) _delay_us(255); 
-		if (button_down()) return;
+		if (triggered()) return;
 	}
+#endif
 
-	sleep();
+	// A key, or a press over before it could be seen, wakes the dice too.
+	// Only a press or a shake rolls.
+	do {
+		sleep(figure);
+	} while (!triggered());
 }
 
 /*
- * Called when battery is plugged in
+ * Called when battery is plugged in. Shows the remaining charge.
  */
 static void welcome() {
-	PORTA = 0b01111111;
+#if FUEL_GAUGE
+	display_figure(gauge_figure);
+#else
+	display_figure(0b01111111);
+#endif
 	beep(200);
-	PORTA = 0;
+	display_figure(0);
 }
 
 int main(void) {
@@ -276,17 +1480,78 @@ int main(void) {
 	set_sleep_mode(SLEEP_MODE_PWR_DOWN); // Conserve power when sleeping
 	ADCSRA = 0; // Disable ADC
 
+#if CROSSFADE || FUEL_GAUGE || ACCELEROMETER || KEYPAD || LATENCY_REPORT
+	TCCR1B = (1 << CS10); // Free running Timer1 for the display, I2C and keypad clocks, and latencies
+#endif
+	sei();
+
+#if ACCELEROMETER
+	accel_init();
+#endif
+
+#if FUEL_GAUGE
+	gauge_init();
+#endif
+#if KEYPAD
+	keypad_arm();
+#endif
 	welcome();
 
-	int16_t previous_seed = 0;
+#if ADC_ENTROPY
+	int16_t seed = harvest_entropy();
+#else
 	int16_t seed = 1000;
+#endif
+	int16_t previous_seed = seed;
 	
 	while (true) {
+#if ADAPTIVE_DEBOUNCE
+		// What a press that turns out to be noise goes back to. Idle
+		// dimming and sleep blank the dots before the press comes.
+		uint8_t result = shown;
+#if FLOOR_LIGHT
+		bool floor_lit = TIMSK0 & (1 << TOIE0);
+#endif
+#endif
+		debug_mark(MARK_WAIT);
 		wait_or_sleep();
+#if FLOOR_LIGHT
+		fade_off();
+#endif
+		debug_mark(MARK_SPIN);
 		seed = spin(seed);
+#if ADAPTIVE_DEBOUNCE
+		if (spun_on_noise) {
+			display_figure(result);
+#if FLOOR_LIGHT
+			if (floor_lit) {
+				fade();
+			}
+#endif
+			continue;
+		}
+#endif
+#if ACCELEROMETER
+		if (accel_motion()) {
+			// Shaken, not pressed. Nothing was sampled while spinning
+			accel_capture();
+		}
+
+		uint16_t entropy = accel_entropy();
+		seed += entropy;
+		previous_seed += entropy;
+#endif
+		debug_mark(MARK_THROW);
 		if (!throw(seed, previous_seed)) {
+			// The face on display is the result
+			debug_mark(MARK_FADE);
+#if FLOOR_LIGHT
 			fade();
+#endif
 		}
+#if ACCELEROMETER
+		accel_rearm();
+#endif
 		previous_seed = seed;
 	}
 
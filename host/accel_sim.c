@@ -0,0 +1,396 @@
+/*
+ * Host simulation of the accelerometer driver
+ *
+ * Runs usi_i2c.c and accel.c against register-level stand-ins for Timer1,
+ * the USI in two-wire mode and a LIS3DH on the bus, then throws the dice
+ * with a range of strengths and shakes it awake. Exits with 1 if the
+ * sensor wasn't set up as accel.c means to, if harder throws don't give
+ * more energy or if a shake doesn't latch the wake-up interrupt.
+ *
+ * Usage: accel_sim
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "../usi_i2c.h"
+#include "../accel.h"
+
+#define SDA PA6
+#define SCL PA4
+
+#define LIS3DH_ADDRESS 0x18
+
+static uint64_t cycles;
+
+/* Timer1 and USI state that the firmware can't see directly */
+static bool compare_b_pending;
+static bool usi_overflow;
+static uint8_t usi_published;
+static uint8_t sda_latch = 0x80;
+
+/* Bus and sensor */
+static bool scl_line = true;
+static bool sda_line = true;
+static bool sensor_pulls_sda;
+
+enum { SENSOR_IDLE, SENSOR_ADDRESS, SENSOR_REGISTER, SENSOR_WRITE, SENSOR_READ } sensor_phase;
+static uint8_t sensor_bits;
+static uint8_t sensor_shift;
+static bool sensor_acking;
+static bool sensor_ignoring;
+static uint8_t sensor_pointer;
+static bool sensor_increment;
+static uint8_t sensor_registers[0x40];
+static bool int1_latched;
+
+static unsigned transfers;
+static unsigned start_conditions;
+static unsigned failures;
+
+/* Acceleration applied to the sensor, in milli-g */
+static double acceleration[3] = { 0, 0, 1000 };
+
+
+static void update_int1(void) {
+	if (int1_latched) {
+		PINA |= _BV(MOTION);
+	} else {
+		PINA &= ~_BV(MOTION);
+	}
+}
+
+static void update_outputs(void) {
+	for (int axis = 0; axis < 3; axis++) {
+		// +-16 g full scale, left justified, with a little noise in the low byte
+		int32_t value = lround(acceleration[axis] * 32768.0 / 16000.0);
+		if (value > 32767) value = 32767;
+		if (value < -32768) value = -32768;
+		value ^= (int32_t)(cycles * 2654435761u >> 20) & 0x3F;
+		sensor_registers[0x28 + axis * 2] = (uint8_t)value;
+		sensor_registers[0x29 + axis * 2] = (uint8_t)(value >> 8);
+	}
+
+	// High event on any axis
+	uint8_t threshold = sensor_registers[0x32] & 0x7F;
+	bool armed = sensor_registers[0x22] & 0x40;
+	for (int axis = 0; axis < 3 && armed && threshold; axis++) {
+		if (fabs(acceleration[axis]) > threshold * 186.0 &&
+				(sensor_registers[0x30] & (2 << axis * 2))) {
+			int1_latched = true;
+		}
+	}
+
+	update_int1();
+}
+
+static uint8_t sensor_read_register(void) {
+	uint8_t value = sensor_registers[sensor_pointer & 0x3F];
+	if ((sensor_pointer & 0x3F) == 0x31) {
+		value = int1_latched ? 0x40 : 0;
+		int1_latched = false;
+		update_int1();
+	}
+	if (sensor_increment) {
+		sensor_pointer++;
+	}
+	return value;
+}
+
+static void sensor_byte_received(void) {
+	switch (sensor_phase) {
+	case SENSOR_ADDRESS:
+		if (sensor_shift >> 1 != LIS3DH_ADDRESS) {
+			sensor_ignoring = true;
+			sensor_phase = SENSOR_IDLE;
+			return;
+		}
+		sensor_phase = sensor_shift & 1 ? SENSOR_READ : SENSOR_REGISTER;
+		transfers++;
+		break;
+	case SENSOR_REGISTER:
+		sensor_pointer = sensor_shift & 0x7F;
+		sensor_increment = sensor_shift & 0x80;
+		sensor_phase = SENSOR_WRITE;
+		break;
+	case SENSOR_WRITE:
+		sensor_registers[sensor_pointer & 0x3F] = sensor_shift;
+		if (sensor_increment) {
+			sensor_pointer++;
+		}
+		break;
+	default:
+		return;
+	}
+
+	sensor_acking = true;
+	sensor_pulls_sda = true;
+}
+
+static void sensor_clock_rising(void) {
+	if (sensor_phase == SENSOR_IDLE || sensor_acking) {
+		return;
+	}
+
+	if (sensor_phase == SENSOR_READ) {
+		if (++sensor_bits == 9 && sda_line) {
+			// Not acknowledged, the master is done
+			sensor_phase = SENSOR_IDLE;
+		}
+		return;
+	}
+
+	sensor_shift = sensor_shift << 1 | sda_line;
+	sensor_bits++;
+}
+
+static void sensor_clock_falling(void) {
+	if (sensor_phase == SENSOR_IDLE && !sensor_acking) {
+		sensor_pulls_sda = false;
+		return;
+	}
+
+	if (sensor_acking) {
+		// The acknowledge bit has been clocked
+		sensor_acking = false;
+		sensor_pulls_sda = false;
+		sensor_bits = 0;
+		if (sensor_phase == SENSOR_READ) {
+			sensor_shift = sensor_read_register();
+			sensor_pulls_sda = !(sensor_shift & 0x80);
+		}
+		return;
+	}
+
+	if (sensor_phase == SENSOR_READ) {
+		if (sensor_bits < 8) {
+			sensor_pulls_sda = !(sensor_shift << sensor_bits & 0x80);
+		} else if (sensor_bits == 8) {
+			sensor_pulls_sda = false;
+		} else {
+			sensor_bits = 0;
+			sensor_shift = sensor_read_register();
+			sensor_pulls_sda = !(sensor_shift & 0x80);
+		}
+		return;
+	}
+
+	if (sensor_bits == 8) {
+		sensor_byte_received();
+	}
+}
+
+/*
+ * Picks up register writes made by the firmware since the last call and
+ * moves the bus forward.
+ */
+static void peripherals(void) {
+	// Writing ones clears the flags
+	if (TIFR1 & _BV(OCF1B)) {
+		compare_b_pending = false;
+	}
+	TIFR1 = 0;
+
+	if (USISR != usi_published) {
+		if (USISR & _BV(USIOIF)) {
+			usi_overflow = false;
+		}
+	}
+
+	if (USICR & _BV(USITC)) {
+		USICR &= ~_BV(USITC);
+		PORTA ^= _BV(SCL);
+
+		uint8_t counter = (USISR + 1) & 0x0F;
+		if (!counter) {
+			usi_overflow = true;
+		}
+		USISR = (USISR & 0xF0) | counter;
+	}
+
+	usi_published = USISR = (usi_overflow ? _BV(USIOIF) : 0) | (USISR & 0x0F);
+
+	if (!scl_line) {
+		// Output latch follows the shift register only while the clock is low
+		sda_latch = USIDR & 0x80;
+	}
+	bool scl = !((DDRA & _BV(SCL)) && !(PORTA & _BV(SCL)));
+	bool master_pulls_sda = (DDRA & _BV(SDA)) && (!(PORTA & _BV(SDA)) || !sda_latch);
+	bool sda = !(master_pulls_sda || sensor_pulls_sda);
+
+	if (scl && scl_line && sda != sda_line) {
+		if (!sda) {
+			start_conditions++;
+			sensor_phase = SENSOR_ADDRESS;
+			sensor_ignoring = false;
+		} else {
+			sensor_phase = SENSOR_IDLE;
+		}
+		sensor_bits = 0;
+		sensor_shift = 0;
+		sensor_acking = false;
+		sensor_pulls_sda = false;
+		sda = !master_pulls_sda;
+	}
+
+	bool rising = scl && !scl_line;
+	bool falling = !scl && scl_line;
+	sda_line = sda;
+	scl_line = scl;
+
+	if (rising) {
+		// The USI samples the line into the shift register
+		if (USICR & _BV(USIWM1)) {
+			USIDR = USIDR << 1 | sda_line;
+		}
+		sensor_clock_rising();
+	} else if (falling) {
+		sensor_clock_falling();
+	}
+
+	sda_line = !(master_pulls_sda || sensor_pulls_sda);
+}
+
+static void run_isr(void (*isr)(void)) {
+	host_interrupts_enabled = 0;
+	isr();
+	peripherals();
+	host_interrupts_enabled = 1;
+}
+
+static void dispatch(void) {
+	while (host_interrupts_enabled) {
+		if (compare_b_pending && (TIMSK1 & _BV(OCIE1B))) {
+			compare_b_pending = false;
+			run_isr(TIM1_COMPB_vect);
+		} else if (usi_overflow && (USICR & _BV(USIOIE))) {
+			run_isr(USI_OVF_vect);
+			peripherals();
+		} else {
+			break;
+		}
+	}
+}
+
+void host_delay_us(double us) {
+	uint64_t end = cycles + (uint64_t)(us * F_CPU / 1000000.0 + 0.5);
+	while (cycles < end) {
+		cycles++;
+		if (TCCR1B & _BV(CS10)) {
+			TCNT1++;
+			if (TCNT1 == OCR1B) {
+				compare_b_pending = true;
+			}
+		}
+		if (cycles % 1000 == 0) {
+			update_outputs();
+		}
+		peripherals();
+		dispatch();
+	}
+}
+
+void host_sleep(void) {
+}
+
+static void expect(bool ok, const char *what) {
+	if (!ok) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+/*
+ * Spins for 'ms' milliseconds like spin() does, shaking the sensor up to a
+ * peak of 'peak_g' over 40 ms and holding it for the last 60 ms
+ */
+static void throw_with(double peak_g, unsigned ms) {
+	for (unsigned t = 0; t < ms; t++) {
+		double g = t + 100 < ms ? 1.0 : t + 60 >= ms ? peak_g :
+			1.0 + (peak_g - 1.0) * (t + 100 - ms) / 40.0;
+		acceleration[0] = g * 600;
+		acceleration[1] = g * -300;
+		acceleration[2] = g * 750;
+		accel_poll();
+		host_delay_us(800);
+		host_delay_us(200);
+	}
+
+	acceleration[0] = acceleration[1] = 0;
+	acceleration[2] = 1000;
+}
+
+int main(void) {
+	DDRA = 0b01111111;
+	sei();
+	accel_init();
+
+	printf("init: %u transfers, CTRL_REG1=%02x CTRL_REG3=%02x CTRL_REG4=%02x INT1_CFG=%02x INT1_THS=%02x\n",
+		transfers, sensor_registers[0x20], sensor_registers[0x22], sensor_registers[0x23],
+		sensor_registers[0x30], sensor_registers[0x32]);
+	expect(transfers == 7, "accel_init() writes seven registers");
+	expect(sensor_registers[0x20] == 0x57, "CTRL_REG1: 100 Hz, all axes");
+	expect(sensor_registers[0x22] == 0x40, "CTRL_REG3: IA1 on INT1");
+	expect(sensor_registers[0x23] == 0x30, "CTRL_REG4: +-16 g");
+	expect(sensor_registers[0x24] == 0x08, "CTRL_REG5: INT1 latched");
+	expect(sensor_registers[0x30] == 0x2A, "INT1_CFG: high events on all axes");
+	expect(sensor_registers[0x32] == 0x08, "INT1_THS: about 1.5 g");
+
+	printf("%8s %8s %8s %10s\n", "peak g", "energy", "delay", "entropy");
+	const double strengths[] = { 1, 1.5, 2, 3, 4, 6, 8, 12 };
+	uint16_t last_energy = 0, first_entropy = 0;
+	bool entropy_varies = false;
+	for (unsigned i = 0; i < sizeof(strengths) / sizeof(strengths[0]); i++) {
+		unsigned before = transfers;
+		throw_with(strengths[i], 300);
+		// Two addressings per read: one to set the register, one to read
+		expect((transfers - before) / 2 <= 300 / 40 + 1, "spinning reads the sensor every 40 ms at most");
+		accel_rearm();
+		uint16_t energy = accel_energy();
+		uint16_t entropy = accel_entropy();
+		printf("%8.1f %8u %8u %10u\n", strengths[i], energy, 68 - energy * 64 / 1024, entropy);
+
+		expect(energy >= last_energy, "a harder throw gives at least as much energy");
+		expect(energy <= 1023, "energy is at most 1023");
+		last_energy = energy;
+		if (i == 0) {
+			expect(energy == 0, "resting at 1 g gives no energy");
+			first_entropy = entropy;
+		}
+		entropy_varies = entropy_varies || entropy != first_entropy;
+	}
+	expect(last_energy == 1023, "a 12 g throw saturates the energy");
+	expect(entropy_varies, "entropy differs from throw to throw");
+
+	// Shake it while asleep
+	accel_rearm();
+	bool before = accel_motion();
+	acceleration[0] = 3000;
+	host_delay_us(20000);
+	bool after = accel_motion();
+	accel_capture();
+	uint16_t energy = accel_energy();
+	acceleration[0] = 0;
+	host_delay_us(20000);
+	accel_rearm();
+
+	printf("wake: motion %d -> %d, captured energy %u, cleared %d\n",
+		before, after, energy, !accel_motion());
+	printf("%u start conditions, %.1f ms simulated\n", start_conditions, cycles / 1000.0);
+	expect(!before, "no motion latched at rest");
+	expect(after, "a shake latches the wake-up interrupt");
+	expect(energy > 0, "the captured burst has the shake in it");
+	expect(!accel_motion(), "accel_rearm() clears the latch");
+
+	if (failures) {
+		printf("%u checks failed\n", failures);
+		return 1;
+	}
+	printf("ok\n");
+	return 0;
+}
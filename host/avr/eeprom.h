@@ -0,0 +1,33 @@
+/*
+ * Host stand-in for <avr/eeprom.h>
+ *
+ * EEMEM variables live in ordinary memory; a harness can inspect or
+ * preload them.
+ */
+
+#ifndef HOST_AVR_EEPROM_H
+#define HOST_AVR_EEPROM_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define EEMEM
+
+static inline uint8_t eeprom_read_byte(const uint8_t *address) { return *address; }
+static inline uint16_t eeprom_read_word(const uint16_t *address) { return *address; }
+static inline uint32_t eeprom_read_dword(const uint32_t *address) { return *address; }
+static inline void eeprom_read_block(void *destination, const void *source, size_t size) { memcpy(destination, source, size); }
+
+static inline void eeprom_update_byte(uint8_t *address, uint8_t value) { *address = value; }
+static inline void eeprom_update_word(uint16_t *address, uint16_t value) { *address = value; }
+static inline void eeprom_update_dword(uint32_t *address, uint32_t value) { *address = value; }
+static inline void eeprom_update_block(const void *source, void *destination, size_t size) { memcpy(destination, source, size); }
+
+#define eeprom_write_byte eeprom_update_byte
+#define eeprom_write_word eeprom_update_word
+#define eeprom_write_dword eeprom_update_dword
+#define eeprom_write_block eeprom_update_block
+
+#define eeprom_busy_wait()
+
+#endif
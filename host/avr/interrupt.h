@@ -0,0 +1,42 @@
+/*
+ * Host stand-in for <avr/interrupt.h>
+ *
+ * Interrupt handlers become ordinary functions named after their vectors,
+ * so a harness can call them when it decides the peripheral fired.
+ */
+
+#ifndef HOST_AVR_INTERRUPT_H
+#define HOST_AVR_INTERRUPT_H
+
+#include <avr/io.h>
+
+extern volatile uint8_t host_interrupts_enabled;
+
+#define sei() (host_interrupts_enabled = 1)
+#define cli() (host_interrupts_enabled = 0)
+
+#define ISR_BLOCK
+#define ISR_NOBLOCK
+#define ISR_NAKED
+#define ISR_ALIASOF(vector)
+#define ISR(vector, ...) void vector(void)
+#define EMPTY_INTERRUPT(vector) void vector(void) { }
+
+void INT0_vect(void);
+void PCINT0_vect(void);
+void PCINT1_vect(void);
+void WDT_vect(void);
+void TIM1_CAPT_vect(void);
+void TIM1_COMPA_vect(void);
+void TIM1_COMPB_vect(void);
+void TIM1_OVF_vect(void);
+void TIM0_COMPA_vect(void);
+void TIM0_COMPB_vect(void);
+void TIM0_OVF_vect(void);
+void ANA_COMP_vect(void);
+void ADC_vect(void);
+void EE_RDY_vect(void);
+void USI_STR_vect(void);
+void USI_OVF_vect(void);
+
+#endif
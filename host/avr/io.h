@@ -0,0 +1,231 @@
+/*
+ * Host stand-in for <avr/io.h>
+ *
+ * The ATtiny44 I/O registers are plain variables (see avr_regs.c). A host
+ * harness plays the part of the peripherals by inspecting and updating them
+ * between calls into the firmware.
+ */
+
+#ifndef HOST_AVR_IO_H
+#define HOST_AVR_IO_H
+
+#include <stdint.h>
+
+#ifndef HOST_REG
+#define HOST_REG(type, name) extern volatile type name;
+#endif
+
+#define HOST_REGISTERS \
+	HOST_REG(uint8_t, PINA) HOST_REG(uint8_t, DDRA) HOST_REG(uint8_t, PORTA) \
+	HOST_REG(uint8_t, PINB) HOST_REG(uint8_t, DDRB) HOST_REG(uint8_t, PORTB) \
+	HOST_REG(uint8_t, TCCR0A) HOST_REG(uint8_t, TCCR0B) HOST_REG(uint8_t, TCNT0) \
+	HOST_REG(uint8_t, OCR0A) HOST_REG(uint8_t, OCR0B) \
+	HOST_REG(uint8_t, TIMSK0) HOST_REG(uint8_t, TIFR0) \
+	HOST_REG(uint8_t, TCCR1A) HOST_REG(uint8_t, TCCR1B) HOST_REG(uint8_t, TCCR1C) \
+	HOST_REG(uint16_t, TCNT1) HOST_REG(uint16_t, OCR1A) HOST_REG(uint16_t, OCR1B) \
+	HOST_REG(uint16_t, ICR1) HOST_REG(uint8_t, TIMSK1) HOST_REG(uint8_t, TIFR1) \
+	HOST_REG(uint8_t, GIMSK) HOST_REG(uint8_t, GIFR) \
+	HOST_REG(uint8_t, PCMSK0) HOST_REG(uint8_t, PCMSK1) \
+	HOST_REG(uint8_t, MCUCR) HOST_REG(uint8_t, MCUSR) HOST_REG(uint8_t, WDTCSR) \
+	HOST_REG(uint8_t, ADMUX) HOST_REG(uint8_t, ADCSRA) HOST_REG(uint8_t, ADCSRB) \
+	HOST_REG(uint16_t, ADC) HOST_REG(uint8_t, DIDR0) HOST_REG(uint8_t, ACSR) \
+	HOST_REG(uint8_t, USICR) HOST_REG(uint8_t, USISR) HOST_REG(uint8_t, USIDR) \
+	HOST_REG(uint8_t, USIBR) \
+	HOST_REG(uint8_t, EECR) HOST_REG(uint8_t, EEDR) HOST_REG(uint16_t, EEAR) \
+	HOST_REG(uint8_t, PRR) HOST_REG(uint8_t, OSCCAL) HOST_REG(uint8_t, CLKPR) \
+	HOST_REG(uint8_t, GPIOR0) HOST_REG(uint8_t, GPIOR1) HOST_REG(uint8_t, GPIOR2) \
+	HOST_REG(uint8_t, SREG)
+
+HOST_REGISTERS
+
+#define ADCL ((uint8_t)(ADC & 0xFF))
+#define ADCH ((uint8_t)(ADC >> 8))
+
+#ifndef _BV
+#define _BV(bit) (1 << (bit))
+#endif
+
+#define bit_is_set(reg, bit) ((reg) & _BV(bit))
+#define bit_is_clear(reg, bit) (!((reg) & _BV(bit)))
+#define loop_until_bit_is_set(reg, bit) do { } while (bit_is_clear(reg, bit))
+#define loop_until_bit_is_clear(reg, bit) do { } while (bit_is_set(reg, bit))
+
+/* Port pins */
+#define PA0 0
+#define PA1 1
+#define PA2 2
+#define PA3 3
+#define PA4 4
+#define PA5 5
+#define PA6 6
+#define PA7 7
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+
+/* Timer/Counter0 */
+#define COM0A1 7
+#define COM0A0 6
+#define COM0B1 5
+#define COM0B0 4
+#define WGM01 1
+#define WGM00 0
+#define FOC0A 7
+#define FOC0B 6
+#define WGM02 3
+#define CS02 2
+#define CS01 1
+#define CS00 0
+#define OCIE0B 2
+#define OCIE0A 1
+#define TOIE0 0
+#define OCF0B 2
+#define OCF0A 1
+#define TOV0 0
+
+/* Timer/Counter1 */
+#define COM1A1 7
+#define COM1A0 6
+#define COM1B1 5
+#define COM1B0 4
+#define WGM11 1
+#define WGM10 0
+#define ICNC1 7
+#define ICES1 6
+#define WGM13 4
+#define WGM12 3
+#define CS12 2
+#define CS11 1
+#define CS10 0
+#define ICIE1 5
+#define OCIE1B 2
+#define OCIE1A 1
+#define TOIE1 0
+#define ICF1 5
+#define OCF1B 2
+#define OCF1A 1
+#define TOV1 0
+
+/* External and pin change interrupts */
+#define INT0 6
+#define PCIE1 5
+#define PCIE0 4
+#define INTF0 6
+#define PCIF1 5
+#define PCIF0 4
+#define PCINT0 0
+#define PCINT1 1
+#define PCINT2 2
+#define PCINT3 3
+#define PCINT4 4
+#define PCINT5 5
+#define PCINT6 6
+#define PCINT7 7
+#define PCINT8 0
+#define PCINT9 1
+#define PCINT10 2
+#define PCINT11 3
+
+/* MCU control and status */
+#define BODS 7
+#define PUD 6
+#define SE 5
+#define SM1 4
+#define SM0 3
+#define BODSE 2
+#define ISC01 1
+#define ISC00 0
+#define WDRF 3
+#define BORF 2
+#define EXTRF 1
+#define PORF 0
+
+/* Watchdog */
+#define WDIF 7
+#define WDIE 6
+#define WDP3 5
+#define WDCE 4
+#define WDE 3
+#define WDP2 2
+#define WDP1 1
+#define WDP0 0
+
+/* ADC */
+#define REFS1 7
+#define REFS0 6
+#define MUX5 5
+#define MUX4 4
+#define MUX3 3
+#define MUX2 2
+#define MUX1 1
+#define MUX0 0
+#define ADEN 7
+#define ADSC 6
+#define ADATE 5
+#define ADIF 4
+#define ADIE 3
+#define ADPS2 2
+#define ADPS1 1
+#define ADPS0 0
+#define BIN 7
+#define ACME 6
+#define ADLAR 4
+#define ADTS2 2
+#define ADTS1 1
+#define ADTS0 0
+#define ADC7D 7
+#define ADC6D 6
+#define ADC5D 5
+#define ADC4D 4
+#define ADC3D 3
+#define ADC2D 2
+#define ADC1D 1
+#define ADC0D 0
+
+/* Analog comparator */
+#define ACD 7
+#define ACBG 6
+#define ACO 5
+#define ACI 4
+#define ACIE 3
+#define ACIC 2
+#define ACIS1 1
+#define ACIS0 0
+
+/* USI */
+#define USISIE 7
+#define USIOIE 6
+#define USIWM1 5
+#define USIWM0 4
+#define USICS1 3
+#define USICS0 2
+#define USICLK 1
+#define USITC 0
+#define USISIF 7
+#define USIOIF 6
+#define USIPF 5
+#define USIDC 4
+#define USICNT3 3
+#define USICNT2 2
+#define USICNT1 1
+#define USICNT0 0
+
+/* EEPROM */
+#define EEPM1 5
+#define EEPM0 4
+#define EERIE 3
+#define EEMPE 2
+#define EEPE 1
+#define EERE 0
+
+/* Power reduction */
+#define PRTIM1 3
+#define PRTIM0 2
+#define PRUSI 1
+#define PRADC 0
+
+#define E2END 255
+#define RAMEND 0x15F
+
+#endif
@@ -0,0 +1,27 @@
+/*
+ * Host stand-in for <avr/sleep.h>
+ *
+ * sleep_cpu() hands control to the harness, which decides when (and
+ * whether) a wake-up interrupt arrives.
+ */
+
+#ifndef HOST_AVR_SLEEP_H
+#define HOST_AVR_SLEEP_H
+
+#include <avr/io.h>
+
+#define SLEEP_MODE_IDLE 0
+#define SLEEP_MODE_ADC _BV(SM0)
+#define SLEEP_MODE_PWR_DOWN _BV(SM1)
+#define SLEEP_MODE_STANDBY (_BV(SM0) | _BV(SM1))
+
+void host_sleep(void);
+
+#define set_sleep_mode(mode) (MCUCR = (MCUCR & ~(_BV(SM0) | _BV(SM1))) | (mode))
+#define sleep_enable() (MCUCR |= _BV(SE))
+#define sleep_disable() (MCUCR &= ~_BV(SE))
+#define sleep_bod_disable()
+#define sleep_cpu() host_sleep()
+#define sleep_mode() do { sleep_enable(); sleep_cpu(); sleep_disable(); } while (0)
+
+#endif
@@ -0,0 +1,276 @@
+/*
+ * Translates dice.elf into C for avrsim
+ *
+ * Follows the control flow from the vectors and the function symbols,
+ * splits the code into basic blocks and writes each block as a case of a
+ * switch on the program counter: the block's instructions as calls to
+ * avr_execute() with constant operands, which the compiler reduces to the
+ * few lines each of them does. A block ends at control flow and at the
+ * instructions that can change what the peripherals do next (I/O writes,
+ * sei, sleep, wdr); stores through pointers check for an I/O write, and
+ * writes to SREG for an interrupt they let in.
+ *
+ * A block only runs if it can't reach the next peripheral event, so
+ * events are seen at the same instruction as by the interpreter. Other
+ * cases, and code only reached through ijmp and icall, fall back to
+ * avr_step().
+ *
+ * The countdown loops of _delay_us() and _delay_ms() (subi/sbci chains,
+ * sbiw or dec, and brne back to the start) are fast-forwarded: all but
+ * the last iteration that fits before the next event are done at once.
+ *
+ * Usage: avr2c dice.elf > dice_translated.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avr_decode.h"
+#include "avr_sim.h"
+
+#define WORDS (AVR_FLASH_SIZE / 2)
+#define MAX_COUNTER 4
+
+static struct avr_insn code[WORDS];
+static bool reached[WORDS];
+static bool leader[WORDS];
+
+static uint16_t next_address(const struct avr_insn *insn) {
+	return (insn->address + insn->words * 2) & (AVR_FLASH_SIZE - 1);
+}
+
+static uint8_t skip_words(uint16_t address) {
+	return code[next_address(&code[address >> 1]) >> 1].words;
+}
+
+static void reach(uint16_t *work, unsigned *count, uint16_t address, bool starts_block) {
+	address &= AVR_FLASH_SIZE - 1;
+	if (starts_block) {
+		leader[address >> 1] = true;
+	}
+	if (!reached[address >> 1]) {
+		reached[address >> 1] = true;
+		work[(*count)++] = address;
+	}
+}
+
+/* Instructions after which a block can't go on */
+static bool ends_block(const struct avr_insn *insn) {
+	switch (insn->op) {
+	case OP_OUT: case OP_SBI: case OP_CBI:
+		return !avr_cpu_register(insn->d);
+	case OP_SLEEP: case OP_WDR: case OP_SPM:
+		return true;
+	case OP_STS:
+		return insn->k < AVR_RAM_START && !(insn->k >= 0x20 && avr_cpu_register(insn->k - 0x20));
+	case OP_BSET: case OP_BCLR:
+		return insn->d == SREG_I;
+	}
+	return insn->flow != FLOW_NEXT;
+}
+
+static void explore(const struct avr_image *image) {
+	static uint16_t work[WORDS];
+	unsigned count = 0;
+
+	for (uint16_t address = 0; address < AVR_FLASH_SIZE; address += 2) {
+		avr_decode(image->flash, address, &code[address >> 1]);
+	}
+	for (unsigned vector = 0; vector < AVR_VECTORS; vector++) {
+		reach(work, &count, vector * 2, true);
+	}
+	for (unsigned i = 0; i < image->symbol_count; i++) {
+		if (image->symbols[i].function && image->symbols[i].address < image->flash_used) {
+			reach(work, &count, image->symbols[i].address, true);
+		}
+	}
+
+	while (count > 0) {
+		const struct avr_insn *insn = &code[work[--count] >> 1];
+		uint16_t next = next_address(insn);
+		switch (insn->flow) {
+		case FLOW_NEXT:
+			reach(work, &count, next, ends_block(insn));
+			break;
+		case FLOW_BRANCH:
+			reach(work, &count, next, true);
+			reach(work, &count, insn->target, true);
+			break;
+		case FLOW_SKIP:
+			reach(work, &count, next, true);
+			reach(work, &count, next + skip_words(insn->address) * 2, true);
+			break;
+		case FLOW_JUMP:
+			reach(work, &count, insn->target, true);
+			break;
+		case FLOW_CALL:
+			reach(work, &count, insn->target, true);
+			reach(work, &count, next, true);
+			break;
+		case FLOW_INDIRECT_CALL:
+			reach(work, &count, next, true);
+			break;
+		}
+	}
+}
+
+/*
+ * Stores through pointers, which may turn out to be I/O writes, writes to
+ * SREG, which may let an interrupt in, and to GPIOR0, where a marker may
+ * want to stop
+ */
+static bool may_stop(const struct avr_insn *insn) {
+	switch (insn->op) {
+	case OP_OUT: case OP_STS: case OP_SBI: case OP_CBI:
+		return true;
+	case OP_STD_Y: case OP_STD_Z: case OP_ST_X: case OP_ST_XINC: case OP_ST_XDEC:
+	case OP_ST_YINC: case OP_ST_YDEC: case OP_ST_ZINC: case OP_ST_ZDEC:
+		return true;
+	}
+	return false;
+}
+
+static uint8_t max_cycles(const struct avr_insn *insn) {
+	if (insn->flow == FLOW_BRANCH) {
+		return insn->cycles + 1;
+	}
+	if (insn->flow == FLOW_SKIP) {
+		return insn->cycles + 2;
+	}
+	return insn->cycles;
+}
+
+/*
+ * A _delay_us() countdown: the counter's registers, least significant
+ * first, or 0 if the block isn't one
+ */
+static unsigned delay_loop(const struct avr_insn *block, unsigned length, uint8_t *counter) {
+	const struct avr_insn *last = &block[length - 1];
+	if (last->op != OP_BRBC || last->d != SREG_Z || last->target != block[0].address) {
+		return 0;
+	}
+	unsigned bytes = 0;
+	for (unsigned i = 0; i + 1 < length; i++) {
+		const struct avr_insn *insn = &block[i];
+		if (insn->op == OP_NOP) {
+			continue;
+		}
+		if (bytes == 0 && (insn->op == OP_SUBI || insn->op == OP_DEC) && (insn->op == OP_DEC || insn->k == 1)) {
+			counter[bytes++] = insn->d;
+		} else if (bytes == 0 && insn->op == OP_SBIW && insn->k == 1) {
+			counter[bytes++] = insn->d;
+			counter[bytes++] = insn->d + 1;
+		} else if (bytes > 0 && block[0].op != OP_DEC && insn->op == OP_SBCI && insn->k == 0 &&
+				bytes < MAX_COUNTER) {
+			counter[bytes++] = insn->d;
+		} else {
+			return 0;
+		}
+	}
+	return bytes;
+}
+
+static void write_delay_loop(const uint8_t *counter, unsigned bytes, unsigned cycles) {
+	printf("\t\t{\n");
+	printf("\t\t\tuint64_t left = ");
+	for (unsigned i = 0; i < bytes; i++) {
+		printf("%s(uint64_t)sim->s.data[%u] << %u", i ? " | " : "", counter[i], i * 8);
+	}
+	printf(";\n");
+	printf("\t\t\tuint64_t skip = (left ? left : 1ULL << %u) - 1;\n", bytes * 8);
+	printf("\t\t\tuint64_t fit = (room - %u) / %u;\n", cycles, cycles);
+	printf("\t\t\tif (skip > fit) {\n\t\t\t\tskip = fit;\n\t\t\t}\n");
+	printf("\t\t\tleft -= skip;\n");
+	for (unsigned i = 0; i < bytes; i++) {
+		printf("\t\t\tsim->s.data[%u] = left >> %u;\n", counter[i], i * 8);
+	}
+	printf("\t\t\tsim->s.cycles += skip * %u;\n", cycles);
+	printf("\t\t\tsim->skipped += skip * %u;\n", cycles);
+	printf("\t\t}\n");
+}
+
+static void write_block(const struct avr_image *image, uint16_t start) {
+	static struct avr_insn block[WORDS];
+	unsigned length = 0, cycles = 0;
+	uint16_t address = start;
+
+	for (;;) {
+		const struct avr_insn *insn = &code[address >> 1];
+		block[length++] = *insn;
+		cycles += max_cycles(insn);
+		address = next_address(insn);
+		if (ends_block(insn) || leader[address >> 1] || !reached[address >> 1]) {
+			break;
+		}
+	}
+
+	const struct avr_symbol *symbol = avr_symbol_at(image, start);
+	printf("\tcase 0x%04X:", start);
+	if (symbol && symbol->address == start) {
+		printf(" // %s", symbol->name);
+	}
+	printf("\n\t\tif (room < %u) {\n\t\t\tgoto step;\n\t\t}\n", cycles);
+
+	uint8_t counter[MAX_COUNTER];
+	unsigned bytes = delay_loop(block, length, counter);
+	if (bytes) {
+		write_delay_loop(counter, bytes, cycles);
+	}
+	for (unsigned i = 0; i < length; i++) {
+		const struct avr_insn *insn = &block[i];
+		printf("\t\tX(%u, %u, %u, 0x%X, 0x%04X, 0x%04X, %u, %u, %u); // %s\n", insn->op, insn->d, insn->r,
+			insn->k, insn->address, insn->target, insn->words, insn->cycles, skip_words(insn->address),
+			avr_op_names[insn->op]);
+		if (may_stop(insn) && i + 1 < length) {
+			printf("\t\tif (sim->stop) {\n\t\t\tbreak;\n\t\t}\n");
+		}
+	}
+	printf("\t\tbreak;\n");
+}
+
+int main(int argc, char **argv) {
+	static struct avr_image image;
+	char error[256];
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: avr2c dice.elf > dice_translated.c\n");
+		return 2;
+	}
+	if (!avr_load_elf(argv[1], &image, error, sizeof(error))) {
+		fprintf(stderr, "avr2c: %s\n", error);
+		return 1;
+	}
+	explore(&image);
+
+	printf("/* Translated from %s by avr2c, don't edit */\n\n", argv[1]);
+	printf("#include \"avr_sim.h\"\n\n");
+	printf("const uint32_t avr_translation_checksum = 0x%08Xu;\n\n", avr_checksum(&image));
+	printf("#define X(op, d, r, k, address, target, words, cycles, skip) \\\n");
+	printf("\tavr_execute(sim, op, d, r, k, address, target, words, cycles, skip)\n\n");
+	printf("/* One block, or one step of the interpreter where no block fits */\n");
+	printf("void avr_translated_block(struct avr_sim *sim, uint64_t until) {\n");
+	printf("\tif (!avr_block_ready(sim)) {\n\t\tavr_step(sim, until);\n\t\treturn;\n\t}\n");
+	printf("\tuint64_t horizon = sim->next_event < until ? sim->next_event : until;\n");
+	printf("\tuint64_t room = horizon > sim->s.cycles ? horizon - sim->s.cycles : 0;\n");
+	printf("\tsim->stop = false;\n");
+	printf("\tswitch (sim->s.pc) {\n");
+
+	unsigned blocks = 0;
+	for (unsigned word = 0; word < WORDS; word++) {
+		if (reached[word] && leader[word]) {
+			write_block(&image, word * 2);
+			blocks++;
+		}
+	}
+
+	printf("\tdefault:\n\tstep:\n\t\tavr_step(sim, until);\n\t\treturn;\n");
+	printf("\t}\n");
+	printf("\tif (sim->s.cycles >= sim->next_event) {\n\t\tavr_update(sim);\n\t}\n");
+	printf("}\n\n");
+	printf("void avr_translated_run(struct avr_sim *sim, uint64_t until) {\n");
+	printf("\twhile (sim->s.cycles < until && !sim->fault) {\n\t\tavr_translated_block(sim, until);\n\t}\n}\n");
+
+	fprintf(stderr, "avr2c: %u blocks\n", blocks);
+	return 0;
+}
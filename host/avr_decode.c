@@ -0,0 +1,425 @@
+/*
+ * AVR instruction decoding and ELF loading, see avr_decode.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avr_decode.h"
+
+const char *const avr_op_names[OP_COUNT] = {
+	"?",
+	"nop", "movw", "mul", "muls", "mulsu", "fmul", "fmuls", "fmulsu",
+	"cpc", "sbc", "add", "cpse", "cp", "sub", "adc",
+	"and", "eor", "or", "mov",
+	"cpi", "sbci", "subi", "ori", "andi", "ldi",
+	"ldd", "ldd", "std", "std",
+	"lds", "sts",
+	"ld", "ld", "ld", "ld", "ld", "ld", "ld",
+	"st", "st", "st", "st", "st", "st", "st",
+	"lpm", "lpm", "lpm", "elpm", "spm",
+	"push", "pop",
+	"com", "neg", "swap", "inc", "asr", "lsr", "ror", "dec",
+	"bset", "bclr",
+	"adiw", "sbiw",
+	"cbi", "sbic", "sbi", "sbis",
+	"in", "out",
+	"rjmp", "rcall", "jmp", "call", "ijmp", "icall",
+	"ret", "reti",
+	"brbs", "brbc",
+	"bld", "bst", "sbrc", "sbrs",
+	"sleep", "break", "wdr"
+};
+
+const char *const avr_vector_names[AVR_VECTORS] = {
+	"RESET", "INT0", "PCINT0", "PCINT1", "WDT", "TIM1_CAPT", "TIM1_COMPA", "TIM1_COMPB",
+	"TIM1_OVF", "TIM0_COMPA", "TIM0_COMPB", "TIM0_OVF", "ANA_COMP", "ADC", "EE_RDY",
+	"USI_STR", "USI_OVF"
+};
+
+static uint16_t word_at(const uint8_t *flash, uint16_t address) {
+	return flash[address] | flash[address + 1] << 8;
+}
+
+static void set(struct avr_insn *insn, enum avr_op op, uint8_t cycles) {
+	insn->op = op;
+	insn->cycles = cycles;
+}
+
+/*
+ * Decodes the instruction at 'address'. Returns false for unknown opcodes,
+ * which are then one word long.
+ */
+bool avr_decode(const uint8_t *flash, uint16_t address, struct avr_insn *insn) {
+	uint16_t w = word_at(flash, address);
+	uint8_t d5 = (w >> 4) & 0x1F;
+	uint8_t r5 = (w & 0x0F) | ((w >> 5) & 0x10);
+	uint8_t d4 = 16 + ((w >> 4) & 0x0F);
+	uint8_t k8 = (w & 0x0F) | ((w >> 4) & 0xF0);
+
+	memset(insn, 0, sizeof(*insn));
+	insn->address = address;
+	insn->words = 1;
+	insn->flow = FLOW_NEXT;
+
+	switch (w >> 12) {
+	case 0x0:
+		if (w == 0) {
+			set(insn, OP_NOP, 1);
+		} else if ((w & 0xFF00) == 0x0100) {
+			set(insn, OP_MOVW, 1);
+			insn->d = ((w >> 4) & 0x0F) * 2;
+			insn->r = (w & 0x0F) * 2;
+		} else if ((w & 0xFF00) == 0x0200) {
+			set(insn, OP_MULS, 2);
+			insn->d = d4;
+			insn->r = 16 + (w & 0x0F);
+		} else if ((w & 0xFF00) == 0x0300) {
+			static const uint8_t ops[] = { OP_MULSU, OP_FMUL, OP_FMULS, OP_FMULSU };
+			set(insn, ops[(w >> 6 & 2) | (w >> 3 & 1)], 2);
+			insn->d = 16 + ((w >> 4) & 7);
+			insn->r = 16 + (w & 7);
+		} else {
+			static const uint8_t ops[] = { 0, OP_CPC, OP_SBC, OP_ADD };
+			set(insn, ops[(w >> 10) & 3], 1);
+			insn->d = d5;
+			insn->r = r5;
+		}
+		break;
+	case 0x1:
+	case 0x2: {
+		static const uint8_t ops[] = { OP_AND, OP_EOR, OP_OR, OP_MOV, OP_CPSE, OP_CP, OP_SUB, OP_ADC };
+		set(insn, ops[(w >> 10) & 7], 1);
+		insn->d = d5;
+		insn->r = r5;
+		if (insn->op == OP_CPSE) {
+			insn->flow = FLOW_SKIP;
+		}
+		break;
+	}
+	case 0x3: case 0x4: case 0x5: case 0x6: case 0x7: case 0xE: {
+		static const uint8_t ops[16] = { [3] = OP_CPI, OP_SBCI, OP_SUBI, OP_ORI, OP_ANDI, [14] = OP_LDI };
+		set(insn, ops[w >> 12], 1);
+		insn->d = d4;
+		insn->k = k8;
+		break;
+	}
+	case 0x8: case 0xA: {
+		// ldd and std, ld and st through Y and Z without displacement
+		uint8_t q = (w & 7) | ((w >> 7) & 0x18) | ((w >> 8) & 0x20);
+		bool y = w & 0x0008;
+		bool store = w & 0x0200;
+		set(insn, store ? (y ? OP_STD_Y : OP_STD_Z) : (y ? OP_LDD_Y : OP_LDD_Z), 2);
+		insn->d = d5;
+		insn->k = q;
+		break;
+	}
+	case 0x9:
+		if ((w & 0xFC00) == 0x9000) {
+			bool store = w & 0x0200;
+			insn->d = d5;
+			switch (w & 0x000F) {
+			case 0x0:
+				set(insn, store ? OP_STS : OP_LDS, 2);
+				insn->words = 2;
+				insn->k = word_at(flash, address + 2);
+				break;
+			case 0x1: set(insn, store ? OP_ST_ZINC : OP_LD_ZINC, 2); break;
+			case 0x2: set(insn, store ? OP_ST_ZDEC : OP_LD_ZDEC, 2); break;
+			case 0x4: if (!store) set(insn, OP_LPM_Z, 3); break;
+			case 0x5: if (!store) set(insn, OP_LPM_ZINC, 3); break;
+			case 0x6: case 0x7: if (!store) set(insn, OP_ELPM, 3); break;
+			case 0x9: set(insn, store ? OP_ST_YINC : OP_LD_YINC, 2); break;
+			case 0xA: set(insn, store ? OP_ST_YDEC : OP_LD_YDEC, 2); break;
+			case 0xC: set(insn, store ? OP_ST_X : OP_LD_X, 2); break;
+			case 0xD: set(insn, store ? OP_ST_XINC : OP_LD_XINC, 2); break;
+			case 0xE: set(insn, store ? OP_ST_XDEC : OP_LD_XDEC, 2); break;
+			case 0xF: set(insn, store ? OP_PUSH : OP_POP, 2); break;
+			}
+		} else if ((w & 0xFE08) == 0x9400 || (w & 0xFE0F) == 0x940A) {
+			static const uint8_t ops[16] = { OP_COM, OP_NEG, OP_SWAP, OP_INC, 0, OP_ASR, OP_LSR, OP_ROR,
+				[10] = OP_DEC };
+			set(insn, ops[w & 0x0F], 1);
+			insn->d = d5;
+		} else if ((w & 0xFE0C) == 0x940C) {
+			bool call = w & 0x0002;
+			set(insn, call ? OP_CALL : OP_JMP, call ? 4 : 3);
+			insn->words = 2;
+			insn->flow = call ? FLOW_CALL : FLOW_JUMP;
+			insn->target = word_at(flash, address + 2) * 2;
+		} else if ((w & 0xFF0F) == 0x9408) {
+			set(insn, w & 0x0080 ? OP_BCLR : OP_BSET, 1);
+			insn->d = (w >> 4) & 7;
+		} else if (w == 0x9508 || w == 0x9518) {
+			set(insn, w == 0x9508 ? OP_RET : OP_RETI, 4);
+			insn->flow = FLOW_RETURN;
+		} else if (w == 0x9588) {
+			set(insn, OP_SLEEP, 1);
+		} else if (w == 0x9598) {
+			set(insn, OP_BREAK, 1);
+		} else if (w == 0x95A8) {
+			set(insn, OP_WDR, 1);
+		} else if (w == 0x95C8) {
+			set(insn, OP_LPM, 3);
+		} else if (w == 0x95D8) {
+			set(insn, OP_ELPM, 3);
+		} else if (w == 0x95E8) {
+			set(insn, OP_SPM, 4);
+		} else if (w == 0x9409) {
+			set(insn, OP_IJMP, 2);
+			insn->flow = FLOW_INDIRECT_JUMP;
+		} else if (w == 0x9509) {
+			set(insn, OP_ICALL, 3);
+			insn->flow = FLOW_INDIRECT_CALL;
+		} else if ((w & 0xFE00) == 0x9600) {
+			set(insn, w & 0x0100 ? OP_SBIW : OP_ADIW, 2);
+			insn->d = 24 + ((w >> 4) & 3) * 2;
+			insn->k = (w & 0x0F) | ((w >> 2) & 0x30);
+		} else if ((w & 0xFC00) == 0x9800) {
+			static const uint8_t ops[] = { OP_CBI, OP_SBIC, OP_SBI, OP_SBIS };
+			uint8_t op = ops[(w >> 8) & 3];
+			set(insn, op, op == OP_CBI || op == OP_SBI ? 2 : 1);
+			insn->d = (w >> 3) & 0x1F;
+			insn->r = w & 7;
+			if (op == OP_SBIC || op == OP_SBIS) {
+				insn->flow = FLOW_SKIP;
+			}
+		} else if ((w & 0xFC00) == 0x9C00) {
+			set(insn, OP_MUL, 2);
+			insn->d = d5;
+			insn->r = r5;
+		}
+		break;
+	case 0xB:
+		set(insn, w & 0x0800 ? OP_OUT : OP_IN, 1);
+		insn->d = (w & 0x0F) | ((w >> 5) & 0x30);
+		insn->r = d5;
+		break;
+	case 0xC:
+	case 0xD: {
+		int16_t offset = (int16_t)(w << 4) >> 4;
+		bool call = w & 0x1000;
+		set(insn, call ? OP_RCALL : OP_RJMP, call ? 3 : 2);
+		insn->flow = call ? FLOW_CALL : FLOW_JUMP;
+		insn->target = (address + 2 + offset * 2) & (AVR_FLASH_SIZE - 1);
+		break;
+	}
+	case 0xF:
+		if (!(w & 0x0800)) {
+			int8_t offset = (int8_t)((w >> 3) << 1) >> 1;
+			set(insn, w & 0x0400 ? OP_BRBC : OP_BRBS, 1);
+			insn->d = w & 7;
+			insn->flow = FLOW_BRANCH;
+			insn->target = (address + 2 + offset * 2) & (AVR_FLASH_SIZE - 1);
+		} else if (!(w & 0x0008)) {
+			static const uint8_t ops[] = { OP_BLD, OP_BST, OP_SBRC, OP_SBRS };
+			set(insn, ops[(w >> 9) & 3], 1);
+			insn->d = d5;
+			insn->r = w & 7;
+			if (insn->op == OP_SBRC || insn->op == OP_SBRS) {
+				insn->flow = FLOW_SKIP;
+			}
+		}
+		break;
+	}
+
+	if (insn->op == OP_UNKNOWN) {
+		insn->cycles = 1;
+		return false;
+	}
+	return true;
+}
+
+/* ELF32, little endian */
+
+struct elf_header {
+	uint8_t ident[16];
+	uint16_t type, machine;
+	uint32_t version, entry, phoff, shoff, flags;
+	uint16_t ehsize, phentsize, phnum, shentsize, shnum, shstrndx;
+};
+
+struct elf_program {
+	uint32_t type, offset, vaddr, paddr, filesz, memsz, flags, align;
+};
+
+struct elf_section {
+	uint32_t name, type, flags, addr, offset, size, link, info, addralign, entsize;
+};
+
+struct elf_symbol {
+	uint32_t name, value, size;
+	uint8_t info, other;
+	uint16_t shndx;
+};
+
+#define EM_AVR 83
+#define PT_LOAD 1
+#define SHT_SYMTAB 2
+#define STT_NOTYPE 0
+#define STT_FUNC 2
+#define DATA_OFFSET 0x800000
+#define EEPROM_OFFSET 0x810000
+
+static int compare_symbols(const void *a, const void *b) {
+	const struct avr_symbol *x = a;
+	const struct avr_symbol *y = b;
+	if (x->address != y->address) {
+		return x->address < y->address ? -1 : 1;
+	}
+	// Functions before labels at the same address, then by name
+	if (x->function != y->function) {
+		return x->function ? -1 : 1;
+	}
+	return strcmp(x->name, y->name);
+}
+
+/*
+ * Loads flash, EEPROM and symbols from an ELF file made by avr-gcc
+ */
+bool avr_load_elf(const char *path, struct avr_image *image, char *error, unsigned error_size) {
+	memset(image, 0, sizeof(*image));
+	memset(image->flash, 0xFF, sizeof(image->flash));
+	memset(image->eeprom, 0xFF, sizeof(image->eeprom));
+
+	FILE *file = fopen(path, "rb");
+	if (!file) {
+		snprintf(error, error_size, "%s: can't open", path);
+		return false;
+	}
+	fseek(file, 0, SEEK_END);
+	long length = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	uint8_t *data = malloc(length > 0 ? length : 1);
+	bool read = length > 0 && fread(data, 1, length, file) == (size_t)length;
+	fclose(file);
+
+	struct elf_header header;
+	if (!read || (size_t)length < sizeof(header) || memcmp(data, "\177ELF", 4) != 0) {
+		snprintf(error, error_size, "%s: not an ELF file", path);
+		free(data);
+		return false;
+	}
+	memcpy(&header, data, sizeof(header));
+	if (header.ident[4] != 1 || header.ident[5] != 1 || header.machine != EM_AVR) {
+		snprintf(error, error_size, "%s: not a 32-bit little-endian AVR ELF file", path);
+		free(data);
+		return false;
+	}
+
+	for (unsigned i = 0; i < header.phnum; i++) {
+		struct elf_program program;
+		memcpy(&program, data + header.phoff + i * header.phentsize, sizeof(program));
+		if (program.type != PT_LOAD || program.filesz == 0) {
+			continue;
+		}
+		if (program.paddr >= EEPROM_OFFSET) {
+			uint32_t start = program.paddr - EEPROM_OFFSET;
+			if (start + program.filesz <= sizeof(image->eeprom)) {
+				memcpy(image->eeprom + start, data + program.offset, program.filesz);
+			}
+		} else if (program.paddr < DATA_OFFSET) {
+			if (program.paddr + program.filesz > AVR_FLASH_SIZE) {
+				snprintf(error, error_size, "%s: image doesn't fit in %u bytes of flash", path, AVR_FLASH_SIZE);
+				free(data);
+				return false;
+			}
+			memcpy(image->flash + program.paddr, data + program.offset, program.filesz);
+			if (program.paddr + program.filesz > image->flash_used) {
+				image->flash_used = program.paddr + program.filesz;
+			}
+		}
+	}
+
+	struct elf_section names;
+	memcpy(&names, data + header.shoff + header.shstrndx * header.shentsize, sizeof(names));
+
+	for (unsigned i = 0; i < header.shnum; i++) {
+		struct elf_section section;
+		memcpy(&section, data + header.shoff + i * header.shentsize, sizeof(section));
+		const char *name = (const char *)data + names.offset + section.name;
+
+		if (strcmp(name, ".data") == 0) {
+			image->data_size = section.size;
+		} else if (strcmp(name, ".bss") == 0 || strcmp(name, ".noinit") == 0) {
+			image->bss_size += section.size;
+		}
+
+		if (section.type != SHT_SYMTAB) {
+			continue;
+		}
+
+		struct elf_section strings;
+		memcpy(&strings, data + header.shoff + section.link * header.shentsize, sizeof(strings));
+		unsigned count = section.size / sizeof(struct elf_symbol);
+		image->symbols = calloc(count, sizeof(struct avr_symbol));
+
+		for (unsigned j = 0; j < count; j++) {
+			struct elf_symbol symbol;
+			memcpy(&symbol, data + section.offset + j * sizeof(symbol), sizeof(symbol));
+			uint8_t type = symbol.info & 0x0F;
+			const char *symbol_name = (const char *)data + strings.offset + symbol.name;
+
+			if ((type != STT_FUNC && type != STT_NOTYPE) || !symbol_name[0] || symbol.shndx == 0 ||
+					symbol.shndx >= 0xFF00 || symbol.value >= AVR_FLASH_SIZE) {
+				continue;
+			}
+
+			struct avr_symbol *s = &image->symbols[image->symbol_count++];
+			s->name = strdup(symbol_name);
+			s->address = symbol.value;
+			s->size = symbol.size;
+			s->function = type == STT_FUNC;
+		}
+	}
+
+	qsort(image->symbols, image->symbol_count, sizeof(struct avr_symbol), compare_symbols);
+	free(data);
+	return true;
+}
+
+const struct avr_symbol *avr_find_symbol(const struct avr_image *image, const char *name) {
+	int vector = avr_vector_number(name);
+	char vector_name[24];
+	if (vector >= 0) {
+		snprintf(vector_name, sizeof(vector_name), "__vector_%d", vector);
+		name = vector_name;
+	}
+
+	for (unsigned i = 0; i < image->symbol_count; i++) {
+		if (strcmp(image->symbols[i].name, name) == 0) {
+			return &image->symbols[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Returns the function starting at 'address', or the first symbol there
+ */
+const struct avr_symbol *avr_symbol_at(const struct avr_image *image, uint16_t address) {
+	for (unsigned i = 0; i < image->symbol_count; i++) {
+		if (image->symbols[i].address == address) {
+			return &image->symbols[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Returns the vector number of "TIM0_OVF_vect" or "TIM0_OVF", or -1
+ */
+int avr_vector_number(const char *name) {
+	size_t length = strlen(name);
+	if (length > 5 && strcmp(name + length - 5, "_vect") == 0) {
+		length -= 5;
+	}
+
+	for (int i = 1; i < AVR_VECTORS; i++) {
+		if (strlen(avr_vector_names[i]) == length && strncmp(name, avr_vector_names[i], length) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
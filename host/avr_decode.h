@@ -0,0 +1,95 @@
+/*
+ * AVR instruction decoding and ELF loading for the host tools
+ *
+ * Covers the instruction set of the ATtiny44 (AVR25 core) plus the few
+ * instructions of the larger cores, which decode but have no timing.
+ * Cycle counts are the ATtiny44 datasheet's.
+ */
+
+#ifndef AVR_DECODE_H
+#define AVR_DECODE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define AVR_FLASH_SIZE 4096
+#define AVR_RAM_START 0x60
+#define AVR_RAM_END 0x15F
+#define AVR_VECTORS 17
+
+enum avr_op {
+	OP_UNKNOWN,
+	OP_NOP, OP_MOVW, OP_MUL, OP_MULS, OP_MULSU, OP_FMUL, OP_FMULS, OP_FMULSU,
+	OP_CPC, OP_SBC, OP_ADD, OP_CPSE, OP_CP, OP_SUB, OP_ADC,
+	OP_AND, OP_EOR, OP_OR, OP_MOV,
+	OP_CPI, OP_SBCI, OP_SUBI, OP_ORI, OP_ANDI, OP_LDI,
+	OP_LDD_Y, OP_LDD_Z, OP_STD_Y, OP_STD_Z,
+	OP_LDS, OP_STS,
+	OP_LD_X, OP_LD_XINC, OP_LD_XDEC, OP_LD_YINC, OP_LD_YDEC, OP_LD_ZINC, OP_LD_ZDEC,
+	OP_ST_X, OP_ST_XINC, OP_ST_XDEC, OP_ST_YINC, OP_ST_YDEC, OP_ST_ZINC, OP_ST_ZDEC,
+	OP_LPM, OP_LPM_Z, OP_LPM_ZINC, OP_ELPM, OP_SPM,
+	OP_PUSH, OP_POP,
+	OP_COM, OP_NEG, OP_SWAP, OP_INC, OP_ASR, OP_LSR, OP_ROR, OP_DEC,
+	OP_BSET, OP_BCLR,
+	OP_ADIW, OP_SBIW,
+	OP_CBI, OP_SBIC, OP_SBI, OP_SBIS,
+	OP_IN, OP_OUT,
+	OP_RJMP, OP_RCALL, OP_JMP, OP_CALL, OP_IJMP, OP_ICALL,
+	OP_RET, OP_RETI,
+	OP_BRBS, OP_BRBC,
+	OP_BLD, OP_BST, OP_SBRC, OP_SBRS,
+	OP_SLEEP, OP_BREAK, OP_WDR,
+	OP_COUNT
+};
+
+/* How an instruction continues */
+enum avr_flow {
+	FLOW_NEXT,          // Falls through
+	FLOW_BRANCH,        // Falls through or goes to 'target'
+	FLOW_SKIP,          // Falls through or skips the next instruction
+	FLOW_JUMP,          // Goes to 'target'
+	FLOW_CALL,          // Calls 'target' and falls through
+	FLOW_INDIRECT_JUMP,
+	FLOW_INDIRECT_CALL,
+	FLOW_RETURN
+};
+
+struct avr_insn {
+	uint16_t address;   // Bytes
+	uint8_t words;
+	uint8_t op;         // enum avr_op
+	uint8_t flow;       // enum avr_flow
+	uint8_t cycles;     // Not taken, not skipping
+	uint8_t d;          // Destination register, I/O address or status bit
+	uint8_t r;          // Source register or bit number
+	uint16_t k;         // Immediate, displacement or data address
+	uint16_t target;    // Bytes, for branches, jumps and calls
+};
+
+struct avr_symbol {
+	char *name;
+	uint16_t address;
+	uint16_t size;
+	bool function;
+};
+
+struct avr_image {
+	uint8_t flash[AVR_FLASH_SIZE];
+	uint16_t flash_used;
+	uint8_t eeprom[256];
+	uint16_t data_size;     // Initialized data copied to RAM at startup
+	uint16_t bss_size;
+	struct avr_symbol *symbols;
+	unsigned symbol_count;
+};
+
+extern const char *const avr_op_names[OP_COUNT];
+extern const char *const avr_vector_names[AVR_VECTORS];
+
+bool avr_decode(const uint8_t *flash, uint16_t address, struct avr_insn *insn);
+bool avr_load_elf(const char *path, struct avr_image *image, char *error, unsigned error_size);
+const struct avr_symbol *avr_find_symbol(const struct avr_image *image, const char *name);
+const struct avr_symbol *avr_symbol_at(const struct avr_image *image, uint16_t address);
+int avr_vector_number(const char *name);
+
+#endif
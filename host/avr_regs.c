@@ -0,0 +1,10 @@
+/*
+ * Storage for the host stand-in registers
+ */
+
+#include <stdint.h>
+
+#define HOST_REG(type, name) volatile type name;
+#include <avr/io.h>
+
+volatile uint8_t host_interrupts_enabled;
@@ -0,0 +1,878 @@
+/*
+ * Cycle-accurate ATtiny44 simulation for the host tools
+ *
+ * Timers keep their count as of 'synced', in cycles of the I/O clock,
+ * which stops in the sleep modes deeper than idle. Bringing a timer up
+ * to date jumps from one point where something happens (a compare match,
+ * TOP, BOTTOM) to the next, so a timer costs per event, not per tick.
+ * Events happen on the tick that leaves the count they belong to, as in
+ * the datasheet's timing diagrams.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avr_sim.h"
+
+#define IO(sim, address) ((sim)->s.data[0x20 + (address)])
+
+// Bits
+#define SE 5
+#define SM0 3
+#define PCIF0 4
+#define PCIF1 5
+#define PCIE0 4
+#define PCIE1 5
+#define WDIF 7
+#define WDIE 6
+#define WDE 3
+#define ADEN 7
+#define ADSC 6
+#define ADIF 4
+#define ADIE 3
+#define ADLAR 4
+#define EERIE 3
+#define EEMPE 2
+#define EEPE 1
+#define EERE 0
+#define TOV 0
+#define OCFA 1
+#define OCFB 2
+
+enum { SLEEP_IDLE, SLEEP_ADC, SLEEP_POWER_DOWN, SLEEP_STANDBY };
+enum { MODE_NORMAL, MODE_CTC, MODE_FAST, MODE_PHASE, MODE_PHASE_FREQUENCY };
+enum { TOP_MAX, TOP_OCRA, TOP_ICR, TOP_FF, TOP_1FF, TOP_3FF };
+
+// Bit ranges: the flags that are cleared by writing one to them
+static const struct {
+	uint8_t address;
+	uint8_t flags;
+} flag_registers[] = {
+	{ IO_TIFR0, 0x07 },
+	{ IO_TIFR1, 0x27 },
+	{ IO_GIFR, 0x70 },
+	{ IO_WDTCSR, 1 << WDIF },
+	{ IO_ADCSRA, 1 << ADIF },
+};
+
+// Timer registers: control, mask, flags and where the compare outputs go
+static const struct {
+	uint8_t tccra, tccrb, timsk, tifr;
+	uint16_t max;
+	uint8_t port[2], pin[2];
+} timers[2] = {
+	{ IO_TCCR0A, IO_TCCR0B, IO_TIMSK0, IO_TIFR0, 0xFF, { PORT_B, PORT_A }, { 2, 7 } },
+	{ IO_TCCR1A, IO_TCCR1B, IO_TIMSK1, IO_TIFR1, 0xFFFF, { PORT_A, PORT_A }, { 6, 5 } },
+};
+
+static const uint16_t prescalers[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+
+struct timer_mode {
+	uint8_t kind;
+	uint16_t top;
+	unsigned prescaler;     // 0 when stopped
+};
+
+void avr_fault(struct avr_sim *sim, const char *fault) {
+	if (!sim->fault) {
+		sim->fault = fault;
+	}
+}
+
+static uint64_t io_time(const struct avr_sim *sim) {
+	uint64_t now = sim->s.clock_stopped ? sim->s.frozen_since : sim->s.cycles;
+	return now - sim->s.frozen;
+}
+
+static uint8_t sleep_mode(const struct avr_sim *sim) {
+	return (IO(sim, IO_MCUCR) >> SM0) & 3;
+}
+
+/* Pins */
+
+static uint8_t port_register(int port, uint8_t porta) {
+	return port == PORT_A ? porta : porta - 3;
+}
+
+static void update_pins(struct avr_sim *sim) {
+	for (int port = PORT_A; port <= PORT_B; port++) {
+		uint8_t ddr = IO(sim, port_register(port, IO_DDRA));
+		uint8_t level = (ddr & IO(sim, port_register(port, IO_PORTA))) | (~ddr & sim->s.input[port]);
+		for (int i = 0; i < 2; i++) {
+			for (int ch = 0; ch < 2; ch++) {
+				uint8_t com = IO(sim, timers[i].tccra) >> (6 - ch * 2) & 3;
+				uint8_t bit = 1 << timers[i].pin[ch];
+				if (com && timers[i].port[ch] == port && (ddr & bit)) {
+					level = (level & ~bit) | (sim->s.timer[i].output[ch] ? bit : 0);
+				}
+			}
+		}
+		uint8_t changed = level ^ sim->s.pins[port];
+		sim->s.pins[port] = level;
+		if (changed & IO(sim, port == PORT_A ? IO_PCMSK0 : IO_PCMSK1)) {
+			IO(sim, IO_GIFR) |= 1 << (port == PORT_A ? PCIF0 : PCIF1);
+		}
+	}
+}
+
+void avr_set_input(struct avr_sim *sim, int port, uint8_t bit, bool level) {
+	avr_sync(sim);
+	sim->s.input[port] = (sim->s.input[port] & ~(1 << bit)) | (level << bit);
+	update_pins(sim);
+}
+
+/* Timers */
+
+static struct timer_mode timer_mode(const struct avr_sim *sim, int i) {
+	static const uint8_t kinds[2][16] = {
+		{ MODE_NORMAL, MODE_PHASE, MODE_CTC, MODE_FAST, MODE_NORMAL, MODE_PHASE, MODE_NORMAL, MODE_FAST },
+		{ MODE_NORMAL, MODE_PHASE, MODE_PHASE, MODE_PHASE, MODE_CTC, MODE_FAST, MODE_FAST, MODE_FAST,
+			MODE_PHASE_FREQUENCY, MODE_PHASE_FREQUENCY, MODE_PHASE, MODE_PHASE, MODE_CTC, MODE_NORMAL,
+			MODE_FAST, MODE_FAST },
+	};
+	static const uint8_t tops[2][16] = {
+		{ TOP_MAX, TOP_FF, TOP_OCRA, TOP_FF, TOP_MAX, TOP_OCRA, TOP_MAX, TOP_OCRA },
+		{ TOP_MAX, TOP_FF, TOP_1FF, TOP_3FF, TOP_OCRA, TOP_FF, TOP_1FF, TOP_3FF,
+			TOP_ICR, TOP_OCRA, TOP_ICR, TOP_OCRA, TOP_ICR, TOP_MAX, TOP_ICR, TOP_OCRA },
+	};
+	const struct avr_timer *timer = &sim->s.timer[i];
+	uint8_t tccrb = IO(sim, timers[i].tccrb);
+	uint8_t wgm = (IO(sim, timers[i].tccra) & 3) | (tccrb >> 1 & (i == 0 ? 0x04 : 0x0C));
+	struct timer_mode mode = { kinds[i][wgm], 0, prescalers[tccrb & 7] };
+
+	switch (tops[i][wgm]) {
+	case TOP_MAX: mode.top = timers[i].max; break;
+	case TOP_OCRA: mode.top = timer->compare[0]; break;
+	case TOP_ICR: mode.top = IO(sim, IO_ICR1L) | IO(sim, IO_ICR1H) << 8; break;
+	case TOP_FF: mode.top = 0xFF; break;
+	case TOP_1FF: mode.top = 0x1FF; break;
+	case TOP_3FF: mode.top = 0x3FF; break;
+	}
+	if (mode.top == 0) {
+		mode.top = 1;
+	}
+	return mode;
+}
+
+static bool buffered(uint8_t kind) {
+	return kind == MODE_FAST || kind == MODE_PHASE || kind == MODE_PHASE_FREQUENCY;
+}
+
+static bool dual_slope(uint8_t kind) {
+	return kind == MODE_PHASE || kind == MODE_PHASE_FREQUENCY;
+}
+
+/* The count that is left when the overflow flag is set */
+static uint16_t overflow_count(const struct timer_mode *mode, uint16_t max) {
+	return dual_slope(mode->kind) ? 0 : buffered(mode->kind) ? mode->top : max;
+}
+
+/* The count that is left when the compare registers are updated */
+static uint16_t update_count(const struct timer_mode *mode) {
+	return mode->kind == MODE_PHASE_FREQUENCY ? 0 : mode->top;
+}
+
+/* Ticks until the count is 'value', 0 if it is now */
+static uint32_t ticks_to(const struct avr_timer *timer, const struct timer_mode *mode, uint16_t max, uint16_t value) {
+	uint32_t count = timer->count, top = mode->top;
+	if (dual_slope(mode->kind)) {
+		if (value > top) {
+			return UINT32_MAX;
+		}
+		bool down = timer->down || count > top;
+		if (down) {
+			return value <= count ? count - value : count + value;
+		}
+		return value >= count ? value - count : (top - count) + (top - value);
+	}
+	uint32_t end = count > top ? max : top;
+	if (value >= count && value <= end) {
+		return value - count;
+	}
+	if (value <= top) {
+		return (end - count) + 1 + value;
+	}
+	return UINT32_MAX;
+}
+
+/* Returns true if the output changed */
+static bool compare_output(struct avr_sim *sim, int i, int ch, const struct timer_mode *mode, bool bottom) {
+	struct avr_timer *timer = &sim->s.timer[i];
+	uint8_t com = IO(sim, timers[i].tccra) >> (6 - ch * 2) & 3;
+	bool old = timer->output[ch];
+	if (!com) {
+		return false;
+	}
+	if (!buffered(mode->kind)) {
+		timer->output[ch] = com == 1 ? !timer->output[ch] : com == 3;
+	} else if (com >= 2) {
+		bool inverting = com == 3;
+		if (bottom) {
+			timer->output[ch] = !inverting;
+		} else if (dual_slope(mode->kind)) {
+			// Cleared on the way up, set on the way down, or the other way
+			timer->output[ch] = timer->down ^ inverting;
+		} else {
+			timer->output[ch] = inverting;
+		}
+	}
+	return timer->output[ch] != old;
+}
+
+/* One tick, leaving the current count. Returns true if an output changed */
+static bool tick(struct avr_sim *sim, int i, struct timer_mode *mode) {
+	struct avr_timer *timer = &sim->s.timer[i];
+	uint8_t *flags = &IO(sim, timers[i].tifr);
+	uint16_t max = timers[i].max;
+	uint16_t count = timer->count;
+	bool bottom = false, changed = false;
+
+	for (int ch = 0; ch < 2; ch++) {
+		if (timer->compare[ch] == count) {
+			*flags |= 1 << (OCFA + ch);
+			changed |= compare_output(sim, i, ch, mode, false);
+		}
+	}
+	if (count == overflow_count(mode, max)) {
+		*flags |= 1 << TOV;
+	}
+	if (buffered(mode->kind) && count == update_count(mode)) {
+		timer->compare[0] = timer->buffer[0];
+		timer->compare[1] = timer->buffer[1];
+		*mode = timer_mode(sim, i);
+	}
+
+	if (dual_slope(mode->kind)) {
+		if (count >= mode->top) {
+			timer->down = true;
+		} else if (count == 0) {
+			timer->down = false;
+		}
+		timer->count = timer->down ? count - 1 : count + 1;
+	} else {
+		bottom = count == mode->top || count == max;
+		timer->count = bottom ? 0 : count + 1;
+	}
+
+	if (bottom && mode->kind == MODE_FAST) {
+		changed |= compare_output(sim, i, 0, mode, true);
+		changed |= compare_output(sim, i, 1, mode, true);
+	}
+	return changed;
+}
+
+/* The next count at which a tick does something */
+static uint32_t ticks_to_event(const struct avr_sim *sim, int i, const struct timer_mode *mode) {
+	const struct avr_timer *timer = &sim->s.timer[i];
+	uint16_t max = timers[i].max;
+	uint32_t ticks = ticks_to(timer, mode, max, overflow_count(mode, max));
+	for (int ch = 0; ch < 2; ch++) {
+		uint32_t t = ticks_to(timer, mode, max, timer->compare[ch]);
+		ticks = t < ticks ? t : ticks;
+	}
+	uint16_t ends[] = { mode->top, max, update_count(mode), 0 };
+	for (unsigned e = 0; e < sizeof(ends) / sizeof(ends[0]); e++) {
+		uint32_t t = ticks_to(timer, mode, max, ends[e]);
+		ticks = t < ticks ? t : ticks;
+	}
+	return ticks;
+}
+
+static void timer_advance(struct avr_sim *sim, int i, uint64_t ticks) {
+	struct avr_timer *timer = &sim->s.timer[i];
+	struct timer_mode mode = timer_mode(sim, i);
+	bool reduced = false, changed = false;
+
+	while (ticks > 0) {
+		uint64_t quiet = ticks_to_event(sim, i, &mode);
+		if (quiet >= ticks) {
+			quiet = ticks;
+		}
+		if (dual_slope(mode.kind) && (timer->down || timer->count > mode.top)) {
+			timer->count -= quiet;
+		} else {
+			timer->count += quiet;
+		}
+		ticks -= quiet;
+		if (ticks == 0) {
+			break;
+		}
+		changed |= tick(sim, i, &mode);
+		ticks--;
+
+		// Whole pairs of periods change nothing once the flags are set
+		uint64_t period = dual_slope(mode.kind) ? 2 * mode.top : mode.top + 1u;
+		if (!reduced && ticks >= 4 * period && timer->count <= mode.top &&
+				timer->compare[0] == timer->buffer[0] && timer->compare[1] == timer->buffer[1]) {
+			ticks -= (ticks / (2 * period) - 1) * 2 * period;
+			reduced = true;
+		}
+	}
+	if (changed) {
+		update_pins(sim);
+	}
+}
+
+static void timer_sync(struct avr_sim *sim, int i) {
+	struct avr_timer *timer = &sim->s.timer[i];
+	uint64_t now = io_time(sim);
+	unsigned prescaler = prescalers[IO(sim, timers[i].tccrb) & 7];
+	if (prescaler && now / prescaler != timer->synced / prescaler) {
+		timer_advance(sim, i, now / prescaler - timer->synced / prescaler);
+	}
+	timer->synced = now;
+}
+
+/* The cycle of the first tick that can raise an interrupt, or change a pin that can */
+static uint64_t timer_event(const struct avr_sim *sim, int i) {
+	const struct avr_timer *timer = &sim->s.timer[i];
+	struct timer_mode mode = timer_mode(sim, i);
+	if (!mode.prescaler || sim->s.clock_stopped) {
+		return AVR_NEVER;
+	}
+	uint8_t wanted = IO(sim, timers[i].timsk) & ~IO(sim, timers[i].tifr) & 7;
+	uint8_t com = IO(sim, timers[i].tccra);
+	uint8_t gimsk = IO(sim, IO_GIMSK);
+	for (int ch = 0; ch < 2; ch++) {
+		int port = timers[i].port[ch];
+		uint8_t mask = port == PORT_A ? IO(sim, IO_PCMSK0) : IO(sim, IO_PCMSK1);
+		bool enabled = gimsk & (1 << (port == PORT_A ? PCIE0 : PCIE1));
+		if ((com >> (6 - ch * 2) & 3) && enabled && (mask & (1 << timers[i].pin[ch]))) {
+			wanted |= 1 << (OCFA + ch) | 1 << TOV;
+		}
+	}
+	if (!wanted) {
+		return AVR_NEVER;
+	}
+
+	uint16_t max = timers[i].max;
+	uint32_t ticks = UINT32_MAX;
+	if (wanted & (1 << TOV)) {
+		ticks = ticks_to(timer, &mode, max, overflow_count(&mode, max));
+	}
+	for (int ch = 0; ch < 2; ch++) {
+		if (wanted & (1 << (OCFA + ch))) {
+			uint32_t t = ticks_to(timer, &mode, max, timer->compare[ch]);
+			ticks = t < ticks ? t : ticks;
+		}
+	}
+	if (buffered(mode.kind) &&
+			(timer->compare[0] != timer->buffer[0] || timer->compare[1] != timer->buffer[1])) {
+		uint32_t t = ticks_to(timer, &mode, max, update_count(&mode));
+		ticks = t < ticks ? t : ticks;
+	}
+	if (ticks == UINT32_MAX) {
+		return AVR_NEVER;
+	}
+	uint64_t tick_at = (timer->synced / mode.prescaler + ticks + 1) * mode.prescaler;
+	return tick_at + sim->s.frozen;
+}
+
+static void timer_write_compare(struct avr_sim *sim, int i, int ch, uint16_t value) {
+	struct avr_timer *timer = &sim->s.timer[i];
+	timer->buffer[ch] = value;
+	if (!buffered(timer_mode(sim, i).kind)) {
+		timer->compare[ch] = value;
+	}
+}
+
+/* Watchdog */
+
+static uint64_t watchdog_period(const struct avr_sim *sim) {
+	uint8_t wdtcsr = IO(sim, IO_WDTCSR);
+	uint8_t wdp = (wdtcsr & 7) | (wdtcsr >> 2 & 8);
+	// 2048 cycles of the 128 kHz oscillator and up
+	return (2048ULL << (wdp > 9 ? 9 : wdp)) * F_CPU / 128000;
+}
+
+void avr_watchdog_reset(struct avr_sim *sim) {
+	uint8_t wdtcsr = IO(sim, IO_WDTCSR);
+	bool running = wdtcsr & (1 << WDIE | 1 << WDE);
+	sim->s.watchdog_at = running ? sim->s.cycles + watchdog_period(sim) : AVR_NEVER;
+	sim->stop = true;
+}
+
+static void watchdog_sync(struct avr_sim *sim) {
+	while (sim->s.watchdog_at <= sim->s.cycles) {
+		uint8_t *wdtcsr = &IO(sim, IO_WDTCSR);
+		if (*wdtcsr & (1 << WDIE)) {
+			*wdtcsr |= 1 << WDIF;
+			sim->s.watchdog_at += watchdog_period(sim);
+		} else if (*wdtcsr & (1 << WDE)) {
+			uint64_t cycles = sim->s.cycles;
+			avr_reset(sim);
+			sim->s.cycles = cycles;
+			return;
+		} else {
+			sim->s.watchdog_at = AVR_NEVER;
+		}
+	}
+}
+
+/* ADC */
+
+static uint32_t noise(struct avr_sim *sim) {
+	uint32_t x = sim->s.noise;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	sim->s.noise = x;
+	return x;
+}
+
+/* Bandgap and temperature sensor on a 3 V supply, the rest mid scale */
+static uint16_t default_adc(struct avr_sim *sim, uint8_t mux, void *context) {
+	(void)context;
+	uint16_t value = mux == 0x21 ? 375 : mux == 0x22 ? 300 : 512;
+	return value + noise(sim) % 5 - 2;
+}
+
+static void adc_start(struct avr_sim *sim) {
+	unsigned prescaler = 1 << (IO(sim, IO_ADCSRA) & 7);
+	if (prescaler < 2) {
+		prescaler = 2;
+	}
+	sim->s.adc_done_at = sim->s.cycles + (sim->s.adc_started ? 13 : 25) * prescaler;
+	sim->s.adc_started = true;
+	IO(sim, IO_ADCSRA) |= 1 << ADSC;
+}
+
+static void adc_sync(struct avr_sim *sim) {
+	if (sim->s.adc_done_at > sim->s.cycles) {
+		return;
+	}
+	uint8_t mux = IO(sim, IO_ADMUX) & 0x3F;
+	uint16_t value = sim->adc ? sim->adc(sim, mux, sim->context) : default_adc(sim, mux, NULL);
+	if (value > 1023) {
+		value = 1023;
+	}
+	if (IO(sim, IO_ADCSRB) & (1 << ADLAR)) {
+		value <<= 6;
+	}
+	IO(sim, IO_ADCL) = value;
+	IO(sim, IO_ADCH) = value >> 8;
+	IO(sim, IO_ADCSRA) = (IO(sim, IO_ADCSRA) & ~(1 << ADSC)) | 1 << ADIF;
+	sim->s.adc_done_at = AVR_NEVER;
+}
+
+/* EEPROM */
+
+static void eeprom_write(struct avr_sim *sim, uint8_t value) {
+	uint8_t *eecr = &IO(sim, IO_EECR);
+	uint8_t old = *eecr;
+	*eecr = (old & (1 << EEPE)) | (value & ~(1 << EEPE | 1 << EERE));
+	if (old & (1 << EEPE)) {
+		return;
+	}
+	uint8_t *cell = &sim->s.eeprom[IO(sim, IO_EEARL)];
+	if (value & (1 << EERE)) {
+		IO(sim, IO_EEDR) = *cell;
+		sim->s.cycles += 4;
+	} else if ((value & (1 << EEPE)) && (old & (1 << EEMPE))) {
+		uint8_t mode = value >> 4 & 3;
+		*cell = mode == 0 ? IO(sim, IO_EEDR) : mode == 1 ? 0xFF : *cell & IO(sim, IO_EEDR);
+		sim->s.eeprom_done_at = sim->s.cycles + (mode == 0 ? 3400 : 1800) * (F_CPU / 1000000);
+		*eecr = (*eecr | 1 << EEPE) & ~(1 << EEMPE);
+		sim->s.cycles += 2;
+	}
+}
+
+static void eeprom_sync(struct avr_sim *sim) {
+	if (sim->s.eeprom_done_at <= sim->s.cycles) {
+		IO(sim, IO_EECR) &= ~(1 << EEPE);
+		sim->s.eeprom_done_at = AVR_NEVER;
+	}
+}
+
+/* Interrupts */
+
+static uint8_t pending(const struct avr_sim *sim) {
+	uint8_t gifr = IO(sim, IO_GIFR) & IO(sim, IO_GIMSK);
+	uint8_t tifr1 = IO(sim, IO_TIFR1) & IO(sim, IO_TIMSK1);
+	uint8_t tifr0 = IO(sim, IO_TIFR0) & IO(sim, IO_TIMSK0);
+	uint8_t wdtcsr = IO(sim, IO_WDTCSR);
+	uint8_t adcsra = IO(sim, IO_ADCSRA);
+	uint8_t eecr = IO(sim, IO_EECR);
+
+	if (gifr & (1 << PCIF0)) return 2;
+	if (gifr & (1 << PCIF1)) return 3;
+	if ((wdtcsr & (1 << WDIF)) && (wdtcsr & (1 << WDIE))) return 4;
+	if (tifr1 & (1 << 5)) return 5;
+	if (tifr1 & (1 << OCFA)) return 6;
+	if (tifr1 & (1 << OCFB)) return 7;
+	if (tifr1 & (1 << TOV)) return 8;
+	if (tifr0 & (1 << OCFA)) return 9;
+	if (tifr0 & (1 << OCFB)) return 10;
+	if (tifr0 & (1 << TOV)) return 11;
+	if ((adcsra & (1 << ADIF)) && (adcsra & (1 << ADIE))) return 13;
+	if ((eecr & (1 << EERIE)) && !(eecr & (1 << EEPE))) return 14;
+	return 0;
+}
+
+/* Acknowledges the interrupt the way the hardware does when it's taken */
+static void acknowledge(struct avr_sim *sim, uint8_t vector) {
+	switch (vector) {
+	case 2: IO(sim, IO_GIFR) &= ~(1 << PCIF0); break;
+	case 3: IO(sim, IO_GIFR) &= ~(1 << PCIF1); break;
+	case 4:
+		IO(sim, IO_WDTCSR) &= ~(1 << WDIF);
+		if (IO(sim, IO_WDTCSR) & (1 << WDE)) {
+			IO(sim, IO_WDTCSR) &= ~(1 << WDIE);
+		}
+		break;
+	case 5: IO(sim, IO_TIFR1) &= ~(1 << 5); break;
+	case 6: IO(sim, IO_TIFR1) &= ~(1 << OCFA); break;
+	case 7: IO(sim, IO_TIFR1) &= ~(1 << OCFB); break;
+	case 8: IO(sim, IO_TIFR1) &= ~(1 << TOV); break;
+	case 9: IO(sim, IO_TIFR0) &= ~(1 << OCFA); break;
+	case 10: IO(sim, IO_TIFR0) &= ~(1 << OCFB); break;
+	case 11: IO(sim, IO_TIFR0) &= ~(1 << TOV); break;
+	case 13: IO(sim, IO_ADCSRA) &= ~(1 << ADIF); break;
+	}
+}
+
+static void schedule(struct avr_sim *sim) {
+	sim->irq = pending(sim);
+	uint64_t next = sim->input ? sim->input_at : AVR_NEVER;
+	uint64_t candidates[] = {
+		sim->s.watchdog_at, sim->s.adc_done_at, sim->s.eeprom_done_at, timer_event(sim, 0), timer_event(sim, 1),
+	};
+	for (unsigned i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+		next = candidates[i] < next ? candidates[i] : next;
+	}
+	sim->next_event = next;
+}
+
+/* Brings the peripherals up to the current cycle */
+void avr_sync(struct avr_sim *sim) {
+	timer_sync(sim, 0);
+	timer_sync(sim, 1);
+	watchdog_sync(sim);
+	adc_sync(sim);
+	eeprom_sync(sim);
+}
+
+/* Brings up to date the peripheral a register belongs to, or all of them */
+static void sync_register(struct avr_sim *sim, uint8_t address) {
+	switch (address) {
+	case IO_TCCR0B: case IO_TCNT0: case IO_OCR0A: case IO_OCR0B: case IO_TIMSK0: case IO_TIFR0:
+		timer_sync(sim, 0);
+		break;
+	case IO_TCCR1B: case IO_TCNT1L: case IO_TCNT1H: case IO_OCR1AL: case IO_OCR1AH: case IO_OCR1BL:
+	case IO_OCR1BH: case IO_ICR1L: case IO_ICR1H: case IO_TIMSK1: case IO_TIFR1:
+		timer_sync(sim, 1);
+		break;
+	case IO_WDTCSR:
+		watchdog_sync(sim);
+		break;
+	case IO_ADCL: case IO_ADCH: case IO_ADCSRA: case IO_ADCSRB: case IO_ADMUX:
+		adc_sync(sim);
+		break;
+	case IO_EECR: case IO_EEDR: case IO_EEARL: case IO_EEARH:
+		eeprom_sync(sim);
+		break;
+	default:
+		avr_sync(sim);
+		break;
+	}
+}
+
+/* At 'next_event': peripherals, then the outside world, then what's next */
+void avr_update(struct avr_sim *sim) {
+	avr_sync(sim);
+	while (sim->input && sim->input_at <= sim->s.cycles) {
+		sim->input_at = sim->input(sim, sim->context);
+	}
+	schedule(sim);
+}
+
+/* I/O registers */
+
+/* The value of a register, without the side effects of reading it */
+static uint8_t peek(const struct avr_sim *sim, uint8_t address) {
+	switch (address) {
+	case IO_SREG: return sim->s.sreg;
+	case IO_SPL: return sim->s.sp;
+	case IO_SPH: return sim->s.sp >> 8;
+	case IO_PINA: return sim->s.pins[PORT_A];
+	case IO_PINB: return sim->s.pins[PORT_B];
+	case IO_TCNT0: return sim->s.timer[0].count;
+	case IO_OCR0A: return sim->s.timer[0].buffer[0];
+	case IO_OCR0B: return sim->s.timer[0].buffer[1];
+	case IO_TCNT1L: return sim->s.timer[1].count;
+	case IO_TCNT1H: case IO_ICR1H: return sim->s.temp;
+	case IO_OCR1AL: return sim->s.timer[1].buffer[0];
+	case IO_OCR1AH: return sim->s.timer[1].buffer[0] >> 8;
+	case IO_OCR1BL: return sim->s.timer[1].buffer[1];
+	case IO_OCR1BH: return sim->s.timer[1].buffer[1] >> 8;
+	}
+	return IO(sim, address);
+}
+
+uint8_t avr_io_read(struct avr_sim *sim, uint8_t address) {
+	sync_register(sim, address);
+	// Reading the low byte of a 16-bit register latches the high byte
+	if (address == IO_TCNT1L) {
+		sim->s.temp = sim->s.timer[1].count >> 8;
+	} else if (address == IO_ICR1L) {
+		sim->s.temp = IO(sim, IO_ICR1H);
+	}
+	return peek(sim, address);
+}
+
+/*
+ * Writes the bits in 'mask': all of them for out and sts, one for sbi and
+ * cbi, which leave the other flags in a flag register alone
+ */
+void avr_io_write(struct avr_sim *sim, uint8_t address, uint8_t value, uint8_t mask) {
+	uint8_t *reg = &IO(sim, address);
+	if (avr_cpu_register(address)) {
+		uint8_t merged = (peek(sim, address) & ~mask) | (value & mask);
+		if (address == IO_SREG) {
+			sim->s.sreg = merged;
+			sim->stop = (merged & (1 << SREG_I)) && sim->irq;
+		} else if (address == IO_SPL) {
+			sim->s.sp = (sim->s.sp & 0xFF00) | merged;
+		} else if (address == IO_SPH) {
+			sim->s.sp = (sim->s.sp & 0x00FF) | merged << 8;
+		} else {
+			*reg = merged;
+			if (address == IO_GPIOR0 && sim->marker) {
+				sim->marker(sim, merged, sim->context);
+			}
+		}
+		return;
+	}
+	sync_register(sim, address);
+	uint8_t old = peek(sim, address);
+	uint8_t merged = (old & ~mask) | (value & mask);
+
+	sim->stop = true;
+	for (unsigned i = 0; i < sizeof(flag_registers) / sizeof(flag_registers[0]); i++) {
+		if (flag_registers[i].address == address) {
+			uint8_t flags = flag_registers[i].flags;
+			uint8_t cleared = value & mask & flags;
+			merged = (merged & ~flags) | (*reg & flags & ~cleared);
+			break;
+		}
+	}
+
+	switch (address) {
+	case IO_PINA: case IO_PINB:
+		// Writing ones toggles the port
+		IO(sim, address + 2) ^= value & mask;
+		break;
+	case IO_TCNT0:
+		sim->s.timer[0].count = merged;
+		break;
+	case IO_OCR0A: timer_write_compare(sim, 0, 0, merged); break;
+	case IO_OCR0B: timer_write_compare(sim, 0, 1, merged); break;
+	case IO_TCNT1H: case IO_OCR1AH: case IO_OCR1BH: case IO_ICR1H:
+		sim->s.temp = merged;
+		break;
+	case IO_TCNT1L:
+		sim->s.timer[1].count = sim->s.temp << 8 | merged;
+		break;
+	case IO_OCR1AL: timer_write_compare(sim, 1, 0, sim->s.temp << 8 | merged); break;
+	case IO_OCR1BL: timer_write_compare(sim, 1, 1, sim->s.temp << 8 | merged); break;
+	case IO_ICR1L:
+		IO(sim, IO_ICR1H) = sim->s.temp;
+		*reg = merged;
+		break;
+	case IO_TCCR0A: case IO_TCCR0B: case IO_TCCR1A: case IO_TCCR1B: {
+		int i = address == IO_TCCR0A || address == IO_TCCR0B ? 0 : 1;
+		*reg = merged;
+		if (!buffered(timer_mode(sim, i).kind)) {
+			sim->s.timer[i].compare[0] = sim->s.timer[i].buffer[0];
+			sim->s.timer[i].compare[1] = sim->s.timer[i].buffer[1];
+		}
+		break;
+	}
+	case IO_WDTCSR:
+		*reg = merged;
+		avr_watchdog_reset(sim);
+		break;
+	case IO_ADCSRA:
+		*reg = merged & ~(1 << ADSC);
+		if (!(merged & (1 << ADEN))) {
+			sim->s.adc_done_at = AVR_NEVER;
+			sim->s.adc_started = false;
+		} else if (sim->s.adc_done_at != AVR_NEVER) {
+			*reg |= 1 << ADSC;
+		} else if (merged & (1 << ADSC)) {
+			adc_start(sim);
+		}
+		break;
+	case IO_EECR:
+		eeprom_write(sim, merged);
+		break;
+	default:
+		*reg = merged;
+		break;
+	}
+
+	switch (address) {
+	case IO_PORTA: case IO_DDRA: case IO_PINA: case IO_PORTB: case IO_DDRB: case IO_PINB:
+	case IO_TCCR0A: case IO_TCCR1A:
+		update_pins(sim);
+		break;
+	}
+	schedule(sim);
+}
+
+/* Sleep and interrupts */
+
+void avr_sleep(struct avr_sim *sim) {
+	avr_sync(sim);
+	sim->s.sleeping = true;
+	sim->stop = true;
+	uint8_t mode = sleep_mode(sim);
+	if (mode != SLEEP_IDLE) {
+		sim->s.clock_stopped = true;
+		sim->s.frozen_since = sim->s.cycles;
+	}
+	if (mode == SLEEP_ADC && (IO(sim, IO_ADCSRA) & (1 << ADEN)) && sim->s.adc_done_at == AVR_NEVER) {
+		adc_start(sim);
+	}
+	schedule(sim);
+}
+
+static void wake(struct avr_sim *sim) {
+	sim->s.sleeping = false;
+	if (sim->s.clock_stopped) {
+		sim->s.frozen += sim->s.cycles - sim->s.frozen_since;
+		sim->s.clock_stopped = false;
+		sim->s.frozen_since = 0;
+	}
+	sim->s.cycles += 4;
+}
+
+static void interrupt(struct avr_sim *sim) {
+	uint8_t vector = sim->irq;
+	acknowledge(sim, vector);
+	avr_push_pc(sim, sim->s.pc);
+	sim->s.sreg &= ~(1 << SREG_I);
+	sim->s.pc = vector * 2;
+	sim->s.cycles += 4;
+	sim->interrupts++;
+	schedule(sim);
+}
+
+/*
+ * One instruction, an interrupt response, or sleep up to the next event
+ * but not past 'until'
+ */
+void avr_step(struct avr_sim *sim, uint64_t until) {
+	bool interruptible = (sim->s.sreg & (1 << SREG_I)) && sim->irq;
+	if (sim->s.sleeping) {
+		if (!interruptible) {
+			if (sim->next_event == AVR_NEVER) {
+				avr_fault(sim, "asleep with nothing to wake up");
+				return;
+			}
+			uint64_t wake_at = sim->next_event < until ? sim->next_event : until;
+			if (wake_at > sim->s.cycles) {
+				sim->slept += wake_at - sim->s.cycles;
+				sim->s.cycles = wake_at;
+			}
+			if (sim->s.cycles >= sim->next_event) {
+				avr_update(sim);
+			}
+			return;
+		}
+		wake(sim);
+	}
+
+	bool delayed = sim->s.interrupt_delay;
+	sim->s.interrupt_delay = false;
+	if (interruptible && !delayed) {
+		interrupt(sim);
+	} else {
+		const struct avr_insn *insn = &sim->code[sim->s.pc >> 1];
+		uint8_t skip = sim->code[((insn->address + insn->words * 2) & (AVR_FLASH_SIZE - 1)) >> 1].words;
+		avr_execute(sim, insn->op, insn->d, insn->r, insn->k, insn->address, insn->target, insn->words,
+			insn->cycles, skip);
+	}
+	if (sim->s.cycles >= sim->next_event) {
+		avr_update(sim);
+	}
+}
+
+void avr_run(struct avr_sim *sim, uint64_t until) {
+	while (sim->s.cycles < until && !sim->fault) {
+		avr_step(sim, until);
+	}
+}
+
+void avr_reset(struct avr_sim *sim) {
+	uint8_t input[2] = { sim->s.input[0], sim->s.input[1] };
+	memset(&sim->s, 0, sizeof(sim->s));
+	memcpy(sim->s.eeprom, sim->image->eeprom, sizeof(sim->s.eeprom));
+	memcpy(sim->s.input, input, sizeof(input));
+	sim->s.sp = AVR_RAM_END;
+	sim->s.watchdog_at = AVR_NEVER;
+	sim->s.adc_done_at = AVR_NEVER;
+	sim->s.eeprom_done_at = AVR_NEVER;
+	sim->s.noise = 0x9E3779B9;
+	update_pins(sim);
+	schedule(sim);
+}
+
+void avr_init(struct avr_sim *sim, const struct avr_image *image) {
+	memset(sim, 0, sizeof(*sim));
+	sim->image = image;
+	sim->code = calloc(AVR_FLASH_SIZE / 2, sizeof(*sim->code));
+	for (uint16_t address = 0; address < AVR_FLASH_SIZE; address += 2) {
+		avr_decode(image->flash, address, &sim->code[address >> 1]);
+	}
+	avr_reset(sim);
+}
+
+/* FNV-1a over the used flash, to tie a translation to its image */
+uint32_t avr_checksum(const struct avr_image *image) {
+	uint32_t hash = 2166136261u;
+	for (unsigned i = 0; i < image->flash_used; i++) {
+		hash = (hash ^ image->flash[i]) * 16777619u;
+	}
+	return hash;
+}
+
+#define SAME(field) if (memcmp(&a->field, &b->field, sizeof(a->field)) != 0) return #field
+
+/* The first part of the state that differs, NULL if none does */
+const char *avr_compare(const struct avr_state *a, const struct avr_state *b) {
+	SAME(cycles);
+	SAME(pc);
+	SAME(sreg);
+	SAME(sp);
+	for (unsigned i = 0; i < 0x20; i++) {
+		if (a->data[i] != b->data[i]) {
+			static char name[8];
+			snprintf(name, sizeof(name), "r%u", i);
+			return name;
+		}
+	}
+	SAME(data);
+	SAME(sleeping);
+	SAME(interrupt_delay);
+	SAME(frozen);
+	SAME(clock_stopped);
+	SAME(input);
+	SAME(pins);
+	for (int i = 0; i < 2; i++) {
+		SAME(timer[i].count);
+		SAME(timer[i].compare);
+		SAME(timer[i].buffer);
+		SAME(timer[i].down);
+		SAME(timer[i].output);
+	}
+	SAME(temp);
+	SAME(watchdog_at);
+	SAME(adc_done_at);
+	SAME(adc_started);
+	SAME(eeprom_done_at);
+	SAME(eeprom);
+	SAME(noise);
+	return NULL;
+}
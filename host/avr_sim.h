@@ -0,0 +1,533 @@
+/*
+ * Cycle-accurate ATtiny44 simulation for the host tools
+ *
+ * The CPU and the peripherals the dice uses: the ports with their pin
+ * change interrupts, both timers with their compare outputs, the
+ * watchdog, the ADC, the EEPROM and the sleep modes. Peripherals are
+ * brought up to date lazily, when the program touches them or when the
+ * cycle count reaches 'next_event', the first cycle at which one of them
+ * can raise an interrupt. Between those points the CPU runs on its own.
+ *
+ * Instruction semantics are in avr_execute(), shared by the interpreter
+ * (avr_step()) and the code avr2c generates, so the two can only differ
+ * in how they get from one instruction to the next.
+ */
+
+#ifndef AVR_SIM_H
+#define AVR_SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "avr_decode.h"
+
+#ifndef F_CPU
+#define F_CPU 1000000UL
+#endif
+
+#define AVR_DATA_SIZE (AVR_RAM_END + 1)
+#define AVR_NEVER UINT64_MAX
+
+/* SREG bits */
+#define SREG_C 0
+#define SREG_Z 1
+#define SREG_N 2
+#define SREG_V 3
+#define SREG_S 4
+#define SREG_H 5
+#define SREG_T 6
+#define SREG_I 7
+
+/* I/O addresses, in the I/O space */
+#define IO_ADCSRB 0x03
+#define IO_ADCL 0x04
+#define IO_ADCH 0x05
+#define IO_ADCSRA 0x06
+#define IO_ADMUX 0x07
+#define IO_TIFR1 0x0B
+#define IO_TIMSK1 0x0C
+#define IO_PCMSK0 0x12
+#define IO_GPIOR0 0x13
+#define IO_GPIOR1 0x14
+#define IO_GPIOR2 0x15
+#define IO_PINB 0x16
+#define IO_DDRB 0x17
+#define IO_PORTB 0x18
+#define IO_PINA 0x19
+#define IO_DDRA 0x1A
+#define IO_PORTA 0x1B
+#define IO_EECR 0x1C
+#define IO_EEDR 0x1D
+#define IO_EEARL 0x1E
+#define IO_EEARH 0x1F
+#define IO_PCMSK1 0x20
+#define IO_WDTCSR 0x21
+#define IO_ICR1L 0x24
+#define IO_ICR1H 0x25
+#define IO_OCR1BL 0x28
+#define IO_OCR1BH 0x29
+#define IO_OCR1AL 0x2A
+#define IO_OCR1AH 0x2B
+#define IO_TCNT1L 0x2C
+#define IO_TCNT1H 0x2D
+#define IO_TCCR1B 0x2E
+#define IO_TCCR1A 0x2F
+#define IO_TCCR0A 0x30
+#define IO_TCNT0 0x32
+#define IO_TCCR0B 0x33
+#define IO_MCUCR 0x35
+#define IO_OCR0A 0x36
+#define IO_TIFR0 0x38
+#define IO_TIMSK0 0x39
+#define IO_GIFR 0x3A
+#define IO_GIMSK 0x3B
+#define IO_OCR0B 0x3C
+#define IO_SPL 0x3D
+#define IO_SPH 0x3E
+#define IO_SREG 0x3F
+
+enum { PORT_A, PORT_B };
+
+struct avr_timer {
+	uint16_t count;
+	uint16_t compare[2];        // In effect, A and B
+	uint16_t buffer[2];         // Written, waiting for the update in PWM modes
+	bool down;                  // Dual slope modes counting down
+	bool output[2];             // Compare output levels, OCnA and OCnB
+	uint64_t synced;            // I/O clock cycle the count is valid for
+};
+
+/*
+ * Everything the program can observe, so that two simulations can be
+ * compared with memcmp()
+ */
+struct avr_state {
+	uint64_t cycles;
+	uint64_t frozen;            // Cycles the I/O clock was stopped by sleep
+	uint64_t frozen_since;
+	bool clock_stopped;
+	uint8_t data[AVR_DATA_SIZE];    // Registers, I/O registers and SRAM
+	uint16_t pc;                // Bytes
+	uint16_t sp;
+	uint8_t sreg;
+	bool sleeping;
+	bool interrupt_delay;       // One more instruction after sei and reti
+	uint8_t input[2];           // Levels driven onto the pins from outside
+	uint8_t pins[2];
+
+	struct avr_timer timer[2];
+	uint8_t temp;               // Timer1 high byte latch
+
+	uint64_t watchdog_at;       // Next timeout
+	uint64_t adc_done_at;
+	bool adc_started;           // The next conversion isn't the first
+	uint64_t eeprom_done_at;
+	uint8_t eeprom[256];
+
+	uint32_t noise;             // ADC noise generator
+};
+
+struct avr_sim;
+typedef uint64_t (*avr_input)(struct avr_sim *sim, void *context);
+typedef uint16_t (*avr_adc_input)(struct avr_sim *sim, uint8_t mux, void *context);
+typedef void (*avr_marker)(struct avr_sim *sim, uint8_t mark, void *context);
+
+/*
+ * A simulation is plain data apart from the image and the decoded code,
+ * which it only reads: a copy of the struct is a snapshot of the chip and
+ * of virtual time, and goes on from there on its own. The outside world
+ * in 'context' is the caller's to copy along.
+ */
+
+struct avr_sim {
+	struct avr_state s;
+
+	const struct avr_image *image;
+	struct avr_insn *code;      // Decoded, indexed by word address
+
+	uint64_t next_event;
+	uint8_t irq;                // Highest priority pending interrupt, 0 for none
+	bool stop;                  // Set by I/O writes, ends translated blocks
+
+	// Outside world: called at 'input_at' and returns the next time
+	avr_input input;
+	uint64_t input_at;
+	avr_adc_input adc;
+	avr_marker marker;          // Writes to GPIOR0, where debug_mark() puts them. May set 'stop'
+	void *context;
+
+	// Statistics
+	uint64_t interrupts;
+	uint64_t slept;             // Cycles
+	uint64_t skipped;           // Cycles of delay loops fast-forwarded
+
+	const char *fault;
+};
+
+void avr_init(struct avr_sim *sim, const struct avr_image *image);
+void avr_reset(struct avr_sim *sim);
+void avr_step(struct avr_sim *sim, uint64_t until);
+void avr_run(struct avr_sim *sim, uint64_t until);
+void avr_update(struct avr_sim *sim);
+void avr_sync(struct avr_sim *sim);
+void avr_set_input(struct avr_sim *sim, int port, uint8_t bit, bool level);
+uint8_t avr_io_read(struct avr_sim *sim, uint8_t address);
+void avr_io_write(struct avr_sim *sim, uint8_t address, uint8_t value, uint8_t mask);
+void avr_sleep(struct avr_sim *sim);
+void avr_watchdog_reset(struct avr_sim *sim);
+void avr_fault(struct avr_sim *sim, const char *fault);
+const char *avr_compare(const struct avr_state *a, const struct avr_state *b);
+
+/* The translation of a program, made by avr2c */
+extern const uint32_t avr_translation_checksum;
+void avr_translated_block(struct avr_sim *sim, uint64_t until);
+void avr_translated_run(struct avr_sim *sim, uint64_t until);
+uint32_t avr_checksum(const struct avr_image *image);
+
+/* Registers only the CPU sees: writing them can't change what the peripherals do */
+static inline bool avr_cpu_register(uint8_t address) {
+	return address == IO_SREG || address == IO_SPL || address == IO_SPH ||
+		(address >= IO_GPIOR0 && address <= IO_GPIOR2);
+}
+
+/*
+ * True if a translated block may run: the CPU is awake and no interrupt
+ * is due before the next instruction
+ */
+static inline bool avr_block_ready(const struct avr_sim *sim) {
+	return !sim->s.sleeping && !sim->s.interrupt_delay && !(sim->irq && (sim->s.sreg & (1 << SREG_I)));
+}
+
+static inline uint8_t avr_read(struct avr_sim *sim, uint16_t address) {
+	if (address < 0x20 || (address >= AVR_RAM_START && address < AVR_DATA_SIZE)) {
+		return sim->s.data[address];
+	}
+	if (address < AVR_RAM_START) {
+		return avr_io_read(sim, address - 0x20);
+	}
+	avr_fault(sim, "read outside the data space");
+	return 0;
+}
+
+static inline void avr_write(struct avr_sim *sim, uint16_t address, uint8_t value) {
+	if (address < 0x20 || (address >= AVR_RAM_START && address < AVR_DATA_SIZE)) {
+		sim->s.data[address] = value;
+	} else if (address < AVR_RAM_START) {
+		avr_io_write(sim, address - 0x20, value, 0xFF);
+	} else {
+		avr_fault(sim, "write outside the data space");
+	}
+}
+
+static inline void avr_push(struct avr_sim *sim, uint8_t value) {
+	avr_write(sim, sim->s.sp, value);
+	sim->s.sp--;
+}
+
+static inline uint8_t avr_pop(struct avr_sim *sim) {
+	sim->s.sp++;
+	return avr_read(sim, sim->s.sp);
+}
+
+/* Return addresses are pushed low byte first, in words */
+static inline void avr_push_pc(struct avr_sim *sim, uint16_t address) {
+	avr_push(sim, (address >> 1) & 0xFF);
+	avr_push(sim, address >> 9);
+}
+
+static inline uint16_t avr_pop_pc(struct avr_sim *sim) {
+	uint16_t high = avr_pop(sim);
+	uint16_t low = avr_pop(sim);
+	return ((high << 8 | low) << 1) & (AVR_FLASH_SIZE - 1);
+}
+
+#define AVR_BIT(value, bit) (((value) >> (bit)) & 1)
+
+static inline void avr_flags(struct avr_sim *sim, uint8_t mask, uint8_t flags) {
+	sim->s.sreg = (sim->s.sreg & ~mask) | flags;
+}
+
+/* N, S and Z from a result, V given */
+static inline uint8_t avr_nsz(uint8_t result, uint8_t v) {
+	uint8_t n = result >> 7;
+	return n << SREG_N | (n ^ v) << SREG_S | v << SREG_V | (result == 0) << SREG_Z;
+}
+
+static inline uint8_t avr_add(struct avr_sim *sim, uint8_t a, uint8_t b, uint8_t carry) {
+	uint8_t result = a + b + carry;
+	uint8_t carries = (a & b) | (b & ~result) | (~result & a);
+	uint8_t v = ((a & b & ~result) | (~a & ~b & result)) >> 7;
+	avr_flags(sim, 0x3F, avr_nsz(result, v) | AVR_BIT(carries, 3) << SREG_H | AVR_BIT(carries, 7) << SREG_C);
+	return result;
+}
+
+/* Subtraction; 'keep_z' for the ones with carry, which only clear Z */
+static inline uint8_t avr_sub(struct avr_sim *sim, uint8_t a, uint8_t b, uint8_t carry, bool keep_z) {
+	uint8_t result = a - b - carry;
+	uint8_t borrows = (~a & b) | (b & result) | (result & ~a);
+	uint8_t v = ((a & ~b & ~result) | (~a & b & result)) >> 7;
+	uint8_t flags = avr_nsz(result, v) | AVR_BIT(borrows, 3) << SREG_H | AVR_BIT(borrows, 7) << SREG_C;
+	if (keep_z && result == 0) {
+		flags = (flags & ~(1 << SREG_Z)) | (sim->s.sreg & (1 << SREG_Z));
+	}
+	avr_flags(sim, 0x3F, flags);
+	return result;
+}
+
+static inline uint8_t avr_logic(struct avr_sim *sim, uint8_t result) {
+	avr_flags(sim, 0x1E, avr_nsz(result, 0));
+	return result;
+}
+
+static inline void avr_multiply(struct avr_sim *sim, int32_t product, bool fractional) {
+	uint16_t result = product << fractional;
+	sim->s.data[0] = result;
+	sim->s.data[1] = result >> 8;
+	avr_flags(sim, 1 << SREG_Z | 1 << SREG_C, (result == 0) << SREG_Z | AVR_BIT(product, 15) << SREG_C);
+}
+
+static inline uint16_t avr_pair(const struct avr_sim *sim, uint8_t low) {
+	return sim->s.data[low] | sim->s.data[low + 1] << 8;
+}
+
+static inline void avr_set_pair(struct avr_sim *sim, uint8_t low, uint16_t value) {
+	sim->s.data[low] = value;
+	sim->s.data[low + 1] = value >> 8;
+}
+
+/*
+ * Executes one instruction: updates the state, the program counter and
+ * the cycle count. 'skip' is the length in words of the next instruction,
+ * for the skip instructions.
+ */
+static inline __attribute__((always_inline)) void avr_execute(struct avr_sim *sim, uint8_t op, uint8_t d, uint8_t r,
+		uint16_t k, uint16_t address, uint16_t target, uint8_t words, uint8_t cycles, uint8_t skip) {
+	uint8_t *reg = sim->s.data;
+	uint16_t next = (address + words * 2) & (AVR_FLASH_SIZE - 1);
+	uint8_t c = AVR_BIT(sim->s.sreg, SREG_C);
+	uint16_t pointer;
+
+	sim->s.cycles += cycles;
+
+	switch (op) {
+	case OP_NOP: case OP_BREAK: case OP_SPM:
+		break;
+	case OP_MOVW: reg[d] = reg[r]; reg[d + 1] = reg[r + 1]; break;
+	case OP_MUL: avr_multiply(sim, reg[d] * reg[r], false); break;
+	case OP_MULS: avr_multiply(sim, (int8_t)reg[d] * (int8_t)reg[r], false); break;
+	case OP_MULSU: avr_multiply(sim, (int8_t)reg[d] * reg[r], false); break;
+	case OP_FMUL: avr_multiply(sim, reg[d] * reg[r], true); break;
+	case OP_FMULS: avr_multiply(sim, (int8_t)reg[d] * (int8_t)reg[r], true); break;
+	case OP_FMULSU: avr_multiply(sim, (int8_t)reg[d] * reg[r], true); break;
+	case OP_CPC: avr_sub(sim, reg[d], reg[r], c, true); break;
+	case OP_SBC: reg[d] = avr_sub(sim, reg[d], reg[r], c, true); break;
+	case OP_ADD: reg[d] = avr_add(sim, reg[d], reg[r], 0); break;
+	case OP_ADC: reg[d] = avr_add(sim, reg[d], reg[r], c); break;
+	case OP_CP: avr_sub(sim, reg[d], reg[r], 0, false); break;
+	case OP_SUB: reg[d] = avr_sub(sim, reg[d], reg[r], 0, false); break;
+	case OP_AND: reg[d] = avr_logic(sim, reg[d] & reg[r]); break;
+	case OP_EOR: reg[d] = avr_logic(sim, reg[d] ^ reg[r]); break;
+	case OP_OR: reg[d] = avr_logic(sim, reg[d] | reg[r]); break;
+	case OP_MOV: reg[d] = reg[r]; break;
+	case OP_CPI: avr_sub(sim, reg[d], k, 0, false); break;
+	case OP_SBCI: reg[d] = avr_sub(sim, reg[d], k, c, true); break;
+	case OP_SUBI: reg[d] = avr_sub(sim, reg[d], k, 0, false); break;
+	case OP_ORI: reg[d] = avr_logic(sim, reg[d] | k); break;
+	case OP_ANDI: reg[d] = avr_logic(sim, reg[d] & k); break;
+	case OP_LDI: reg[d] = k; break;
+
+	case OP_LDD_Y: reg[d] = avr_read(sim, avr_pair(sim, 28) + k); break;
+	case OP_LDD_Z: reg[d] = avr_read(sim, avr_pair(sim, 30) + k); break;
+	case OP_STD_Y: avr_write(sim, avr_pair(sim, 28) + k, reg[d]); break;
+	case OP_STD_Z: avr_write(sim, avr_pair(sim, 30) + k, reg[d]); break;
+	case OP_LDS: reg[d] = avr_read(sim, k); break;
+	case OP_STS: avr_write(sim, k, reg[d]); break;
+
+	case OP_LD_X: reg[d] = avr_read(sim, avr_pair(sim, 26)); break;
+	case OP_LD_XINC:
+		pointer = avr_pair(sim, 26);
+		avr_set_pair(sim, 26, pointer + 1);
+		reg[d] = avr_read(sim, pointer);
+		break;
+	case OP_LD_XDEC:
+		pointer = avr_pair(sim, 26) - 1;
+		avr_set_pair(sim, 26, pointer);
+		reg[d] = avr_read(sim, pointer);
+		break;
+	case OP_LD_YINC:
+		pointer = avr_pair(sim, 28);
+		avr_set_pair(sim, 28, pointer + 1);
+		reg[d] = avr_read(sim, pointer);
+		break;
+	case OP_LD_YDEC:
+		pointer = avr_pair(sim, 28) - 1;
+		avr_set_pair(sim, 28, pointer);
+		reg[d] = avr_read(sim, pointer);
+		break;
+	case OP_LD_ZINC:
+		pointer = avr_pair(sim, 30);
+		avr_set_pair(sim, 30, pointer + 1);
+		reg[d] = avr_read(sim, pointer);
+		break;
+	case OP_LD_ZDEC:
+		pointer = avr_pair(sim, 30) - 1;
+		avr_set_pair(sim, 30, pointer);
+		reg[d] = avr_read(sim, pointer);
+		break;
+
+	case OP_ST_X: avr_write(sim, avr_pair(sim, 26), reg[d]); break;
+	case OP_ST_XINC:
+		pointer = avr_pair(sim, 26);
+		avr_write(sim, pointer, reg[d]);
+		avr_set_pair(sim, 26, pointer + 1);
+		break;
+	case OP_ST_XDEC:
+		pointer = avr_pair(sim, 26) - 1;
+		avr_write(sim, pointer, reg[d]);
+		avr_set_pair(sim, 26, pointer);
+		break;
+	case OP_ST_YINC:
+		pointer = avr_pair(sim, 28);
+		avr_write(sim, pointer, reg[d]);
+		avr_set_pair(sim, 28, pointer + 1);
+		break;
+	case OP_ST_YDEC:
+		pointer = avr_pair(sim, 28) - 1;
+		avr_write(sim, pointer, reg[d]);
+		avr_set_pair(sim, 28, pointer);
+		break;
+	case OP_ST_ZINC:
+		pointer = avr_pair(sim, 30);
+		avr_write(sim, pointer, reg[d]);
+		avr_set_pair(sim, 30, pointer + 1);
+		break;
+	case OP_ST_ZDEC:
+		pointer = avr_pair(sim, 30) - 1;
+		avr_write(sim, pointer, reg[d]);
+		avr_set_pair(sim, 30, pointer);
+		break;
+
+	case OP_LPM: reg[0] = sim->image->flash[avr_pair(sim, 30) & (AVR_FLASH_SIZE - 1)]; break;
+	case OP_LPM_Z: case OP_ELPM: reg[d] = sim->image->flash[avr_pair(sim, 30) & (AVR_FLASH_SIZE - 1)]; break;
+	case OP_LPM_ZINC:
+		pointer = avr_pair(sim, 30);
+		avr_set_pair(sim, 30, pointer + 1);
+		reg[d] = sim->image->flash[pointer & (AVR_FLASH_SIZE - 1)];
+		break;
+
+	case OP_PUSH: avr_push(sim, reg[d]); break;
+	case OP_POP: reg[d] = avr_pop(sim); break;
+
+	case OP_COM:
+		reg[d] = avr_logic(sim, ~reg[d]);
+		sim->s.sreg |= 1 << SREG_C;
+		break;
+	case OP_NEG: {
+		uint8_t result = -reg[d];
+		avr_flags(sim, 0x3F, avr_nsz(result, result == 0x80) | AVR_BIT(result | reg[d], 3) << SREG_H |
+			(result != 0) << SREG_C);
+		reg[d] = result;
+		break;
+	}
+	case OP_SWAP: reg[d] = reg[d] << 4 | reg[d] >> 4; break;
+	case OP_INC:
+		reg[d]++;
+		avr_flags(sim, 0x1E, avr_nsz(reg[d], reg[d] == 0x80));
+		break;
+	case OP_DEC:
+		reg[d]--;
+		avr_flags(sim, 0x1E, avr_nsz(reg[d], reg[d] == 0x7F));
+		break;
+	case OP_ASR: case OP_LSR: case OP_ROR: {
+		uint8_t out = reg[d] & 1;
+		uint8_t top = op == OP_ASR ? reg[d] & 0x80 : op == OP_ROR ? c << 7 : 0;
+		uint8_t result = reg[d] >> 1 | top;
+		avr_flags(sim, 0x1F, avr_nsz(result, (result >> 7) ^ out) | out << SREG_C);
+		reg[d] = result;
+		break;
+	}
+
+	case OP_BSET:
+		sim->s.sreg |= 1 << d;
+		if (d == SREG_I) {
+			sim->s.interrupt_delay = true;
+			sim->stop = true;
+		}
+		break;
+	case OP_BCLR: sim->s.sreg &= ~(1 << d); break;
+
+	case OP_ADIW: case OP_SBIW: {
+		uint16_t value = avr_pair(sim, d);
+		uint16_t result = op == OP_ADIW ? value + k : value - k;
+		uint8_t high = value >> 15, top = result >> 15;
+		uint8_t v = op == OP_ADIW ? !high && top : high && !top;
+		uint8_t carry = op == OP_ADIW ? !top && high : top && !high;
+		avr_set_pair(sim, d, result);
+		avr_flags(sim, 0x1F, top << SREG_N | (top ^ v) << SREG_S | v << SREG_V | (result == 0) << SREG_Z |
+			carry << SREG_C);
+		break;
+	}
+
+	case OP_CBI: avr_io_write(sim, d, 0, 1 << r); break;
+	case OP_SBI: avr_io_write(sim, d, 0xFF, 1 << r); break;
+	case OP_SBIC: case OP_SBIS:
+		if (AVR_BIT(avr_io_read(sim, d), r) == (op == OP_SBIS)) {
+			next = (next + skip * 2) & (AVR_FLASH_SIZE - 1);
+			sim->s.cycles += skip;
+		}
+		break;
+	case OP_IN: reg[r] = avr_io_read(sim, d); break;
+	case OP_OUT: avr_io_write(sim, d, reg[r], 0xFF); break;
+
+	case OP_CPSE: case OP_SBRC: case OP_SBRS: {
+		bool skipping = op == OP_CPSE ? reg[d] == reg[r] : AVR_BIT(reg[d], r) == (op == OP_SBRS);
+		if (skipping) {
+			next = (next + skip * 2) & (AVR_FLASH_SIZE - 1);
+			sim->s.cycles += skip;
+		}
+		break;
+	}
+	case OP_BLD: reg[d] = (reg[d] & ~(1 << r)) | AVR_BIT(sim->s.sreg, SREG_T) << r; break;
+	case OP_BST: avr_flags(sim, 1 << SREG_T, AVR_BIT(reg[d], r) << SREG_T); break;
+
+	case OP_RJMP: case OP_JMP: next = target; break;
+	case OP_RCALL: case OP_CALL:
+		avr_push_pc(sim, next);
+		next = target;
+		break;
+	case OP_IJMP: next = (avr_pair(sim, 30) << 1) & (AVR_FLASH_SIZE - 1); break;
+	case OP_ICALL:
+		avr_push_pc(sim, next);
+		next = (avr_pair(sim, 30) << 1) & (AVR_FLASH_SIZE - 1);
+		break;
+	case OP_RET: next = avr_pop_pc(sim); break;
+	case OP_RETI:
+		next = avr_pop_pc(sim);
+		sim->s.sreg |= 1 << SREG_I;
+		sim->s.interrupt_delay = true;
+		break;
+	case OP_BRBS: case OP_BRBC:
+		if (AVR_BIT(sim->s.sreg, d) == (op == OP_BRBS)) {
+			next = target;
+			sim->s.cycles++;
+		}
+		break;
+
+	case OP_SLEEP:
+		if (sim->s.data[0x20 + IO_MCUCR] & (1 << 5)) {
+			avr_sleep(sim);
+		}
+		break;
+	case OP_WDR:
+		avr_watchdog_reset(sim);
+		break;
+
+	default:
+		avr_fault(sim, "unknown instruction");
+		break;
+	}
+
+	sim->s.pc = next;
+}
+
+#endif
@@ -0,0 +1,357 @@
+/*
+ * Cycles and code size of the firmware's routines
+ *
+ * Runs bench.elf (see bench.c) in the interpreter and times every call
+ * between its markers, exactly, with the cost of the harness itself,
+ * timed on a wrapper that does nothing, taken off. The size of a routine
+ * is every byte reachable from its wrapper through direct calls and jumps,
+ * library routines included, less the empty wrapper's.
+ *
+ * Each run is added to a history file and each result is shown next to
+ * the last one recorded for the same routine, so that competing
+ * implementations can be chosen between with numbers. Label the runs
+ * with -l to tell them apart.
+ *
+ * Usage: avrbench [-H history] [-l label] [-n] [-s] [-t seconds] [-e ranges] bench.elf
+ *
+ *   -e ranges      Fail unless the routines in the file, one "routine min max"
+ *                  per line in cycles, all run and stay in their range
+ *   -H history     History file (bench.history)
+ *   -l label       Name of this run in the history (the image's checksum)
+ *   -n             Don't add this run to the history
+ *   -s             Print the history and exit
+ *   -t seconds     Longest the image may run (60)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "avr_sim.h"
+
+// Markers in bench.c
+#define BENCH_BEGIN 0x80
+#define BENCH_END 0x81
+#define BENCH_DONE 0x82
+
+#define MAX_BENCHES 32
+#define MAX_RECORDS 4096
+#define PREFIX "bench_"
+
+struct bench {
+	uint16_t address;           // Bytes
+	char name[32];
+	uint64_t calls;
+	uint64_t total, min, max;   // Cycles
+	unsigned bytes;
+};
+
+struct run {
+	struct bench benches[MAX_BENCHES];
+	unsigned count;
+	struct bench *current;
+	uint64_t began;
+	bool done;
+};
+
+/* A line of the history */
+struct record {
+	char label[64];
+	char name[32];
+	uint64_t calls;
+	double mean;
+	uint64_t min, max;
+	unsigned bytes;
+};
+
+static const struct avr_image *image;
+
+static struct bench *bench_at(struct run *run, uint16_t address) {
+	for (unsigned i = 0; i < run->count; i++) {
+		if (run->benches[i].address == address) {
+			return &run->benches[i];
+		}
+	}
+	if (run->count == MAX_BENCHES) {
+		return NULL;
+	}
+	struct bench *bench = &run->benches[run->count++];
+	memset(bench, 0, sizeof(*bench));
+	bench->address = address;
+	bench->min = UINT64_MAX;
+	const struct avr_symbol *symbol = avr_symbol_at(image, address);
+	if (symbol && strncmp(symbol->name, PREFIX, strlen(PREFIX)) == 0) {
+		snprintf(bench->name, sizeof(bench->name), "%s", symbol->name + strlen(PREFIX));
+	} else {
+		snprintf(bench->name, sizeof(bench->name), "0x%04X", address);
+	}
+	return bench;
+}
+
+static void bench_mark(struct avr_sim *sim, uint8_t mark, void *context) {
+	struct run *run = context;
+	switch (mark) {
+	case BENCH_BEGIN: {
+		uint16_t word = sim->s.data[0x20 + IO_GPIOR1] | sim->s.data[0x20 + IO_GPIOR2] << 8;
+		run->current = bench_at(run, word * 2);
+		run->began = sim->s.cycles;
+		break;
+	}
+	case BENCH_END:
+		if (run->current) {
+			uint64_t cycles = sim->s.cycles - run->began;
+			struct bench *bench = run->current;
+			bench->calls++;
+			bench->total += cycles;
+			bench->min = cycles < bench->min ? cycles : bench->min;
+			bench->max = cycles > bench->max ? cycles : bench->max;
+			run->current = NULL;
+		}
+		break;
+	case BENCH_DONE:
+		run->done = true;
+		sim->stop = true;
+		break;
+	}
+}
+
+/* Bytes of the function at 'address' and of everything it calls or jumps to */
+static unsigned reachable(uint16_t address, bool *visited) {
+	const struct avr_symbol *symbol = avr_symbol_at(image, address);
+	if (!symbol || !symbol->function || visited[symbol - image->symbols]) {
+		return 0;
+	}
+	visited[symbol - image->symbols] = true;
+
+	unsigned bytes = symbol->size;
+	uint16_t end = symbol->address + symbol->size;
+	for (uint16_t at = symbol->address; at < end; ) {
+		struct avr_insn insn;
+		avr_decode(image->flash, at, &insn);
+		bool outside = insn.target < symbol->address || insn.target >= end;
+		if ((insn.flow == FLOW_CALL || insn.flow == FLOW_JUMP) && outside) {
+			bytes += reachable(insn.target, visited);
+		}
+		at += insn.words * 2;
+	}
+	return bytes;
+}
+
+static unsigned code_size(uint16_t address) {
+	bool visited[image->symbol_count];
+	memset(visited, 0, sizeof(visited));
+	return reachable(address, visited);
+}
+
+static unsigned load_history(const char *path, struct record *records) {
+	FILE *file = fopen(path, "r");
+	if (!file) {
+		return 0;
+	}
+	char line[256];
+	unsigned count = 0;
+	while (count < MAX_RECORDS && fgets(line, sizeof(line), file)) {
+		struct record *record = &records[count];
+		unsigned long long calls, min, max;
+		if (line[0] == '#' || sscanf(line, "%*s %*s %63s %31s %llu %lf %llu %llu %u", record->label,
+				record->name, &calls, &record->mean, &min, &max, &record->bytes) != 7) {
+			continue;
+		}
+		record->calls = calls;
+		record->min = min;
+		record->max = max;
+		count++;
+	}
+	fclose(file);
+	return count;
+}
+
+static const struct record *last_record(const struct record *records, unsigned count, const char *name) {
+	for (unsigned i = count; i-- > 0; ) {
+		if (strcmp(records[i].name, name) == 0) {
+			return &records[i];
+		}
+	}
+	return NULL;
+}
+
+static void print_history(const struct record *records, unsigned count) {
+	for (unsigned i = 0; i < count; i++) {
+		bool first = true;
+		for (unsigned j = 0; j < i; j++) {
+			first = first && strcmp(records[j].name, records[i].name) != 0;
+		}
+		if (!first) {
+			continue;
+		}
+		printf("%s\n", records[i].name);
+		for (unsigned j = i; j < count; j++) {
+			const struct record *record = &records[j];
+			if (strcmp(record->name, records[i].name) == 0) {
+				printf("  %-24s %9.1f cycles (%llu - %llu)  %5u bytes\n", record->label, record->mean,
+					(unsigned long long)record->min, (unsigned long long)record->max, record->bytes);
+			}
+		}
+	}
+}
+
+/*
+ * Checks the fastest and slowest calls against the expected ranges
+ */
+static bool check_ranges(const char *path, const struct run *run, uint64_t overhead) {
+	FILE *file = fopen(path, "r");
+	if (!file) {
+		perror(path);
+		return false;
+	}
+	char line[256];
+	bool ok = true;
+	while (fgets(line, sizeof(line), file)) {
+		char name[32];
+		unsigned long long low, high;
+		if (line[0] == '#' || sscanf(line, "%31s %llu %llu", name, &low, &high) != 3) {
+			continue;
+		}
+		const struct bench *bench = NULL;
+		for (unsigned i = 1; i < run->count; i++) {
+			if (strcmp(run->benches[i].name, name) == 0 && run->benches[i].calls) {
+				bench = &run->benches[i];
+			}
+		}
+		if (!bench) {
+			printf("%s: not run\n", name);
+			ok = false;
+			continue;
+		}
+		uint64_t min = bench->min - overhead, max = bench->max - overhead;
+		if (min < low || max > high) {
+			printf("%s: %llu - %llu cycles, expected within %llu - %llu\n", name, (unsigned long long)min,
+				(unsigned long long)max, low, high);
+			ok = false;
+		}
+	}
+	fclose(file);
+	printf("%s\n", ok ? "Within the expected ranges" : "Outside the expected ranges");
+	return ok;
+}
+
+static void usage() {
+	fprintf(stderr, "Usage: avrbench [-H history] [-l label] [-n] [-s] [-t seconds] [-e ranges] bench.elf\n");
+	exit(2);
+}
+
+int main(int argc, char **argv) {
+	static struct avr_image loaded;
+	static struct avr_sim sim;
+	static struct run run;
+	static struct record records[MAX_RECORDS];
+	const char *history = "bench.history";
+	const char *ranges = NULL;
+	char label[64] = "";
+	bool record = true, show = false;
+	double seconds = 60;
+	char error[256];
+	int option;
+
+	while ((option = getopt(argc, argv, "H:l:nst:e:")) != -1) {
+		switch (option) {
+		case 'e': ranges = optarg; break;
+		case 'H': history = optarg; break;
+		case 'l': snprintf(label, sizeof(label), "%s", optarg); break;
+		case 'n': record = false; break;
+		case 's': show = true; break;
+		case 't': seconds = atof(optarg); break;
+		default: usage();
+		}
+	}
+	unsigned count = load_history(history, records);
+	if (show) {
+		print_history(records, count);
+		return 0;
+	}
+	if (optind != argc - 1 || seconds <= 0 || strpbrk(label, " \t")) {
+		usage();
+	}
+	if (!avr_load_elf(argv[optind], &loaded, error, sizeof(error))) {
+		fprintf(stderr, "avrbench: %s\n", error);
+		return 1;
+	}
+	image = &loaded;
+	if (!label[0]) {
+		snprintf(label, sizeof(label), "%08x", avr_checksum(image));
+	}
+
+	avr_init(&sim, image);
+	sim.marker = bench_mark;
+	sim.context = &run;
+	uint64_t until = seconds * F_CPU;
+	while (!run.done && !sim.fault && sim.s.cycles < until) {
+		avr_step(&sim, until);
+	}
+	if (sim.fault) {
+		fprintf(stderr, "avrbench: stopped at 0x%04X: %s\n", sim.s.pc, sim.fault);
+		return 1;
+	}
+	if (!run.done || run.count == 0 || run.benches[0].calls == 0) {
+		fprintf(stderr, "avrbench: no benchmarks finished in %.0f s, is this bench.elf?\n", seconds);
+		return 1;
+	}
+
+	// The first wrapper does nothing: the cost of the harness
+	const struct bench *empty = &run.benches[0];
+	uint64_t overhead = empty->min;
+	unsigned empty_bytes = code_size(empty->address);
+
+	FILE *file = NULL;
+	if (record) {
+		bool exists = access(history, F_OK) == 0;
+		file = fopen(history, "a");
+		if (!file) {
+			perror(history);
+			return 1;
+		}
+		if (!exists) {
+			fprintf(file, "# avrbench history: date time label routine calls mean min max bytes\n");
+		}
+	}
+	char date[32];
+	time_t now = time(NULL);
+	strftime(date, sizeof(date), "%Y-%m-%d %H:%M", localtime(&now));
+
+	printf("%-12s %6s %9s %7s %7s %6s   last recorded\n", "routine", "calls", "cycles", "min", "max", "bytes");
+	for (unsigned i = 1; i < run.count; i++) {
+		struct bench *bench = &run.benches[i];
+		if (bench->calls == 0) {
+			continue;
+		}
+		double mean = (double)bench->total / bench->calls - overhead;
+		uint64_t min = bench->min - overhead, max = bench->max - overhead;
+		unsigned bytes = code_size(bench->address);
+		bench->bytes = bytes > empty_bytes ? bytes - empty_bytes : 0;
+
+		printf("%-12s %6llu %9.1f %7llu %7llu %6u", bench->name, (unsigned long long)bench->calls, mean,
+			(unsigned long long)min, (unsigned long long)max, bench->bytes);
+		const struct record *last = last_record(records, count, bench->name);
+		if (last) {
+			printf("   %9.1f %+6.1f %%  %5u %+5d  %s", last->mean, last->mean ? 100 * (mean - last->mean) / last->mean : 0,
+				last->bytes, (int)bench->bytes - (int)last->bytes, last->label);
+		}
+		printf("\n");
+		if (file) {
+			fprintf(file, "%s %s %s %llu %.1f %llu %llu %u\n", date, label, bench->name,
+				(unsigned long long)bench->calls, mean, (unsigned long long)min, (unsigned long long)max,
+				bench->bytes);
+		}
+	}
+	printf("Harness: %llu cycles and %u bytes per call, taken off\n", (unsigned long long)overhead, empty_bytes);
+	if (file) {
+		fclose(file);
+		printf("Recorded as %s in %s\n", label, history);
+	}
+	if (ranges && !check_ranges(ranges, &run, overhead)) {
+		return 1;
+	}
+	return 0;
+}
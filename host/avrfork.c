@@ -0,0 +1,424 @@
+/*
+ * Branching button scenarios on dice.elf
+ *
+ * Sweeps one moment of a button scenario, like how long the button is
+ * held or when it's pressed again during a roll, and reports the face
+ * each branch ends on and how long it took to show. Everything up to a
+ * branch point is simulated once: a base run carries the common part of
+ * the scenario forward, and at each point the whole simulation (CPU,
+ * SRAM, EEPROM, peripherals, virtual time) is copied and the copy goes
+ * on with the branch's own button changes. With more than one worker the
+ * copies are forked processes, which share the base's pages until they
+ * write to them, and send their outcome back through a pipe.
+ *
+ * A branch ends at the first MARK_FADE (the face on display is the
+ * result) after its last button change, so dice.elf needs to be built
+ * with DEBUG_HOOKS. -x runs every branch again from power up, checks that
+ * it ends in the same state and reports the time the snapshots saved.
+ *
+ * Usage: avrfork [options] dice.elf
+ *
+ *   -r from:to:step  Sweep the hold time of a press, in ms (50:1000:10)
+ *   -m from:to:step  Sweep a second press of 100 ms, in ms after the first release
+ *   -p ms            Press after power up (3000)
+ *   -h ms            Hold time of the first press with -m (300)
+ *   -T seconds       Longest a branch may take to show its result (10)
+ *   -j workers       Parallel workers (one per processor)
+ *   -i               Interpret instead of running the translation
+ *   -x               Also run each branch from power up and compare
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "avr_sim.h"
+
+#define BUTTON_PORT PORT_B
+#define BUTTON 1
+
+// debug_mark() values in dice.c
+#define MARK_FADE 4
+
+#define MAX_CHANGES 8
+#define MAX_BRANCHES 4096
+#define TAP_MS 100
+
+static const uint8_t faces[] = { 0x08, 0x41, 0x2A, 0x63, 0x6B, 0x77 };
+
+struct change {
+	uint64_t at;                // Cycle
+	bool pressed;
+};
+
+struct outcome {
+	uint64_t at;                // Cycles after the last change, 0 for no result
+	uint8_t dots;
+	uint32_t hash;              // Of the state at the result
+	uint64_t started, ended;    // Cycles the branch ran on its own
+};
+
+struct scenario {
+	struct avr_sim sim;
+	struct change changes[MAX_CHANGES];
+	unsigned count, next;
+	bool watching;              // For the result
+	bool done;
+	struct outcome outcome;
+};
+
+static uint64_t cycles_at_ms(double ms) {
+	return ms * (F_CPU / 1000);
+}
+
+static uint32_t state_hash(const struct avr_state *s) {
+	uint32_t hash = 2166136261u;
+	const uint8_t *parts[] = { s->data, s->eeprom };
+	const size_t sizes[] = { sizeof(s->data), sizeof(s->eeprom) };
+	for (int i = 0; i < 2; i++) {
+		for (size_t j = 0; j < sizes[i]; j++) {
+			hash = (hash ^ parts[i][j]) * 16777619u;
+		}
+	}
+	return (hash ^ s->pc ^ s->sreg << 16) * 16777619u;
+}
+
+/* Applies the changes that are due and returns when the next one is */
+static uint64_t script_input(struct avr_sim *sim, void *context) {
+	struct scenario *scenario = context;
+	while (scenario->next < scenario->count && scenario->changes[scenario->next].at <= sim->s.cycles) {
+		avr_set_input(sim, BUTTON_PORT, BUTTON, scenario->changes[scenario->next++].pressed);
+	}
+	return scenario->next < scenario->count ? scenario->changes[scenario->next].at : AVR_NEVER;
+}
+
+static void script_mark(struct avr_sim *sim, uint8_t mark, void *context) {
+	struct scenario *scenario = context;
+	if (mark != MARK_FADE || !scenario->watching || scenario->next < scenario->count) {
+		return;
+	}
+	scenario->outcome.at = sim->s.cycles - scenario->changes[scenario->count - 1].at;
+	scenario->outcome.dots = sim->s.data[0x20 + IO_PORTA] & 0x7F;
+	scenario->outcome.hash = state_hash(&sim->s);
+	scenario->done = true;
+	sim->stop = true;
+}
+
+static void scenario_init(struct scenario *scenario, const struct avr_image *image) {
+	memset(scenario, 0, sizeof(*scenario));
+	avr_init(&scenario->sim, image);
+	scenario->sim.input = script_input;
+	scenario->sim.marker = script_mark;
+	scenario->sim.context = scenario;
+}
+
+/* Adds a change, no earlier than the ones already there */
+static void scenario_add(struct scenario *scenario, uint64_t at, bool pressed) {
+	scenario->changes[scenario->count++] = (struct change){ at, pressed };
+	scenario->sim.input_at = scenario->changes[scenario->next].at;
+	avr_update(&scenario->sim);
+}
+
+/* A copy of 'base' that goes on by itself */
+static void scenario_fork(struct scenario *branch, const struct scenario *base) {
+	*branch = *base;
+	branch->sim.context = branch;
+}
+
+static void scenario_run(struct scenario *scenario, uint64_t until, bool interpreted) {
+	struct avr_sim *sim = &scenario->sim;
+	while (sim->s.cycles < until && !sim->fault && !scenario->done) {
+		if (interpreted) {
+			avr_step(sim, until);
+		} else {
+			avr_translated_block(sim, until);
+		}
+	}
+}
+
+struct sweep {
+	char mode;                  // 'r' hold time, 'm' second press
+	double from, to, step;
+	double press, hold;         // ms
+	uint64_t timeout;           // Cycles
+	bool interpreted;
+};
+
+static unsigned sweep_points(const struct sweep *sweep, uint64_t *points) {
+	unsigned count = 0;
+	for (double ms = sweep->from; ms <= sweep->to + 1e-9 && count < MAX_BRANCHES; ms += sweep->step) {
+		points[count++] = cycles_at_ms(ms);
+	}
+	return count;
+}
+
+/* The changes shared by every branch */
+static void add_prefix(struct scenario *scenario, const struct sweep *sweep) {
+	scenario_add(scenario, cycles_at_ms(sweep->press), true);
+	if (sweep->mode == 'm') {
+		scenario_add(scenario, cycles_at_ms(sweep->press + sweep->hold), false);
+	}
+}
+
+/* Where the branch at 'point' after the first press, or the release, parts */
+static uint64_t branch_point(const struct sweep *sweep, uint64_t point) {
+	return cycles_at_ms(sweep->press + (sweep->mode == 'm' ? sweep->hold : 0)) + point;
+}
+
+static void add_branch(struct scenario *scenario, const struct sweep *sweep, uint64_t point) {
+	uint64_t at = branch_point(sweep, point);
+	if (sweep->mode == 'm') {
+		scenario_add(scenario, at, true);
+		scenario_add(scenario, at + cycles_at_ms(TAP_MS), false);
+	} else {
+		scenario_add(scenario, at, false);
+	}
+}
+
+/* Runs to the first result after the last change */
+static void run_to_result(struct scenario *scenario, const struct sweep *sweep) {
+	scenario->watching = true;
+	scenario_run(scenario, scenario->changes[scenario->count - 1].at + sweep->timeout, sweep->interpreted);
+	scenario->outcome.ended = scenario->sim.s.cycles;
+}
+
+static void run_branch(struct scenario *branch, const struct sweep *sweep, uint64_t point) {
+	branch->outcome.started = branch->sim.s.cycles;
+	add_branch(branch, sweep, point);
+	run_to_result(branch, sweep);
+}
+
+static bool write_all(int fd, const void *data, size_t size) {
+	for (const char *p = data; size; ) {
+		ssize_t n = write(fd, p, size);
+		if (n <= 0) {
+			return false;
+		}
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+static bool read_all(int fd, void *data, size_t size) {
+	for (char *p = data; size; ) {
+		ssize_t n = read(fd, p, size);
+		if (n <= 0) {
+			return false;
+		}
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+struct worker {
+	pid_t pid;
+	int pipe;
+	unsigned branch;
+};
+
+static bool collect(const struct worker *worker, struct outcome *outcomes) {
+	bool ok = read_all(worker->pipe, &outcomes[worker->branch], sizeof(outcomes[0]));
+	close(worker->pipe);
+	waitpid(worker->pid, NULL, 0);
+	return ok;
+}
+
+/*
+ * Runs the base through the branch points and each branch on from its
+ * point. Returns the cycles the base ran, 0 if it or a worker failed
+ */
+static uint64_t fan_out(const struct avr_image *image, const struct sweep *sweep, const uint64_t *points,
+		unsigned count, long workers, struct outcome *outcomes) {
+	static struct scenario base, branch;
+	struct worker running[workers];
+	long active = 0, oldest = 0;
+	bool ok = true;
+
+	scenario_init(&base, image);
+	add_prefix(&base, sweep);
+	for (unsigned i = 0; i < count && !base.sim.fault; i++) {
+		scenario_run(&base, branch_point(sweep, points[i]), sweep->interpreted);
+		if (workers == 1) {
+			scenario_fork(&branch, &base);
+			run_branch(&branch, sweep, points[i]);
+			outcomes[i] = branch.outcome;
+			continue;
+		}
+
+		if (active == workers) {
+			ok &= collect(&running[oldest], outcomes);
+			oldest = (oldest + 1) % workers;
+			active--;
+		}
+		int fds[2];
+		if (pipe(fds) != 0) {
+			perror("pipe");
+			exit(1);
+		}
+		fflush(stdout);
+		struct worker *worker = &running[(oldest + active) % workers];
+		worker->pid = fork();
+		if (worker->pid < 0) {
+			perror("fork");
+			exit(1);
+		}
+		if (worker->pid == 0) {
+			// This process's base is its own copy, the branch
+			close(fds[0]);
+			run_branch(&base, sweep, points[i]);
+			_exit(write_all(fds[1], &base.outcome, sizeof(base.outcome)) ? 0 : 1);
+		}
+		close(fds[1]);
+		worker->pipe = fds[0];
+		worker->branch = i;
+		active++;
+	}
+	for (; active > 0; active--) {
+		ok &= collect(&running[oldest], outcomes);
+		oldest = (oldest + 1) % workers;
+	}
+	if (base.sim.fault) {
+		fprintf(stderr, "avrfork: stopped at 0x%04X: %s\n", base.sim.s.pc, base.sim.fault);
+		return 0;
+	}
+	if (!ok) {
+		fprintf(stderr, "avrfork: a worker failed\n");
+		return 0;
+	}
+	return base.sim.s.cycles;
+}
+
+static int face_of(uint8_t dots) {
+	for (unsigned i = 0; i < sizeof(faces); i++) {
+		if (faces[i] == dots) {
+			return i + 1;
+		}
+	}
+	return 0;
+}
+
+static double now() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+/*
+ * Runs every branch again from power up, with all its changes known from
+ * the start. Returns true if they all end the same
+ */
+static bool recheck(const struct avr_image *image, const struct sweep *sweep, const uint64_t *points,
+		unsigned count, const struct outcome *outcomes) {
+	static struct scenario fresh;
+	bool ok = true;
+	double start = now();
+	for (unsigned i = 0; i < count; i++) {
+		scenario_init(&fresh, image);
+		add_prefix(&fresh, sweep);
+		add_branch(&fresh, sweep, points[i]);
+		run_to_result(&fresh, sweep);
+		free(fresh.sim.code);
+		if (fresh.outcome.at != outcomes[i].at || fresh.outcome.hash != outcomes[i].hash) {
+			printf("Branch at %.1f ms ends differently from power up\n", points[i] * 1000.0 / F_CPU);
+			ok = false;
+		}
+	}
+	printf("From power up: %.3f s wall, %s\n", now() - start, ok ? "same results" : "different results");
+	return ok;
+}
+
+static void usage() {
+	fprintf(stderr, "Usage: avrfork [-r from:to:step | -m from:to:step] [-p ms] [-h ms] [-T seconds] "
+		"[-j workers] [-i] [-x] dice.elf\n");
+	exit(2);
+}
+
+int main(int argc, char **argv) {
+	static struct avr_image image;
+	static uint64_t points[MAX_BRANCHES];
+	static struct outcome outcomes[MAX_BRANCHES];
+	struct sweep sweep = { 'r', 50, 1000, 10, 3000, 300, 10 * F_CPU, false };
+	long workers = sysconf(_SC_NPROCESSORS_ONLN);
+	bool again = false;
+	char error[256];
+	int option;
+
+	while ((option = getopt(argc, argv, "r:m:p:h:T:j:ix")) != -1) {
+		switch (option) {
+		case 'r': case 'm':
+			sweep.mode = option;
+			if (sscanf(optarg, "%lf:%lf:%lf", &sweep.from, &sweep.to, &sweep.step) != 3) {
+				usage();
+			}
+			break;
+		case 'p': sweep.press = atof(optarg); break;
+		case 'h': sweep.hold = atof(optarg); break;
+		case 'T': sweep.timeout = atof(optarg) * F_CPU; break;
+		case 'j': workers = strtol(optarg, NULL, 0); break;
+		case 'i': sweep.interpreted = true; break;
+		case 'x': again = true; break;
+		default: usage();
+		}
+	}
+	if (optind != argc - 1 || sweep.step <= 0 || sweep.from < 0 || sweep.to < sweep.from) {
+		usage();
+	}
+	if (workers < 1) {
+		workers = 1;
+	}
+	if (!avr_load_elf(argv[optind], &image, error, sizeof(error))) {
+		fprintf(stderr, "avrfork: %s\n", error);
+		return 1;
+	}
+	if (!sweep.interpreted && avr_checksum(&image) != avr_translation_checksum) {
+		fprintf(stderr, "avrfork: %s isn't the image that was translated, run make again\n", argv[optind]);
+		return 1;
+	}
+
+	unsigned count = sweep_points(&sweep, points);
+	double start = now();
+	uint64_t base = fan_out(&image, &sweep, points, count, workers, outcomes);
+	double wall = now() - start;
+	if (!base) {
+		return 1;
+	}
+
+	unsigned tally[sizeof(faces) + 1] = { 0 }, none = 0;
+	uint64_t simulated = base, alone = 0;
+	for (unsigned i = 0; i < count; i++) {
+		const struct outcome *outcome = &outcomes[i];
+		printf("%s %7.1f ms  ", sweep.mode == 'm' ? "pressed again" : "held", points[i] * 1000.0 / F_CPU);
+		if (outcome->at) {
+			int face = face_of(outcome->dots);
+			printf("face %c  shown %7.1f ms after the last change\n", face ? '0' + face : '?',
+				outcome->at * 1000.0 / F_CPU);
+			tally[face]++;
+		} else {
+			printf("no result\n");
+			none++;
+		}
+		simulated += outcome->ended - outcome->started;
+		alone += outcome->ended;
+	}
+
+	printf("\nFaces:");
+	for (unsigned face = 1; face <= sizeof(faces); face++) {
+		printf("  %u: %u", face, tally[face]);
+	}
+	printf("  unknown: %u  no result: %u\n", tally[0], none);
+	if (none == count) {
+		printf("No results: was dice.elf built with DEBUG_HOOKS?\n");
+	}
+	printf("%u branches, %.3f s simulated instead of %.3f s from power up (%.1f x less), %.3f s wall\n", count,
+		simulated / (double)F_CPU, alone / (double)F_CPU, alone / (double)simulated, wall);
+
+	if (again && !recheck(&image, &sweep, points, count, outcomes)) {
+		return 1;
+	}
+	return 0;
+}
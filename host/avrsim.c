@@ -0,0 +1,217 @@
+/*
+ * Runs dice.elf in the ATtiny44 simulation against a button workload
+ *
+ * The program runs as translated by avr2c, or in the interpreter with -i.
+ * With -c both run side by side and their whole state is compared at the
+ * end of every translated block and every interpreted step; the first
+ * difference is reported with where it happened. -b runs the same time
+ * in both and reports how much faster the translation is.
+ *
+ * The button (PB1, active high) follows the workload, either generated
+ * from a seed or read from a stream written by workload_gen.
+ *
+ * Usage: avrsim [-i | -c | -b] [-t seconds] [-s seed | -w workload | -n] dice.elf
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "avr_sim.h"
+#include "workload.h"
+
+#define BUTTON_PORT PORT_B
+#define BUTTON 1
+
+struct button {
+	struct workload workload;
+	struct workload_reader reader;
+	bool from_file;
+	bool pending;
+	struct edge edge;
+};
+
+static uint64_t cycles_at(uint64_t microseconds) {
+	return microseconds * (F_CPU / 1000000);
+}
+
+/* Applies the edge that's due and returns when the next one is */
+static uint64_t button_input(struct avr_sim *sim, void *context) {
+	struct button *button = context;
+	if (button->pending) {
+		avr_set_input(sim, BUTTON_PORT, BUTTON, button->edge.pressed);
+	}
+	if (button->from_file) {
+		button->pending = workload_read(&button->reader, &button->edge);
+	} else {
+		workload_next(&button->workload, &button->edge);
+		button->pending = true;
+	}
+	return button->pending ? cycles_at(button->edge.time) : AVR_NEVER;
+}
+
+static void button_init(struct button *button, const char *path, uint64_t seed) {
+	memset(button, 0, sizeof(*button));
+	if (path) {
+		FILE *file = fopen(path, "rb");
+		if (!file || !workload_open(&button->reader, file)) {
+			fprintf(stderr, "avrsim: %s: not a workload stream\n", path);
+			exit(1);
+		}
+		button->from_file = true;
+	} else {
+		struct workload_model model;
+		workload_defaults(&model);
+		workload_init(&button->workload, &model, seed);
+	}
+}
+
+static void sim_init(struct avr_sim *sim, const struct avr_image *image, struct button *button) {
+	avr_init(sim, image);
+	if (button) {
+		sim->input = button_input;
+		sim->context = button;
+		sim->input_at = 0;
+		avr_update(sim);
+	}
+}
+
+static double now() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static void report(const char *name, const struct avr_sim *sim, double wall) {
+	uint64_t awake = sim->s.cycles - sim->slept;
+	printf("%-12s %8.3f s wall  %10.1f x real time  %8.2f M awake cycles/s", name, wall,
+		sim->s.cycles / (double)F_CPU / wall, awake / wall / 1e6);
+	if (sim->skipped) {
+		printf("  (%.1f %% of them in skipped delays)", 100.0 * sim->skipped / (awake ? awake : 1));
+	}
+	printf("\n");
+}
+
+static bool check(struct avr_sim *interpreted, struct avr_sim *translated, uint64_t until) {
+	uint64_t points = 0;
+	while (translated->s.cycles < until && !translated->fault) {
+		uint16_t pc = translated->s.pc;
+		avr_translated_block(translated, until);
+		while (interpreted->s.cycles < translated->s.cycles && !interpreted->fault) {
+			avr_step(interpreted, translated->s.cycles);
+		}
+		avr_sync(interpreted);
+		avr_sync(translated);
+		const char *difference = avr_compare(&interpreted->s, &translated->s);
+		if (!difference && interpreted->irq != translated->irq) {
+			difference = "pending interrupt";
+		}
+		if (!difference && interpreted->next_event != translated->next_event) {
+			difference = "next event";
+		}
+		if (difference) {
+			printf("Difference in %s after the block at 0x%04X, at cycle %llu: pc 0x%04X interpreted, 0x%04X translated\n",
+				difference, pc, (unsigned long long)translated->s.cycles, interpreted->s.pc, translated->s.pc);
+			return false;
+		}
+		points++;
+	}
+	printf("%llu points checked over %.3f s, no difference\n", (unsigned long long)points,
+		translated->s.cycles / (double)F_CPU);
+	return true;
+}
+
+static void usage() {
+	fprintf(stderr, "Usage: avrsim [-i | -c | -b] [-t seconds] [-s seed | -w workload | -n] dice.elf\n");
+	exit(2);
+}
+
+int main(int argc, char **argv) {
+	static struct avr_image image;
+	static struct avr_sim interpreted, translated;
+	static struct button buttons[2];
+	char mode = 't';
+	double seconds = 60;
+	uint64_t seed = 1;
+	const char *path = NULL;
+	bool button = true;
+	char error[256];
+	int option;
+
+	while ((option = getopt(argc, argv, "icbt:s:w:n")) != -1) {
+		switch (option) {
+		case 'i': case 'c': case 'b': mode = option; break;
+		case 't': seconds = atof(optarg); break;
+		case 's': seed = strtoull(optarg, NULL, 0); break;
+		case 'w': path = optarg; break;
+		case 'n': button = false; break;
+		default: usage();
+		}
+	}
+	if (optind != argc - 1 || seconds <= 0) {
+		usage();
+	}
+	if (!avr_load_elf(argv[optind], &image, error, sizeof(error))) {
+		fprintf(stderr, "avrsim: %s\n", error);
+		return 1;
+	}
+	if (mode != 'i' && avr_checksum(&image) != avr_translation_checksum) {
+		fprintf(stderr, "avrsim: %s isn't the image that was translated, run make again\n", argv[optind]);
+		return 1;
+	}
+
+	uint64_t until = seconds * F_CPU;
+	for (int i = 0; i < 2; i++) {
+		button_init(&buttons[i], path, seed);
+	}
+	sim_init(&interpreted, &image, button ? &buttons[0] : NULL);
+	sim_init(&translated, &image, button ? &buttons[1] : NULL);
+
+	bool ok = true;
+	double start = now();
+	switch (mode) {
+	case 'i':
+		avr_run(&interpreted, until);
+		report("interpreted", &interpreted, now() - start);
+		break;
+	case 't':
+		avr_translated_run(&translated, until);
+		report("translated", &translated, now() - start);
+		break;
+	case 'c':
+		ok = check(&interpreted, &translated, until);
+		break;
+	case 'b': {
+		avr_run(&interpreted, until);
+		double middle = now();
+		avr_translated_run(&translated, until);
+		double end = now();
+		avr_sync(&interpreted);
+		avr_sync(&translated);
+		report("interpreted", &interpreted, middle - start);
+		report("translated", &translated, end - middle);
+		const char *difference = avr_compare(&interpreted.s, &translated.s);
+		if (difference) {
+			printf("Final states differ in %s\n", difference);
+			ok = false;
+		}
+		uint64_t awake[2] = { interpreted.s.cycles - interpreted.slept, translated.s.cycles - translated.slept };
+		printf("Speedup %.1f x on awake cycles\n", awake[1] / (end - middle) / (awake[0] / (middle - start)));
+		break;
+	}
+	}
+
+	const struct avr_sim *sim = mode == 'i' ? &interpreted : &translated;
+	printf("%.3f s simulated, %llu interrupts, %.2f %% asleep\n", sim->s.cycles / (double)F_CPU,
+		(unsigned long long)sim->interrupts, 100.0 * sim->slept / (sim->s.cycles ? sim->s.cycles : 1));
+	const struct avr_sim *ran[2] = { mode != 't' ? &interpreted : NULL, mode != 'i' ? &translated : NULL };
+	for (int i = 0; i < 2; i++) {
+		if (ran[i] && ran[i]->fault) {
+			printf("Stopped at 0x%04X: %s\n", ran[i]->s.pc, ran[i]->fault);
+			ok = false;
+		}
+	}
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,165 @@
+/*
+ * Checks of single routines in dice.c
+ *
+ * Includes the firmware like rollstat does, but calls its routines one at
+ * a time instead of running main(). Exits with 1 if any check fails.
+ *
+ *   crossfade  For every delay throw() can step by, the fade it asks for
+ *              must last a fifth to a quarter of the step, and never
+ *              less than the fade of a shorter step.
+ *   spin       A press released before spin() starts is noise and leaves
+ *              the seed alone, unless it goes down again while the
+ *              button settles. A press held long enough rolls.
+ *   gauge      A press held for GAUGE_HOLD shows the fuel gauge instead of
+ *              the spin, and still rolls.
+ *
+ * Usage: dicecheck
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define main dice_main
+#define sleep dice_sleep        // Would clash with unistd.h
+#include "../dice.c"
+#undef main
+#undef sleep
+
+static double now;
+static unsigned failures;
+
+// The button is down from 'pressed_at' until 'released_at', in microseconds
+static double pressed_at, released_at;
+
+void host_delay_us(double us) {
+	now += us;
+	if (now >= pressed_at && now < released_at) {
+		set_high(PINB, BUTTON);
+	} else {
+		set_low(PINB, BUTTON);
+	}
+}
+
+void host_sleep(void) {
+}
+
+static void expect(bool ok, const char *what) {
+	if (!ok) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+#if CROSSFADE
+/*
+ * Returns the number of whole PWM frames a crossfade over 'frames' shows
+ * before it settles on the new figure
+ */
+static unsigned fade_frames(uint8_t frames) {
+	display_figure(faces[0]);
+	crossfade(faces[1], frames);
+
+	unsigned shown_frames = 0;
+	for (;;) {
+		bool frame_begins = fade_phase == INCOMING;
+		if (!crossfade_edge()) {
+			break;
+		}
+		shown_frames += frame_begins;
+	}
+	expect(shown == faces[1], "the crossfade ends on the new figure");
+	return shown_frames;
+}
+
+static void check_crossfade(void) {
+	unsigned last = 0;
+	double shortest = 1, longest = 0;
+	for (uint16_t delay = 1; delay <= DELAY_MAX; delay++) {
+		unsigned frames = fade_frames(delay / 8);
+		expect(frames >= last, "a longer step fades at least as long");
+		last = frames;
+
+		// Short steps fade for a frame or so, rounding dominates there
+		if (delay >= 64) {
+			double share = frames * (FRAME * 1000.0 / F_CPU) / delay;
+			shortest = share < shortest ? share : shortest;
+			longest = share > longest ? share : longest;
+		}
+	}
+	printf("crossfade: %.1f - %.1f %% of the step, %u frames at %u ms\n",
+		shortest * 100, longest * 100, last, DELAY_MAX);
+	expect(shortest >= 0.18 && longest <= 0.25, "the fade lasts a fifth to a quarter of the step");
+}
+#endif
+
+#if ADAPTIVE_DEBOUNCE
+/*
+ * Calls spin() with the button down from 'from' to 'until' milliseconds
+ * after the call. Returns how far the seed moved.
+ */
+static int spin_with(double from, double until) {
+	pressed_at = now + from * 1000;
+	released_at = now + until * 1000;
+	host_delay_us(0);
+
+	uint16_t seed = 1000;
+	return (uint16_t)(spin(seed) - seed);
+}
+
+static void check_spin(void) {
+	int moved = spin_with(-5, 0);
+	printf("spin: released before the call moves the seed by %d, noise %d\n", moved, spun_on_noise);
+	expect(spun_on_noise, "a press released before spin() is noise");
+	expect(moved == 0, "noise leaves the seed as it was");
+
+	moved = spin_with(2, 200);
+	printf("spin: down again after 2 ms for 198 ms moves it by %d, noise %d\n", moved, spun_on_noise);
+	expect(!spun_on_noise, "a press that goes down again while settling rolls");
+	expect(moved > 0, "the press moves the seed");
+
+	moved = spin_with(-5, 100);
+	printf("spin: held for 100 ms moves it by %d, noise %d\n", moved, spun_on_noise);
+	expect(!spun_on_noise, "a press held for 100 ms rolls");
+	expect(moved > 0, "the press moves the seed");
+}
+#endif
+
+#if FUEL_GAUGE && ADAPTIVE_DEBOUNCE
+static void check_gauge(void) {
+	// Three dots, which no spin figure is
+	gauge_figure = 0b0000111;
+
+	// A pass of the spin is the 800 us delay here, about a millisecond on
+	// the chip. Hold for 100 passes short of GAUGE_HOLD and past it.
+	double short_hold = (GAUGE_HOLD - 100) * 0.8, long_hold = (GAUGE_HOLD + 100) * 0.8;
+
+	int moved = spin_with(-5, short_hold);
+	printf("gauge: held for %.0f ms shows %02x, moves the seed by %d\n", short_hold + 5, shown, moved);
+	expect(shown != gauge_figure, "a shorter press shows the spin");
+
+	moved = spin_with(-5, long_hold);
+	printf("gauge: held for %.0f ms shows %02x, moves the seed by %d\n", long_hold + 5, shown, moved);
+	expect(shown == gauge_figure, "a long press shows the gauge");
+	expect(!spun_on_noise && moved > 0, "a long press rolls");
+}
+#endif
+
+int main(void) {
+#if CROSSFADE
+	check_crossfade();
+#endif
+#if ADAPTIVE_DEBOUNCE
+	check_spin();
+#endif
+#if FUEL_GAUGE && ADAPTIVE_DEBOUNCE
+	check_gauge();
+#endif
+
+	if (failures) {
+		printf("%u checks failed\n", failures);
+		return 1;
+	}
+	printf("ok\n");
+	return 0;
+}
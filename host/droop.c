@@ -0,0 +1,468 @@
+/*
+ * Supply droop under the dice's loads
+ *
+ * Reads a VCD trace of dice.elf running under simavr and computes the
+ * supply voltage through it. The trace needs the port registers, the data
+ * direction registers and Timer0's settings, as declared with
+ * AVR_MCU_VCD_SYMBOL() or traced pins:
+ *
+ *   PORTA DDRA PORTB DDRB TCCR0A TCCR0B OCR0A OCR0B
+ *
+ * Pin signals (PA0 - PA7, PB0, PB2) override the registers when present.
+ * Without PB2 or PA7 the floor light's PWM outputs, OC0A and OC0B, are
+ * rebuilt from the compare values and the time Timer0 was started.
+ *
+ * The cell is an open circuit voltage behind a series resistance and a
+ * polarization resistance with its capacitance. The board has a
+ * decoupling capacitor. Leds are a forward voltage and a resistance, the
+ * beeper is a resistance, the CPU a constant current. Between changes the
+ * loads are linear, so each step is solved exactly.
+ *
+ * Usage: droop [options] < trace.vcd
+ *
+ *   -V volts       Open circuit voltage (3.0)
+ *   -R ohms        Series resistance (15)
+ *   -P ohms        Polarization resistance (20)
+ *   -C farads      Polarization capacitance (0.05)
+ *   -D farads      Decoupling capacitance (10e-6)
+ *   -B volts       Brown-out level (1.8)
+ *   -s us          Longest step (100)
+ *   -o file        Write time, voltage and current as CSV
+ *   -r us          CSV resolution (10)
+ *   -e volts       Expected lowest voltage; exits with 1 if it is off by more than a millivolt
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <math.h>
+#include <unistd.h>
+
+// Loads: forward voltage and resistance. About the currents in dice.c's fuel gauge at 3 V
+#define DOT_VF 1.8
+#define DOT_R 440.0
+#define FLOOR_VF 2.6
+#define FLOOR_R 20.0
+#define BEEPER_R 375.0
+#define CPU_CURRENT 0.55e-3
+
+#ifndef F_CPU
+#define F_CPU 1000000UL
+#endif
+
+#define BEEPER 0
+#define FLOOR 2
+
+#define COM0A1 7
+#define COM0B1 5
+
+#define MAX_SIGNALS 64
+#define MAX_REPORTED 20
+
+enum signal {
+	PORTA, DDRA, PORTB, DDRB, TCCR0A, TCCR0B, OCR0A, OCR0B,
+	PIN_A0, PIN_B0 = PIN_A0 + 8, PIN_B2 = PIN_B0 + 2,
+	SIGNALS
+};
+
+static const char *const signal_names[SIGNALS] = {
+	"PORTA", "DDRA", "PORTB", "DDRB", "TCCR0A", "TCCR0B", "OCR0A", "OCR0B",
+	"PA0", "PA1", "PA2", "PA3", "PA4", "PA5", "PA6", "PA7",
+	"PB0", "PB1", "PB2"
+};
+
+struct cell {
+	double open_voltage;
+	double series;
+	double polarization;
+	double polarization_capacitance;
+	double decoupling;
+	double brown_out;
+};
+
+/* Trace state */
+static char identifiers[MAX_SIGNALS][16];
+static int identifier_signal[MAX_SIGNALS];
+static unsigned identifier_count;
+static unsigned value[SIGNALS];
+static bool traced[SIGNALS];
+static double timescale = 1e-9;
+static double timer0_started;
+
+/* Electrical state */
+static double vcc;
+static double polarization_voltage;
+static double lowest = INFINITY;
+static double lowest_at;
+static unsigned lowest_loads;
+static bool browned_out;
+static double brown_out_start;
+static double brown_out_lowest;
+static unsigned brown_outs;
+
+static FILE *csv;
+static double csv_resolution = 10e-6;
+static double csv_next;
+
+static void usage(void) {
+	fprintf(stderr, "usage: droop [-V volts] [-R ohms] [-P ohms] [-C farads] [-D farads] [-B volts]\n"
+		"             [-s us] [-o file] [-r us] [-e volts] < trace.vcd\n");
+	exit(2);
+}
+
+/*
+ * Returns the next whitespace separated token, or NULL at the end
+ */
+static const char *token(void) {
+	static char text[256];
+	unsigned length = 0;
+	int c;
+
+	while ((c = getchar()) != EOF && isspace(c)) {
+	}
+	while (c != EOF && !isspace(c)) {
+		if (length < sizeof(text) - 1) {
+			text[length++] = c;
+		}
+		c = getchar();
+	}
+	text[length] = 0;
+	return length ? text : NULL;
+}
+
+static int signal_called(const char *name) {
+	const char *dot = strrchr(name, '.');
+	if (dot) {
+		name = dot + 1;
+	}
+	for (int i = 0; i < SIGNALS; i++) {
+		if (strcasecmp(name, signal_names[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static void declare(void) {
+	const char *type = token();
+	const char *size = token();
+	const char *identifier = token();
+	const char *name;
+	char copy[16];
+
+	if (!type || !size || !identifier) {
+		return;
+	}
+	snprintf(copy, sizeof(copy), "%s", identifier);
+	name = token();
+
+	int signal = name ? signal_called(name) : -1;
+	if (signal >= 0 && identifier_count < MAX_SIGNALS) {
+		snprintf(identifiers[identifier_count], sizeof(identifiers[0]), "%s", copy);
+		identifier_signal[identifier_count++] = signal;
+		traced[signal] = true;
+	}
+
+	const char *rest;
+	while ((rest = token()) && strcmp(rest, "$end") != 0) {
+	}
+}
+
+static void set_timescale(void) {
+	char text[64] = "";
+	const char *part;
+	while ((part = token()) && strcmp(part, "$end") != 0) {
+		strncat(text, part, sizeof(text) - strlen(text) - 1);
+	}
+
+	double number = strtod(text, NULL);
+	const char *unit = text;
+	while (*unit && (isdigit((unsigned char)*unit) || *unit == '.')) {
+		unit++;
+	}
+	double scale = strcmp(unit, "s") == 0 ? 1 : strcmp(unit, "ms") == 0 ? 1e-3 : strcmp(unit, "us") == 0 ? 1e-6
+		: strcmp(unit, "ns") == 0 ? 1e-9 : strcmp(unit, "ps") == 0 ? 1e-12 : 1e-15;
+	timescale = (number > 0 ? number : 1) * scale;
+}
+
+static void change(const char *identifier, unsigned new_value, double now) {
+	for (unsigned i = 0; i < identifier_count; i++) {
+		if (strcmp(identifiers[i], identifier) == 0) {
+			int signal = identifier_signal[i];
+			if (signal == TCCR0B && !value[TCCR0B] && new_value) {
+				timer0_started = now;
+			}
+			value[signal] = new_value;
+		}
+	}
+}
+
+/*
+ * Output level of an OC0x pin with phase correct PWM: TCNT0 runs up and
+ * down once per 510 timer clocks and the pin is high below the compare value
+ */
+static bool pwm_high(unsigned compare, double now) {
+	static const unsigned prescalers[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+	unsigned prescaler = prescalers[value[TCCR0B] & 7];
+	if (!prescaler) {
+		return false;
+	}
+
+	double ticks = (now - timer0_started) * F_CPU / prescaler;
+	unsigned position = (unsigned)fmod(ticks, 510);
+	unsigned count = position < 255 ? position : 510 - position;
+	return compare == 255 || count < compare;
+}
+
+/*
+ * Time to the next possible PWM edge, one timer clock, or a long time
+ * without PWM
+ */
+static double pwm_tick(void) {
+	static const unsigned prescalers[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+	unsigned prescaler = prescalers[value[TCCR0B] & 7];
+	bool floor_rebuilt = !traced[PIN_B2] && (value[TCCR0A] >> COM0A1 & 1);
+	bool green_rebuilt = !traced[PIN_A0 + 7] && (value[TCCR0A] >> COM0B1 & 1);
+	if (!prescaler || !(floor_rebuilt || green_rebuilt)) {
+		return INFINITY;
+	}
+	return (double)prescaler / F_CPU;
+}
+
+/*
+ * Loads at 'now': a bit per lit dot, then the beeper and the floor light zones
+ */
+static unsigned loads(double now) {
+	unsigned lit = 0;
+
+	for (int dot = 0; dot < 7; dot++) {
+		bool on = traced[PIN_A0 + dot] ? value[PIN_A0 + dot] : (value[PORTA] & value[DDRA]) >> dot & 1;
+		lit |= on << dot;
+	}
+
+	bool beeper = traced[PIN_B0] ? value[PIN_B0] : (value[PORTB] & value[DDRB]) >> BEEPER & 1;
+	lit |= beeper << 7;
+
+	bool floor_light;
+	if (traced[PIN_B2]) {
+		floor_light = value[PIN_B2];
+	} else if (value[TCCR0A] >> COM0A1 & 1) {
+		floor_light = (value[DDRB] >> FLOOR & 1) && pwm_high(value[OCR0A], now);
+	} else {
+		floor_light = (value[PORTB] & value[DDRB]) >> FLOOR & 1;
+	}
+	lit |= floor_light << 8;
+
+	// The green zone on PA7 only runs from OC0B. PA7 is an input in builds without it, so
+	// GREEN_FLOOR's conflicts leave nothing else to drive a traced pin high
+	bool green;
+	if (traced[PIN_A0 + 7]) {
+		green = value[PIN_A0 + 7];
+	} else {
+		green = (value[TCCR0A] >> COM0B1 & 1) && (value[DDRA] >> 7 & 1) && pwm_high(value[OCR0B], now);
+	}
+	lit |= green << 9;
+
+	return lit;
+}
+
+static void describe(unsigned lit) {
+	unsigned dots = 0;
+	for (int dot = 0; dot < 7; dot++) {
+		dots += lit >> dot & 1;
+	}
+	printf("%u dots%s%s%s", dots, lit >> 7 & 1 ? ", beeper" : "", lit >> 8 & 1 ? ", floor light" : "",
+		lit >> 9 & 1 ? ", green floor light" : "");
+}
+
+/*
+ * Advances the circuit by 'dt' with constant loads
+ */
+static void step(const struct cell *cell, double now, double dt, unsigned lit) {
+	// Load as conductance and current: I = G * V - J, leds only above their forward voltage
+	double conductance = 0;
+	double offset = -CPU_CURRENT;
+	for (int dot = 0; dot < 7; dot++) {
+		if ((lit >> dot & 1) && vcc > DOT_VF) {
+			conductance += 1 / DOT_R;
+			offset += DOT_VF / DOT_R;
+		}
+	}
+	if (lit >> 7 & 1) {
+		conductance += 1 / BEEPER_R;
+	}
+	for (int zone = 8; zone <= 9; zone++) {
+		if ((lit >> zone & 1) && vcc > FLOOR_VF) {
+			conductance += 1 / FLOOR_R;
+			offset += FLOOR_VF / FLOOR_R;
+		}
+	}
+
+	// C dV/dt = (Vb - V) / Rs - G V + J
+	double battery = cell->open_voltage - polarization_voltage;
+	double b = 1 / cell->series + conductance;
+	double settled = (battery / cell->series + offset) / b;
+	double start = vcc;
+	vcc = settled + (vcc - settled) * exp(-dt * b / cell->decoupling);
+
+	// Polarization follows the average battery current
+	double current = (battery - (start + vcc) / 2) / cell->series;
+	double target = current * cell->polarization;
+	polarization_voltage = target + (polarization_voltage - target) *
+		exp(-dt / (cell->polarization * cell->polarization_capacitance));
+
+	double low = fmin(start, vcc);
+	if (low < lowest) {
+		lowest = low;
+		lowest_at = now + dt;
+		lowest_loads = lit;
+	}
+
+	if (low < cell->brown_out && !browned_out) {
+		browned_out = true;
+		brown_out_start = now;
+		brown_out_lowest = low;
+		if (brown_outs < MAX_REPORTED) {
+			printf("%12.6f s  below %.2f V with ", now, cell->brown_out);
+			describe(lit);
+			printf("\n");
+		}
+		brown_outs++;
+	} else if (browned_out) {
+		brown_out_lowest = fmin(brown_out_lowest, low);
+		if (vcc >= cell->brown_out) {
+			browned_out = false;
+			if (brown_outs <= MAX_REPORTED) {
+				printf("%12.6f s  recovered after %.1f us, lowest %.3f V\n", now + dt,
+					(now + dt - brown_out_start) * 1e6, brown_out_lowest);
+			}
+		}
+	}
+
+	while (csv && csv_next <= now + dt) {
+		fprintf(csv, "%.6f,%.4f,%.3f\n", csv_next, vcc, current * 1e3);
+		csv_next += csv_resolution;
+	}
+}
+
+/*
+ * Simulates from 'now' to 'until' with the current register values
+ */
+static void advance(const struct cell *cell, double now, double until, double longest) {
+	while (now < until) {
+		double dt = fmin(fmin(until - now, longest), pwm_tick());
+		step(cell, now, dt, loads(now));
+		now += dt;
+	}
+}
+
+int main(int argc, char **argv) {
+	struct cell cell = {
+		.open_voltage = 3.0,
+		.series = 15,
+		.polarization = 20,
+		.polarization_capacitance = 0.05,
+		.decoupling = 10e-6,
+		.brown_out = 1.8
+	};
+	double longest = 100e-6;
+	double expected = NAN;
+	int c;
+
+	while ((c = getopt(argc, argv, "V:R:P:C:D:B:s:o:r:e:")) != -1) {
+		switch (c) {
+		case 'V': cell.open_voltage = atof(optarg); break;
+		case 'R': cell.series = atof(optarg); break;
+		case 'P': cell.polarization = atof(optarg); break;
+		case 'C': cell.polarization_capacitance = atof(optarg); break;
+		case 'D': cell.decoupling = atof(optarg); break;
+		case 'B': cell.brown_out = atof(optarg); break;
+		case 's': longest = atof(optarg) * 1e-6; break;
+		case 'r': csv_resolution = atof(optarg) * 1e-6; break;
+		case 'e': expected = atof(optarg); break;
+		case 'o':
+			csv = fopen(optarg, "w");
+			if (!csv) {
+				perror(optarg);
+				return 1;
+			}
+			fprintf(csv, "time,vcc,current_ma\n");
+			break;
+		default: usage();
+		}
+	}
+	if (optind != argc || longest <= 0 || csv_resolution <= 0) {
+		usage();
+	}
+
+	vcc = cell.open_voltage;
+
+	const char *t;
+	double now = 0;
+	bool defined = false;
+	unsigned long long changes = 0;
+
+	while ((t = token())) {
+		if (t[0] == '$') {
+			if (strcmp(t, "$var") == 0) {
+				declare();
+			} else if (strcmp(t, "$timescale") == 0) {
+				set_timescale();
+			} else if (strcmp(t, "$enddefinitions") == 0) {
+				defined = true;
+			} else if (!defined && strcmp(t, "$end") != 0) {
+				// Skip $comment, $date, $version and $scope bodies
+				while ((t = token()) && strcmp(t, "$end") != 0) {
+				}
+			}
+		} else if (t[0] == '#') {
+			double then = strtod(t + 1, NULL) * timescale;
+			advance(&cell, now, then, longest);
+			now = fmax(now, then);
+		} else if (t[0] == 'b' || t[0] == 'B') {
+			unsigned bits = strtoul(t + 1, NULL, 2);
+			if ((t = token())) {
+				change(t, bits, now);
+				changes++;
+			}
+		} else if (t[0] == 'r' || t[0] == 'R') {
+			double real = strtod(t + 1, NULL);
+			if ((t = token())) {
+				change(t, (unsigned)real, now);
+				changes++;
+			}
+		} else if (strchr("01xXzZ", t[0])) {
+			change(t + 1, t[0] == '1', now);
+			changes++;
+		}
+	}
+
+	if (!defined) {
+		fprintf(stderr, "droop: not a VCD trace\n");
+		return 1;
+	}
+	if (!traced[PORTA] && !traced[PIN_A0] && !traced[PIN_A0 + 1]) {
+		fprintf(stderr, "droop: no dots in the trace, PORTA or PA0 - PA7 expected\n");
+	}
+
+	printf("%.6f s, %llu changes\n", now, changes);
+	if (isfinite(lowest)) {
+		printf("lowest %.3f V at %.6f s with ", lowest, lowest_at);
+		describe(lowest_loads);
+		printf("\n");
+	}
+	printf("%u brown-outs below %.2f V\n", brown_outs, cell.brown_out);
+
+	if (csv) {
+		fclose(csv);
+	}
+	if (!isnan(expected) && !(fabs(lowest - expected) <= 1e-3)) {
+		printf("FAIL: expected the lowest at %.3f V\n", expected);
+		return 1;
+	}
+	return brown_outs ? 1 : 0;
+}
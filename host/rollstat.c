@@ -0,0 +1,543 @@
+/*
+ * Correlation between consecutive rolls
+ *
+ * Runs the firmware's own main() on the host against synthetic button
+ * workloads (see workload.h) and tallies every result against the ones
+ * before it. main() carries the seed over from roll to roll, so a result
+ * might give away the next ones. For each lag up to -k this prints the
+ * correlation of the face values and two chi-square tests: independence
+ * of the pair, and each row of the transition matrix against the overall
+ * distribution. Lag 1 is also split by how soon the next press came, as
+ * quick re-rolls are the likeliest to be predictable.
+ *
+ * A run is a dice powered up with a fresh workload. The firmware's state
+ * is global, so each run is a process of its own, forked from a worker
+ * that has never run the firmware. The runs are shared out to the
+ * workers, and counts go back through pipes. Counts are 64 bit, so
+ * billions of pairs are only a matter of time.
+ *
+ * Usage: rollstat [options]
+ *
+ *   -n runs        Runs to simulate (64)
+ *   -r results     Results per run (100000)
+ *   -k lags        Longest lag (4)
+ *   -j workers     Parallel workers (one per processor)
+ *   -s seed        Workload seed of the first run (1)
+ *   -g seconds     Median gap from release to the next press
+ *   -h ms          Median hold time
+ *   -R p           Probability of pressing again during a roll
+ *   -v             Print the transition matrices of all lags, not just the first
+ *   -x p           Exit with 1 if the independence test of any lag gives p or
+ *                  less, or there are more results than presses. The faces
+ *                  themselves aren't uniform, so that isn't checked.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <setjmp.h>
+#include <math.h>
+#include <time.h>
+
+#include "workload.h"
+
+/* The firmware, with its main() and phase markers taken over */
+static void mark(uint8_t phase);
+
+#define main dice_main
+#define sleep dice_sleep        // Would clash with unistd.h
+#define debug_mark(phase) mark(phase)
+#include "../dice.c"
+#undef main
+#undef sleep
+
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define MAX_LAG 16
+
+// Gaps from a result to the press that started the next roll
+#define GAP_CLASSES 4
+static const double gap_limits[GAP_CLASSES - 1] = { 1e6, 3e6, 10e6 };
+static const char *const gap_names[GAP_CLASSES] = { "under 1 s", "1 - 3 s", "3 - 10 s", "10 s or more" };
+
+/* Everything a worker sends back, summed as an array of counters */
+struct tally {
+	uint64_t results;
+	uint64_t presses;
+	uint64_t simulated;                 // Microseconds
+	uint64_t faces[FACES];
+	uint64_t pairs[MAX_LAG + 1][FACES][FACES];
+	uint64_t offsets[GAP_CLASSES][FACES];
+};
+
+/* Simulation state of the current run */
+static struct workload workload;
+static struct edge next_edge;
+static double now;
+static uint64_t results_left;
+static jmp_buf run_over;
+
+static unsigned lags = 4;
+static uint8_t history[MAX_LAG];
+static unsigned history_length;
+static double press_time;
+static double result_time;
+static struct tally tally;
+
+static void reset_registers(void) {
+#undef HOST_REG
+#define HOST_REG(type, name) name = 0;
+	HOST_REGISTERS
+}
+
+/*
+ * Applies the button edges up to now
+ */
+static void apply_edges(void) {
+	while (next_edge.time <= now) {
+		if (next_edge.pressed) {
+			set_high(PINB, BUTTON);
+		} else {
+			set_low(PINB, BUTTON);
+		}
+		workload_next(&workload, &next_edge);
+	}
+}
+
+void host_delay_us(double us) {
+	now += us;
+	apply_edges();
+}
+
+void host_sleep(void) {
+	if ((MCUCR & (_BV(SM0) | _BV(SM1))) == SLEEP_MODE_ADC) {
+		// Entropy harvest: the conversion completes with a noisy reading
+		if (ADCSRA & _BV(ADEN)) {
+			ADC = 512 + (workload_uniform(&workload) < 0.5);
+			set_low(ADCSRA, ADSC);
+		}
+		return;
+	}
+
+	if ((GIMSK & _BV(PCIE1)) && (PCMSK1 & _BV(PCINT9))) {
+		// Powered down until the button is pressed
+		while (!(PINB & _BV(BUTTON))) {
+			now = fmax(now, (double)next_edge.time);
+			apply_edges();
+		}
+		PCINT1_vect();
+	}
+}
+
+static unsigned face_of(uint8_t figure) {
+	for (unsigned face = 0; face < FACES; face++) {
+		if (faces[face] == figure) {
+			return face;
+		}
+	}
+	fprintf(stderr, "rollstat: 0x%02x on display is not a face\n", figure);
+	exit(1);
+}
+
+static void mark(uint8_t phase) {
+	if (phase == MARK_SPIN) {
+		press_time = now;
+		tally.presses++;
+		return;
+	}
+	if (phase != MARK_FADE) {
+		return;
+	}
+
+	unsigned face = face_of(shown);
+	tally.results++;
+	tally.faces[face]++;
+
+	for (unsigned lag = 1; lag <= lags && lag <= history_length; lag++) {
+		tally.pairs[lag][history[(history_length - lag) % MAX_LAG]][face]++;
+	}
+
+	if (history_length) {
+		unsigned previous = history[(history_length - 1) % MAX_LAG];
+		double gap = press_time - result_time;
+		unsigned class = 0;
+		while (class < GAP_CLASSES - 1 && gap >= gap_limits[class]) {
+			class++;
+		}
+		tally.offsets[class][(face + FACES - previous) % FACES]++;
+	}
+
+	history[history_length % MAX_LAG] = face;
+	history_length++;
+	result_time = now;
+
+	if (--results_left == 0) {
+		longjmp(run_over, 1);
+	}
+}
+
+static void simulate(const struct workload_model *model, uint64_t seed, uint64_t results) {
+	reset_registers();
+	workload_init(&workload, model, seed);
+	workload_next(&workload, &next_edge);
+	now = 0;
+	results_left = results;
+	history_length = 0;
+	press_time = result_time = 0;
+
+	if (!setjmp(run_over)) {
+		dice_main();
+	}
+	tally.simulated += (uint64_t)now;
+}
+
+static void add(struct tally *sum, const struct tally *part) {
+	uint64_t *to = (uint64_t *)sum;
+	const uint64_t *from = (const uint64_t *)part;
+	for (size_t i = 0; i < sizeof(struct tally) / sizeof(uint64_t); i++) {
+		to[i] += from[i];
+	}
+}
+
+/*
+ * Upper regularized incomplete gamma function, for chi-square p-values
+ */
+static double gamma_q(double a, double x) {
+	if (x <= 0) {
+		return 1;
+	}
+
+	double log_prefix = a * log(x) - x - lgamma(a);
+	if (x < a + 1) {
+		double term = 1 / a;
+		double sum = term;
+		for (int n = 1; n < 1000 && fabs(term) > fabs(sum) * 1e-15; n++) {
+			term *= x / (a + n);
+			sum += term;
+		}
+		return 1 - sum * exp(log_prefix);
+	}
+
+	// Continued fraction, modified Lentz
+	double b = x + 1 - a;
+	double c = 1 / 1e-300;
+	double d = 1 / b;
+	double h = d;
+	for (int n = 1; n < 1000; n++) {
+		double an = -n * (n - a);
+		b += 2;
+		d = an * d + b;
+		d = fabs(d) < 1e-300 ? 1e-300 : d;
+		c = b + an / c;
+		c = fabs(c) < 1e-300 ? 1e-300 : c;
+		d = 1 / d;
+		double delta = d * c;
+		h *= delta;
+		if (fabs(delta - 1) < 1e-15) {
+			break;
+		}
+	}
+	return exp(log_prefix) * h;
+}
+
+static double chi_square_p(double chi_square, unsigned freedom) {
+	return gamma_q(freedom / 2.0, chi_square / 2);
+}
+
+/*
+ * Chi-square of observed counts against expected proportions
+ */
+static double goodness(const uint64_t *observed, const double *expected, unsigned n) {
+	double total = 0;
+	for (unsigned i = 0; i < n; i++) {
+		total += observed[i];
+	}
+
+	double chi_square = 0;
+	for (unsigned i = 0; i < n; i++) {
+		double e = expected[i] * total;
+		if (e > 0) {
+			chi_square += (observed[i] - e) * (observed[i] - e) / e;
+		}
+	}
+	return chi_square;
+}
+
+/*
+ * Prints the tests of a lag and returns the p of its independence test
+ */
+static double print_lag(const struct tally *t, unsigned lag, bool matrix) {
+	double rows[FACES] = { 0 }, columns[FACES] = { 0 }, n = 0;
+	for (unsigned a = 0; a < FACES; a++) {
+		for (unsigned b = 0; b < FACES; b++) {
+			rows[a] += t->pairs[lag][a][b];
+			columns[b] += t->pairs[lag][a][b];
+			n += t->pairs[lag][a][b];
+		}
+	}
+	if (n == 0) {
+		return 1;
+	}
+
+	// Independence of the pair and the correlation of the face values
+	double chi_square = 0;
+	double sum_x = 0, sum_y = 0, sum_xx = 0, sum_yy = 0, sum_xy = 0;
+	for (unsigned a = 0; a < FACES; a++) {
+		for (unsigned b = 0; b < FACES; b++) {
+			double observed = t->pairs[lag][a][b];
+			double expected = rows[a] * columns[b] / n;
+			if (expected > 0) {
+				chi_square += (observed - expected) * (observed - expected) / expected;
+			}
+			sum_x += observed * (a + 1);
+			sum_y += observed * (b + 1);
+			sum_xx += observed * (a + 1) * (a + 1);
+			sum_yy += observed * (b + 1) * (b + 1);
+			sum_xy += observed * (a + 1) * (b + 1);
+		}
+	}
+	double covariance = sum_xy / n - sum_x / n * sum_y / n;
+	double deviations = sqrt((sum_xx / n - sum_x / n * sum_x / n) * (sum_yy / n - sum_y / n * sum_y / n));
+	double r = deviations > 0 ? covariance / deviations : 0;
+	double z = r * sqrt(n);
+
+	// Each row against the overall distribution of the later roll
+	double proportions[FACES];
+	for (unsigned b = 0; b < FACES; b++) {
+		proportions[b] = columns[b] / n;
+	}
+	double row_p[FACES];
+	double worst = 1;
+	for (unsigned a = 0; a < FACES; a++) {
+		row_p[a] = chi_square_p(goodness(t->pairs[lag][a], proportions, FACES), FACES - 1);
+		worst = fmin(worst, row_p[a]);
+	}
+
+	double independence = chi_square_p(chi_square, (FACES - 1) * (FACES - 1));
+	printf("lag %-3u %14.0f pairs  r %+.6f (z %+.2f, p %.3g)  independence chi2 %.1f, p %.3g, V %.5f  "
+		"worst row p %.3g\n", lag, n, r, z, erfc(fabs(z) / sqrt(2)), chi_square,
+		independence, sqrt(chi_square / (n * (FACES - 1))), worst);
+
+	if (!matrix) {
+		return independence;
+	}
+	printf("          then:");
+	for (unsigned b = 0; b < FACES; b++) {
+		printf("      %u", b + 1);
+	}
+	printf("    row p\n");
+	for (unsigned a = 0; a < FACES; a++) {
+		printf("        %u      ", a + 1);
+		for (unsigned b = 0; b < FACES; b++) {
+			printf(" %5.2f%%", rows[a] ? 100.0 * t->pairs[lag][a][b] / rows[a] : 0);
+		}
+		printf("  %.3g\n", row_p[a]);
+	}
+	return independence;
+}
+
+/*
+ * Prints the tests of all lags and returns the lowest independence p
+ */
+static double report(const struct tally *t, unsigned runs, double seconds, bool all_matrices) {
+	double uniform[FACES];
+	for (unsigned face = 0; face < FACES; face++) {
+		uniform[face] = 1.0 / FACES;
+	}
+
+	printf("%u runs, %llu results from %llu presses, %.1f simulated years, %.0f results/s\n", runs,
+		(unsigned long long)t->results, (unsigned long long)t->presses, t->simulated / 1e6 / 86400 / 365.25,
+		t->results / seconds);
+
+	printf("faces  ");
+	for (unsigned face = 0; face < FACES; face++) {
+		printf(" %u: %.4f%%", face + 1, t->results ? 100.0 * t->faces[face] / t->results : 0);
+	}
+	printf("  uniform p %.3g\n\n", chi_square_p(goodness(t->faces, uniform, FACES), FACES - 1));
+
+	double lowest = 1;
+	for (unsigned lag = 1; lag <= lags; lag++) {
+		lowest = fmin(lowest, print_lag(t, lag, lag == 1 || all_matrices));
+	}
+
+	printf("\nnext face minus previous, by the gap before the next press:\n");
+	for (unsigned class = 0; class < GAP_CLASSES; class++) {
+		uint64_t total = 0;
+		for (unsigned offset = 0; offset < FACES; offset++) {
+			total += t->offsets[class][offset];
+		}
+		printf("  %-13s %12llu", gap_names[class], (unsigned long long)total);
+		for (unsigned offset = 0; offset < FACES; offset++) {
+			printf("  +%u %5.2f%%", offset, total ? 100.0 * t->offsets[class][offset] / total : 0);
+		}
+		printf("  p %.3g\n", total ? chi_square_p(goodness(t->offsets[class], uniform, FACES), FACES - 1) : 1);
+	}
+	return lowest;
+}
+
+static void usage(void) {
+	fprintf(stderr, "usage: rollstat [-v] [-n runs] [-r results] [-k lags] [-j workers] [-s seed]\n"
+		"                [-g seconds] [-h ms] [-R p] [-x p]\n");
+	exit(2);
+}
+
+static bool write_all(int fd, const void *data, size_t size) {
+	for (const char *p = data; size; ) {
+		ssize_t n = write(fd, p, size);
+		if (n <= 0) {
+			return false;
+		}
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+static bool read_all(int fd, void *data, size_t size) {
+	for (char *p = data; size; ) {
+		ssize_t n = read(fd, p, size);
+		if (n <= 0) {
+			return false;
+		}
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+/*
+ * Simulates a run in a child process, from the firmware's power-up state,
+ * and adds its counts to 'sum'
+ */
+static bool run_fresh(const struct workload_model *model, uint64_t seed, uint64_t results, struct tally *sum) {
+	int fds[2];
+	if (pipe(fds) != 0) {
+		perror("pipe");
+		return false;
+	}
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		close(fds[0]);
+		close(fds[1]);
+		return false;
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		simulate(model, seed, results);
+		_exit(write_all(fds[1], &tally, sizeof(tally)) ? 0 : 1);
+	}
+	close(fds[1]);
+
+	static struct tally part;
+	bool ok = read_all(fds[0], &part, sizeof(part));
+	close(fds[0]);
+	waitpid(pid, NULL, 0);
+	if (ok) {
+		add(sum, &part);
+	}
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	struct workload_model model;
+	unsigned runs = 64;
+	uint64_t results = 100000;
+	long workers = sysconf(_SC_NPROCESSORS_ONLN);
+	uint64_t seed = 1;
+	bool all_matrices = false;
+	double fail_at = -1;
+	int c;
+
+	workload_defaults(&model);
+
+	while ((c = getopt(argc, argv, "n:r:k:j:s:g:h:R:vx:")) != -1) {
+		switch (c) {
+		case 'n': runs = strtoul(optarg, NULL, 0); break;
+		case 'r': results = strtoull(optarg, NULL, 0); break;
+		case 'k': lags = strtoul(optarg, NULL, 0); break;
+		case 'j': workers = strtol(optarg, NULL, 0); break;
+		case 's': seed = strtoull(optarg, NULL, 0); break;
+		case 'g': model.roll_gap_median = atof(optarg); break;
+		case 'h': model.hold_median = atof(optarg); break;
+		case 'R': model.repress_probability = atof(optarg); break;
+		case 'v': all_matrices = true; break;
+		case 'x': fail_at = atof(optarg); break;
+		default: usage();
+		}
+	}
+	if (optind != argc || runs == 0 || results == 0 || lags < 1 || lags > MAX_LAG) {
+		usage();
+	}
+	if (workers < 1) {
+		workers = 1;
+	}
+	if ((unsigned long)workers > runs) {
+		workers = runs;
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	int pipes[workers];
+	pid_t pids[workers];
+	for (long w = 0; w < workers; w++) {
+		int fds[2];
+		if (pipe(fds) != 0) {
+			perror("pipe");
+			return 1;
+		}
+		fflush(stdout);
+		pids[w] = fork();
+		if (pids[w] < 0) {
+			perror("fork");
+			return 1;
+		}
+		if (pids[w] == 0) {
+			close(fds[0]);
+			static struct tally runs_sum;
+			for (unsigned run = w; run < runs; run += workers) {
+				if (!run_fresh(&model, seed + run, results, &runs_sum)) {
+					_exit(1);
+				}
+			}
+			_exit(write_all(fds[1], &runs_sum, sizeof(runs_sum)) ? 0 : 1);
+		}
+		close(fds[1]);
+		pipes[w] = fds[0];
+	}
+
+	// Large enough not to go on the stack
+	static struct tally sum, part;
+	bool failed = false;
+	for (long w = 0; w < workers; w++) {
+		if (read_all(pipes[w], &part, sizeof(part))) {
+			add(&sum, &part);
+		} else {
+			failed = true;
+		}
+		close(pipes[w]);
+		waitpid(pids[w], NULL, 0);
+	}
+	if (failed) {
+		fprintf(stderr, "rollstat: a worker failed\n");
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double seconds = end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9;
+	double lowest = report(&sum, runs, seconds, all_matrices);
+	if (lowest <= fail_at) {
+		printf("FAIL: results depend on the ones before them, p %.3g\n", lowest);
+		return 1;
+	}
+	if (fail_at >= 0 && sum.results > sum.presses) {
+		printf("FAIL: %llu results from %llu presses\n",
+			(unsigned long long)sum.results, (unsigned long long)sum.presses);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,840 @@
+/*
+ * Exhaustive check of the sleep and wake-up paths
+ *
+ * A model of dice.c's main loop, cut down to the statements that touch
+ * the interrupt flag, the pin change masks, the sleep enable bit, the
+ * watchdog and the keypad's sampling, and of the interrupt handlers. Between
+ * any two statements the button may be pressed or released, the
+ * accelerometer may latch its interrupt, a key may change and the
+ * watchdog or Timer1 may tick. Interrupts are taken the way the chip takes
+ * them: at an instruction boundary with the I flag set, in vector order,
+ * never right after sei or reti, and a pending interrupt wakes the CPU as
+ * soon as it sleeps. Every interleaving is explored breadth first, with
+ * the states seen so far in a hash table, until no new state turns up.
+ *
+ * Reported, each with the shortest sequence of events that gets there:
+ *
+ *   deadlock     Asleep with interrupts disabled or nothing armed to wake it
+ *   missed wake  Asleep with an input down that the firmware hasn't noticed
+ *                and that has no interrupt pending; the press goes unanswered
+ *   phantom roll About to roll although the last triggered() found neither
+ *                the button down nor a shake, as after a key wakes the dice
+ *
+ * Each valid combination of the features that change the sleep code is a
+ * model of its own. The combinations are shared out to forked workers.
+ *
+ * The model is written by hand after dice.c: change it with the sleep code.
+ *
+ * Usage: sleepcheck [-f features] [-j workers] [-v]
+ *
+ *   -f features    Check only this combination, as in REMINDER,KEYPAD
+ *   -j workers     Parallel workers (one per processor)
+ *   -v             Print the models
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// Features that change the sleep code
+#define ACCELEROMETER 0x01
+#define KEYPAD 0x02
+#define REMINDER 0x04
+#define LATENCY_REPORT 0x08
+#define FEATURES 4
+
+static const char *feature_names[FEATURES] = { "ACCELEROMETER", "KEYPAD", "REMINDER", "LATENCY_REPORT" };
+
+// Pairs that features.cfg doesn't allow together
+static const unsigned conflicts[] = {
+	ACCELEROMETER | KEYPAD, ACCELEROMETER | LATENCY_REPORT, KEYPAD | LATENCY_REPORT
+};
+
+// Inputs. The accelerometer's interrupt stays up until accel_rearm()
+enum { BUTTON, MOTION, KEY, INPUTS };
+static const char *input_names[INPUTS] = { "button", "motion", "key" };
+
+// Interrupt vectors in priority order. SAMPLE stands for the keypad's tick and the conversion it starts
+enum { V_PCINT0, V_PCINT1, V_WDT, V_SAMPLE, VECTORS, V_NONE = VECTORS };
+static const char *vector_names[VECTORS] = { "PCINT0_vect", "PCINT1_vect", "WDT_vect", "TIM1_COMPB_vect" };
+
+// Pin change interrupt of each input: PCINT9 on port B, PA7 on port A
+static const uint8_t input_vector[INPUTS] = { V_PCINT1, V_PCINT0, V_PCINT0 };
+
+// CPU and peripheral bits
+#define CPU_I 0x01          // Global interrupt enable
+#define CPU_SE 0x02         // Sleep enable
+#define CPU_ASLEEP 0x04
+#define CPU_SHADOW 0x08     // After sei or reti: one more instruction before any interrupt
+#define CPU_WDIE 0x10
+#define CPU_OCIE1B 0x20     // The keypad is being sampled
+#define CPU_TRIGGERED 0x40  // What the last triggered() returned
+
+#define ACTIVE(input) (1 << (input))
+#define UNSEEN(input) (0x10 << (input))
+#define UNSEEN_ANY 0xF0
+
+struct state {
+	uint8_t pc;             // Main program
+	uint8_t isr;            // Handler running, or V_NONE
+	uint8_t isr_pc;
+	uint8_t cpu;
+	uint8_t mask;           // PCMSK bit of each input
+	uint8_t enable;         // PCIE bit of each vector, WDIE and OCIE1B are in 'cpu'
+	uint8_t pending;        // Interrupt flag of each vector
+	uint8_t inputs;         // Down, and down but not noticed by the firmware
+};
+
+_Static_assert(sizeof(struct state) == sizeof(uint64_t), "states are hashed as an uint64_t");
+
+enum {
+	OP_CLI, OP_SEI, OP_MASK, OP_UNMASK, OP_ENABLE, OP_DISABLE, OP_SLEEP_ENABLE, OP_SLEEP_DISABLE, OP_SLEEP,
+	OP_WDT_ON, OP_WDT_OFF, OP_SAMPLE_ON, OP_SAMPLE_OFF, OP_REARM, OP_SPIN, OP_JUMP, OP_IF_TRIGGERED,
+	OP_UNLESS_TRIGGERED, OP_IF_NO_SE, OP_IF_KEY_DOWN, OP_EITHER, OP_NOTICE, OP_RETI
+};
+
+struct op {
+	uint8_t code;
+	uint8_t arg;            // Input, vector or jump target
+	const char *text;       // What it stands for in dice.c
+};
+
+#define MAX_OPS 48
+
+struct program {
+	struct op ops[MAX_OPS];
+	uint8_t count;
+};
+
+struct model {
+	unsigned features;
+	struct program main;
+	struct program isr[VECTORS];
+	struct state initial;
+};
+
+// Steps of a trace: the kind in the high byte
+#define STEP_PRESS 0x100
+#define STEP_RELEASE 0x200
+#define STEP_TICK 0x300
+#define STEP_MAIN 0x400
+#define STEP_ISR 0x500
+#define STEP_INTERRUPT 0x600
+#define STEP_WAKE 0x700
+
+enum { DEADLOCK, MISSED_WAKE, PHANTOM_ROLL, VIOLATIONS };
+static const char *violation_names[VIOLATIONS] = { "deadlock", "missed wake", "phantom roll" };
+
+#define MAX_TRACE 96
+
+/* What a worker sends back for a combination of features */
+struct result {
+	unsigned features;
+	uint64_t states, transitions;
+	bool overflow;
+	uint16_t trace[VIOLATIONS][MAX_TRACE];
+	uint16_t length[VIOLATIONS];        // 0 if not found
+	struct state last[VIOLATIONS];
+};
+
+static uint8_t emit(struct program *program, uint8_t code, uint8_t arg, const char *text) {
+	if (program->count == MAX_OPS) {
+		fprintf(stderr, "sleepcheck: more than %d statements in a program\n", MAX_OPS);
+		exit(2);
+	}
+	program->ops[program->count] = (struct op){ code, arg, text };
+	return program->count++;
+}
+
+/* Points the jump at 'at' to the next statement */
+static void land(struct program *program, uint8_t at) {
+	program->ops[at].arg = program->count;
+}
+
+static void pcint_handler(struct program *isr, unsigned features) {
+	emit(isr, OP_SLEEP_DISABLE, 0, "PCINT1_vect: sleep_disable()");
+	emit(isr, OP_UNMASK, BUTTON, "PCINT1_vect: set_low(PCMSK1, PCINT9)");
+	emit(isr, OP_DISABLE, V_PCINT1, "PCINT1_vect: set_low(GIMSK, PCIE1)");
+	if (features & ACCELEROMETER) {
+		emit(isr, OP_UNMASK, MOTION, "PCINT1_vect: set_low(PCMSK0, MOTION)");
+		emit(isr, OP_DISABLE, V_PCINT0, "PCINT1_vect: set_low(GIMSK, PCIE0)");
+	}
+	emit(isr, OP_RETI, 0, "PCINT1_vect: reti");
+}
+
+static void keypad_arm(struct program *program, const char *caller) {
+	emit(program, OP_MASK, KEY, caller);
+	emit(program, OP_ENABLE, V_PCINT0, "keypad_arm: set_high(GIMSK, PCIE0)");
+}
+
+/*
+ * The main loop from wait_or_sleep() to spin(), and the handlers
+ */
+static void build(struct model *model, unsigned features) {
+	memset(model, 0, sizeof(*model));
+	model->features = features;
+	struct program *p = &model->main;
+
+	if (features & LATENCY_REPORT) {
+		emit(p, OP_MASK, BUTTON, "wait_or_sleep: set_high(PCMSK1, PCINT9)");
+		emit(p, OP_ENABLE, V_PCINT1, "wait_or_sleep: set_high(GIMSK, PCIE1)");
+	}
+	uint8_t waited = emit(p, OP_IF_TRIGGERED, 0, "wait_or_sleep: if (triggered()) return");
+
+	uint8_t asleep = emit(p, OP_CLI, 0, "sleep: cli()");
+	emit(p, OP_MASK, BUTTON, "sleep: set_high(PCMSK1, PCINT9)");
+	emit(p, OP_ENABLE, V_PCINT1, "sleep: set_high(GIMSK, PCIE1)");
+	if (features & ACCELEROMETER) {
+		emit(p, OP_MASK, MOTION, "sleep: set_high(PCMSK0, MOTION)");
+		emit(p, OP_ENABLE, V_PCINT0, "sleep: set_high(GIMSK, PCIE0)");
+	}
+	if (features & KEYPAD) {
+		emit(p, OP_SAMPLE_OFF, 0, "sleep: set_low(TIMSK1, OCIE1B)");
+		keypad_arm(p, "sleep: keypad_arm()");
+		// Keys do nothing while awake but hold the display. One down now wakes the dice when released
+		emit(p, OP_NOTICE, KEY, "sleep: a key down wakes the dice when released");
+	}
+	emit(p, OP_SLEEP_ENABLE, 0, "sleep: sleep_enable()");
+	uint8_t quiet = emit(p, OP_UNLESS_TRIGGERED, 0, "sleep: if (triggered())");
+	emit(p, OP_SLEEP_DISABLE, 0, "sleep: sleep_disable()");
+	land(p, quiet);
+
+	if (features & REMINDER) {
+		uint8_t blank = emit(p, OP_EITHER, 0, "remind: if (!figure) return");
+		emit(p, OP_WDT_ON, 0, "remind: WDTCSR = (1 << WDIE) | REMINDER_WDP");
+		uint8_t flash = emit(p, OP_SEI, 0, "remind: sei()");
+		emit(p, OP_SLEEP, 0, "remind: sleep_cpu()");
+		emit(p, OP_CLI, 0, "remind: cli()");
+		uint8_t pressed = emit(p, OP_IF_NO_SE, 0, "remind: if (!(MCUCR & _BV(SE))) break");
+		emit(p, OP_JUMP, flash, "remind: show(figure), next flash");
+		land(p, pressed);
+		emit(p, OP_WDT_OFF, 0, "remind: WDTCSR = 0");
+		land(p, blank);
+	}
+	emit(p, OP_SEI, 0, "sleep: sei()");
+	emit(p, OP_SLEEP, 0, "sleep: sleep_cpu()");
+	emit(p, OP_UNLESS_TRIGGERED, asleep, "wait_or_sleep: while (!triggered())");
+
+	land(p, waited);
+	emit(p, OP_SPIN, 0, "main: seed = spin(seed)");
+	if (features & ACCELEROMETER) {
+		emit(p, OP_REARM, 0, "main: accel_rearm()");
+	}
+	emit(p, OP_JUMP, 0, "main: next roll");
+
+	pcint_handler(&model->isr[V_PCINT1], features);
+	if (features & ACCELEROMETER) {
+		// ISR_ALIASOF(PCINT1_vect)
+		pcint_handler(&model->isr[V_PCINT0], features);
+	}
+	if (features & KEYPAD) {
+		struct program *isr = &model->isr[V_PCINT0];
+		emit(isr, OP_SLEEP_DISABLE, 0, "PCINT0_vect: sleep_disable()");
+		emit(isr, OP_UNMASK, KEY, "PCINT0_vect: set_low(PCMSK0, PCINT7)");
+		emit(isr, OP_SAMPLE_ON, 0, "PCINT0_vect: set_high(TIMSK1, OCIE1B)");
+		emit(isr, OP_RETI, 0, "PCINT0_vect: reti");
+
+		isr = &model->isr[V_SAMPLE];
+		uint8_t held = emit(isr, OP_IF_KEY_DOWN, 0, "ADC_vect: released?");
+		emit(isr, OP_SAMPLE_OFF, 0, "ADC_vect: set_low(TIMSK1, OCIE1B)");
+		keypad_arm(isr, "ADC_vect: keypad_arm()");
+		land(isr, held);
+		emit(isr, OP_RETI, 0, "ADC_vect: reti");
+	}
+	if (features & REMINDER) {
+		emit(&model->isr[V_WDT], OP_RETI, 0, "WDT_vect: reti");
+	}
+
+	// main() has enabled interrupts and armed the keypad
+	model->initial.isr = V_NONE;
+	model->initial.cpu = CPU_I;
+	if (features & KEYPAD) {
+		model->initial.mask = ACTIVE(KEY);
+		model->initial.enable = 1 << V_PCINT0;
+	}
+}
+
+static bool has_input(const struct model *model, uint8_t input) {
+	return input == BUTTON || (input == MOTION && (model->features & ACCELEROMETER)) ||
+		(input == KEY && (model->features & KEYPAD));
+}
+
+static void change_input(struct state *s, uint8_t input, bool down) {
+	if (down) {
+		s->inputs |= ACTIVE(input) | UNSEEN(input);
+	} else {
+		s->inputs &= ~(ACTIVE(input) | UNSEEN(input));
+	}
+	if (s->mask & ACTIVE(input)) {
+		s->pending |= 1 << input_vector[input];
+	}
+}
+
+/* The firmware has seen the input down, or it doesn't matter that it hasn't */
+static void notice(struct state *s, uint8_t input) {
+	s->inputs &= ~UNSEEN(input);
+}
+
+/* triggered() */
+static bool triggered(const struct model *model, struct state *s) {
+	bool down = s->inputs & ACTIVE(BUTTON);
+	notice(s, BUTTON);
+	if (model->features & ACCELEROMETER) {
+		down = down || (s->inputs & ACTIVE(MOTION));
+		notice(s, MOTION);
+	}
+	if (down) {
+		s->cpu |= CPU_TRIGGERED;
+	} else {
+		s->cpu &= ~CPU_TRIGGERED;
+	}
+	return down;
+}
+
+static bool enabled(const struct state *s, uint8_t vector) {
+	switch (vector) {
+	case V_WDT: return s->cpu & CPU_WDIE;
+	case V_SAMPLE: return s->cpu & CPU_OCIE1B;
+	default: return s->enable & (1 << vector);
+	}
+}
+
+/* The interrupt the CPU takes next, or V_NONE */
+static uint8_t next_interrupt(const struct state *s) {
+	if (!(s->cpu & CPU_I) || (s->cpu & CPU_SHADOW)) {
+		return V_NONE;
+	}
+	for (uint8_t vector = 0; vector < VECTORS; vector++) {
+		bool wakes = vector != V_SAMPLE;    // Timer1 and the ADC are off in power down
+		if ((s->pending & (1 << vector)) && enabled(s, vector) && (wakes || !(s->cpu & CPU_ASLEEP))) {
+			return vector;
+		}
+	}
+	return V_NONE;
+}
+
+static void enter(struct state *s, uint8_t vector) {
+	s->pending &= ~(1 << vector);
+	s->cpu &= ~(CPU_I | CPU_ASLEEP);
+	s->isr = vector;
+	s->isr_pc = 0;
+	for (uint8_t input = 0; input < INPUTS; input++) {
+		if (input_vector[input] == vector || (vector == V_SAMPLE && input == KEY)) {
+			notice(s, input);
+		}
+	}
+}
+
+/* Runs the next statement. Returns the number of successors, up to 2 */
+static unsigned execute(const struct model *model, struct state s, struct state *next) {
+	bool in_isr = s.isr != V_NONE;
+	const struct program *program = in_isr ? &model->isr[s.isr] : &model->main;
+	uint8_t *pc = in_isr ? &s.isr_pc : &s.pc;
+	const struct op *op = &program->ops[*pc];
+
+	(*pc)++;
+	s.cpu &= ~CPU_SHADOW;
+	switch (op->code) {
+	case OP_CLI: s.cpu &= ~CPU_I; break;
+	case OP_SEI: s.cpu |= CPU_I | CPU_SHADOW; break;
+	case OP_MASK: s.mask |= ACTIVE(op->arg); break;
+	case OP_UNMASK: s.mask &= ~ACTIVE(op->arg); break;
+	case OP_ENABLE: s.enable |= 1 << op->arg; break;
+	case OP_DISABLE: s.enable &= ~(1 << op->arg); break;
+	case OP_SLEEP_ENABLE: s.cpu |= CPU_SE; break;
+	case OP_SLEEP_DISABLE: s.cpu &= ~CPU_SE; break;
+	case OP_SLEEP:
+		if (s.cpu & CPU_SE) {
+			s.cpu |= CPU_ASLEEP;
+		}
+		break;
+	case OP_WDT_ON: s.cpu |= CPU_WDIE; break;
+	case OP_WDT_OFF: s.cpu &= ~CPU_WDIE; break;
+	case OP_SAMPLE_ON:
+		s.cpu |= CPU_OCIE1B;
+		s.pending &= ~(1 << V_SAMPLE);
+		break;
+	case OP_SAMPLE_OFF: s.cpu &= ~CPU_OCIE1B; break;
+	case OP_REARM:
+		if (s.inputs & ACTIVE(MOTION)) {
+			change_input(&s, MOTION, false);
+		}
+		break;
+	case OP_SPIN:
+		// Blocked until the button is released
+		if (s.inputs & ACTIVE(BUTTON)) {
+			return 0;
+		}
+		break;
+	case OP_JUMP: *pc = op->arg; break;
+	case OP_IF_TRIGGERED:
+		if (triggered(model, &s)) {
+			*pc = op->arg;
+		}
+		break;
+	case OP_UNLESS_TRIGGERED:
+		if (!triggered(model, &s)) {
+			*pc = op->arg;
+		}
+		break;
+	case OP_IF_NO_SE:
+		if (!(s.cpu & CPU_SE)) {
+			*pc = op->arg;
+		}
+		break;
+	case OP_IF_KEY_DOWN:
+		if (s.inputs & ACTIVE(KEY)) {
+			*pc = op->arg;
+		}
+		break;
+	case OP_NOTICE: notice(&s, op->arg); break;
+	case OP_EITHER:
+		next[0] = s;
+		*pc = op->arg;
+		next[1] = s;
+		return 2;
+	case OP_RETI:
+		s.isr = V_NONE;
+		s.isr_pc = 0;
+		s.cpu |= CPU_I | CPU_SHADOW;
+		break;
+	}
+	next[0] = s;
+	return 1;
+}
+
+/* All the states one event or one statement away, with the steps that lead there */
+static unsigned successors(const struct model *model, const struct state *s, struct state *next, uint16_t *steps) {
+	unsigned count = 0;
+
+	for (uint8_t input = 0; input < INPUTS; input++) {
+		bool down = s->inputs & ACTIVE(input);
+		// Only the firmware clears the accelerometer's latch
+		if (!has_input(model, input) || (input == MOTION && down)) {
+			continue;
+		}
+		next[count] = *s;
+		change_input(&next[count], input, !down);
+		steps[count++] = (down ? STEP_RELEASE : STEP_PRESS) | input;
+	}
+	if (s->cpu & CPU_WDIE) {
+		next[count] = *s;
+		next[count].pending |= 1 << V_WDT;
+		steps[count++] = STEP_TICK | V_WDT;
+	}
+	if ((s->cpu & CPU_OCIE1B) && !(s->cpu & CPU_ASLEEP)) {
+		next[count] = *s;
+		next[count].pending |= 1 << V_SAMPLE;
+		steps[count++] = STEP_TICK | V_SAMPLE;
+	}
+
+	uint8_t vector = next_interrupt(s);
+	if (vector != V_NONE) {
+		next[count] = *s;
+		enter(&next[count], vector);
+		steps[count++] = (s->cpu & CPU_ASLEEP ? STEP_WAKE : STEP_INTERRUPT) | vector;
+	} else if (!(s->cpu & CPU_ASLEEP)) {
+		uint16_t step = s->isr != V_NONE ? STEP_ISR | s->isr << 6 | s->isr_pc : STEP_MAIN | s->pc;
+		for (unsigned n = execute(model, *s, &next[count]); n; n--) {
+			steps[count++] = step;
+		}
+	}
+	return count;
+}
+
+/* Whether an armed source can still wake the CPU */
+static bool can_wake(const struct model *model, const struct state *s) {
+	if (s->cpu & CPU_WDIE) {
+		return true;
+	}
+	for (uint8_t input = 0; input < INPUTS; input++) {
+		bool latched = input == MOTION && (s->inputs & ACTIVE(MOTION));
+		if (has_input(model, input) && (s->mask & ACTIVE(input)) && enabled(s, input_vector[input]) && !latched) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* The violation a state is, or VIOLATIONS */
+static unsigned violation(const struct model *model, const struct state *s) {
+	bool rolls = !(s->cpu & CPU_ASLEEP) && s->isr == V_NONE && model->main.ops[s->pc].code == OP_SPIN;
+	if (rolls && !(s->cpu & CPU_TRIGGERED)) {
+		return PHANTOM_ROLL;
+	}
+	if (!(s->cpu & CPU_ASLEEP) || next_interrupt(s) != V_NONE) {
+		return VIOLATIONS;
+	}
+	if (!(s->cpu & CPU_I) || !can_wake(model, s)) {
+		return DEADLOCK;
+	}
+	if (s->inputs & UNSEEN_ANY) {
+		return MISSED_WAKE;
+	}
+	return VIOLATIONS;
+}
+
+/*
+ * States
+ *
+ * Every state found is kept with the one it was first reached from, so
+ * that the shortest way to it can be traced back. An open addressing
+ * table of indices finds them by value.
+ */
+
+struct node {
+	struct state state;
+	uint32_t parent;
+	uint16_t step;
+};
+
+struct graph {
+	struct node *nodes;
+	uint32_t count, capacity;
+	uint32_t *table;        // Index + 1, 0 if empty
+	uint32_t slots;         // Power of two
+};
+
+#define MAX_STATES (1U << 24)
+
+static uint64_t key(const struct state *s) {
+	uint64_t k;
+	memcpy(&k, s, sizeof(k));
+	return k;
+}
+
+static uint32_t hash(uint64_t k) {
+	k ^= k >> 33;
+	k *= 0xFF51AFD7ED558CCDULL;
+	k ^= k >> 33;
+	k *= 0xC4CEB9FE1A85EC53ULL;
+	return k ^ k >> 33;
+}
+
+static uint32_t *slot(struct graph *graph, uint64_t k) {
+	for (uint32_t i = hash(k) & (graph->slots - 1); ; i = (i + 1) & (graph->slots - 1)) {
+		uint32_t *entry = &graph->table[i];
+		if (!*entry || key(&graph->nodes[*entry - 1].state) == k) {
+			return entry;
+		}
+	}
+}
+
+static void grow(struct graph *graph) {
+	free(graph->table);
+	graph->slots = graph->slots ? graph->slots * 2 : 1 << 12;
+	graph->table = calloc(graph->slots, sizeof(*graph->table));
+	if (!graph->table) {
+		perror("sleepcheck");
+		exit(1);
+	}
+	for (uint32_t i = 0; i < graph->count; i++) {
+		*slot(graph, key(&graph->nodes[i].state)) = i + 1;
+	}
+}
+
+/* Adds a state unless it is known. Returns false if the table is full */
+static bool add(struct graph *graph, const struct state *s, uint32_t parent, uint16_t step) {
+	if (2 * (graph->count + 1) > graph->slots) {
+		grow(graph);
+	}
+	uint32_t *entry = slot(graph, key(s));
+	if (*entry) {
+		return true;
+	}
+	if (graph->count == MAX_STATES) {
+		return false;
+	}
+	if (graph->count == graph->capacity) {
+		graph->capacity = graph->capacity ? graph->capacity * 2 : 1 << 12;
+		graph->nodes = realloc(graph->nodes, graph->capacity * sizeof(*graph->nodes));
+		if (!graph->nodes) {
+			perror("sleepcheck");
+			exit(1);
+		}
+	}
+	graph->nodes[graph->count] = (struct node){ *s, parent, step };
+	*entry = ++graph->count;
+	return true;
+}
+
+static void trace_back(const struct graph *graph, uint32_t index, struct result *result, unsigned violation) {
+	uint16_t reversed[MAX_TRACE];
+	unsigned length = 0;
+	for (uint32_t i = index; i && length < MAX_TRACE; i = graph->nodes[i].parent) {
+		reversed[length++] = graph->nodes[i].step;
+	}
+	for (unsigned i = 0; i < length; i++) {
+		result->trace[violation][i] = reversed[length - 1 - i];
+	}
+	result->length[violation] = length;
+	result->last[violation] = graph->nodes[index].state;
+}
+
+/*
+ * Explores every state of a model, breadth first
+ */
+static void check(const struct model *model, struct result *result) {
+	struct graph graph = { 0 };
+	memset(result, 0, sizeof(*result));
+	result->features = model->features;
+
+	add(&graph, &model->initial, 0, 0);
+	for (uint32_t i = 0; i < graph.count; i++) {
+		struct state s = graph.nodes[i].state;
+		unsigned found = violation(model, &s);
+		if (found < VIOLATIONS && !result->length[found]) {
+			trace_back(&graph, i, result, found);
+		}
+
+		struct state next[INPUTS + 4];
+		uint16_t steps[INPUTS + 4];
+		unsigned count = successors(model, &s, next, steps);
+		result->transitions += count;
+		for (unsigned n = 0; n < count; n++) {
+			if (!add(&graph, &next[n], i, steps[n])) {
+				result->overflow = true;
+			}
+		}
+	}
+	result->states = graph.count;
+	free(graph.nodes);
+	free(graph.table);
+}
+
+static void print_features(unsigned features) {
+	if (!features) {
+		printf("(none)");
+	}
+	for (unsigned f = 0; f < FEATURES; f++) {
+		if (features & (1 << f)) {
+			printf("%s%s", feature_names[f], features >> (f + 1) ? "," : "");
+		}
+	}
+}
+
+static void print_step(const struct model *model, uint16_t step) {
+	uint8_t arg = step & 0xFF;
+	switch (step & 0xFF00) {
+	case STEP_PRESS: printf("      %s %s\n", input_names[arg], arg == MOTION ? "latched" : "down"); break;
+	case STEP_RELEASE: printf("      %s up\n", input_names[arg]); break;
+	case STEP_TICK: printf("      %s tick\n", arg == V_WDT ? "watchdog" : "Timer1"); break;
+	case STEP_MAIN: printf("    %s\n", model->main.ops[arg].text); break;
+	case STEP_ISR: printf("    %s\n", model->isr[arg >> 6].ops[arg & 0x3F].text); break;
+	case STEP_INTERRUPT: printf("    -> %s\n", vector_names[arg]); break;
+	case STEP_WAKE: printf("    wakes up -> %s\n", vector_names[arg]); break;
+	}
+}
+
+static void print_state(const struct state *s) {
+	printf("    %s, I=%d SE=%d, down:", s->cpu & CPU_ASLEEP ? "asleep" : "awake", !!(s->cpu & CPU_I), !!(s->cpu & CPU_SE));
+	for (uint8_t input = 0; input < INPUTS; input++) {
+		if (s->inputs & ACTIVE(input)) {
+			printf(" %s%s", input_names[input], s->inputs & UNSEEN(input) ? " (unnoticed)" : "");
+		}
+	}
+	printf(", armed:");
+	for (uint8_t input = 0; input < INPUTS; input++) {
+		if ((s->mask & ACTIVE(input)) && enabled(s, input_vector[input])) {
+			printf(" %s", input_names[input]);
+		}
+	}
+	printf("%s\n", s->cpu & CPU_WDIE ? " watchdog" : "");
+}
+
+static void print_model(const struct model *model) {
+	printf("  main loop\n");
+	for (unsigned i = 0; i < model->main.count; i++) {
+		printf("  %2u  %s\n", i, model->main.ops[i].text);
+	}
+	for (unsigned vector = 0; vector < VECTORS; vector++) {
+		if (model->isr[vector].count) {
+			printf("  %s\n", vector_names[vector]);
+		}
+		for (unsigned i = 0; i < model->isr[vector].count; i++) {
+			printf("  %2u  %s\n", i, model->isr[vector].ops[i].text);
+		}
+	}
+}
+
+/* Prints a result. Returns true if it is clean */
+static bool report(const struct result *result, bool verbose) {
+	struct model model;
+	build(&model, result->features);
+
+	print_features(result->features);
+	printf(": %llu states, %llu transitions", (unsigned long long)result->states,
+		(unsigned long long)result->transitions);
+	bool clean = !result->overflow;
+	for (unsigned v = 0; v < VIOLATIONS; v++) {
+		clean = clean && !result->length[v];
+	}
+	printf("%s\n", result->overflow ? ", too many states" : clean ? ", ok" : "");
+	if (verbose) {
+		print_model(&model);
+	}
+	for (unsigned v = 0; v < VIOLATIONS; v++) {
+		if (!result->length[v]) {
+			continue;
+		}
+		printf("  %s after %u steps:\n", violation_names[v], result->length[v]);
+		for (unsigned i = 0; i < result->length[v]; i++) {
+			print_step(&model, result->trace[v][i]);
+		}
+		print_state(&result->last[v]);
+	}
+	return clean;
+}
+
+static bool valid(unsigned features) {
+	for (unsigned i = 0; i < sizeof(conflicts) / sizeof(conflicts[0]); i++) {
+		if ((features & conflicts[i]) == conflicts[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool parse_features(const char *list, unsigned *features) {
+	char copy[128];
+	snprintf(copy, sizeof(copy), "%s", list);
+	*features = 0;
+	for (char *name = strtok(copy, ", "); name; name = strtok(NULL, ", ")) {
+		unsigned f = 0;
+		while (f < FEATURES && strcmp(name, feature_names[f]) != 0) {
+			f++;
+		}
+		if (f == FEATURES) {
+			fprintf(stderr, "sleepcheck: unknown feature %s\n", name);
+			return false;
+		}
+		*features |= 1 << f;
+	}
+	if (!valid(*features)) {
+		fprintf(stderr, "sleepcheck: %s can't be combined\n", list);
+		return false;
+	}
+	return true;
+}
+
+static bool write_all(int fd, const void *data, size_t size) {
+	for (const char *p = data; size; ) {
+		ssize_t n = write(fd, p, size);
+		if (n <= 0) {
+			return false;
+		}
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+static bool read_all(int fd, void *data, size_t size) {
+	for (char *p = data; size; ) {
+		ssize_t n = read(fd, p, size);
+		if (n <= 0) {
+			return false;
+		}
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+static void usage() {
+	fprintf(stderr, "Usage: sleepcheck [-f features] [-j workers] [-v]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv) {
+	long workers = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned combinations[1 << FEATURES];
+	unsigned count = 0;
+	bool verbose = false;
+	int c;
+
+	while ((c = getopt(argc, argv, "f:j:v")) != -1) {
+		switch (c) {
+		case 'f':
+			if (!parse_features(optarg, &combinations[0])) {
+				return 2;
+			}
+			count = 1;
+			break;
+		case 'j': workers = strtol(optarg, NULL, 0); break;
+		case 'v': verbose = true; break;
+		default: usage();
+		}
+	}
+	if (optind != argc) {
+		usage();
+	}
+	if (!count) {
+		for (unsigned features = 0; features < 1 << FEATURES; features++) {
+			if (valid(features)) {
+				combinations[count++] = features;
+			}
+		}
+	}
+	if (workers < 1) {
+		workers = 1;
+	}
+	if ((unsigned long)workers > count) {
+		workers = count;
+	}
+
+	int pipes[workers];
+	pid_t pids[workers];
+	for (long w = 0; w < workers; w++) {
+		int fds[2];
+		if (pipe(fds) != 0) {
+			perror("pipe");
+			return 1;
+		}
+		fflush(stdout);
+		pids[w] = fork();
+		if (pids[w] < 0) {
+			perror("fork");
+			return 1;
+		}
+		if (pids[w] == 0) {
+			close(fds[0]);
+			for (unsigned i = w; i < count; i += workers) {
+				static struct model model;
+				static struct result result;
+				build(&model, combinations[i]);
+				check(&model, &result);
+				if (!write_all(fds[1], &result, sizeof(result))) {
+					_exit(1);
+				}
+			}
+			_exit(0);
+		}
+		close(fds[1]);
+		pipes[w] = fds[0];
+	}
+
+	// In order: worker i % workers has combination i
+	bool clean = true, failed = false;
+	for (unsigned i = 0; i < count && !failed; i++) {
+		static struct result result;
+		if (read_all(pipes[i % workers], &result, sizeof(result))) {
+			clean = report(&result, verbose) && clean;
+		} else {
+			failed = true;
+		}
+	}
+	for (long w = 0; w < workers; w++) {
+		close(pipes[w]);
+		waitpid(pids[w], NULL, 0);
+	}
+	if (failed) {
+		fprintf(stderr, "sleepcheck: a worker failed\n");
+		return 1;
+	}
+	return clean ? 0 : 1;
+}
@@ -0,0 +1,647 @@
+/*
+ * Writes a small dice-like program as an AVR ELF file
+ *
+ * For checking the simulator, avr2c and avrfork where avr-gcc isn't at
+ * hand. The program waits for the button with 1 ms delay loops and goes
+ * to sleep after a while, counts through the faces while the button is
+ * down, rolls with slowing steps that a new press interrupts, saves the
+ * result to EEPROM and reads the ADC before showing it. It marks the
+ * phases in GPIOR0 as dice.c does with DEBUG_HOOKS. Timer0 runs the
+ * floor light's PWM with an overflow interrupt that steps the duty, Timer1
+ * overflows into a counter and the button's pin change interrupt wakes it.
+ * The delays are the countdown loops avr-gcc makes of _delay_us(), so
+ * avr2c fast-forwards them as in dice.elf. Startup code and symbols are
+ * laid out as avr-gcc does, so wcet can take both images apart;
+ * wcet_test.cfg and wcet_bench_test.cfg have their answers.
+ *
+ * With -b it writes a program for avrbench instead, with bench.c's
+ * markers: a wrapper that does nothing, a divide by repeated subtraction
+ * and an EEPROM write, each called 64 times. Their cycles are known, and
+ * bench_test.cycles has them for make check.
+ *
+ * The instructions are assembled here, in two passes to resolve labels.
+ *
+ * Usage: testimage [-b] test.elf
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+// I/O addresses
+#define GPIOR0 0x13
+#define GPIOR1 0x14
+#define GPIOR2 0x15
+#define PINB 0x16
+#define DDRB 0x17
+#define PORTA 0x1B
+#define DDRA 0x1A
+#define EECR 0x1C
+#define EEDR 0x1D
+#define EEARL 0x1E
+#define ADCSRA 0x06
+#define ADMUX 0x07
+#define ADCL 0x04
+#define ADCH 0x05
+#define TIMSK1 0x0C
+#define PCMSK1 0x20
+#define TCCR1B 0x2E
+#define TCCR0A 0x30
+#define TCCR0B 0x33
+#define MCUCR 0x35
+#define OCR0A 0x36
+#define TIMSK0 0x39
+#define GIMSK 0x3B
+#define SPL 0x3D
+#define SPH 0x3E
+#define SREG 0x3F
+
+#define BUTTON 1            // PB1
+
+// debug_mark() values in dice.c
+#define MARK_WAIT 1
+#define MARK_SPIN 2
+#define MARK_THROW 3
+#define MARK_FADE 4
+#define MARK_SLEEP 5
+
+// Markers in bench.c
+#define BENCH_BEGIN 0x80
+#define BENCH_END 0x81
+#define BENCH_DONE 0x82
+#define BENCH_CALLS 64
+
+// SRAM
+#define TICKS 0x60          // Timer1 overflows
+#define WAKES 0x61          // Button interrupts
+#define DUTY 0x62           // Floor light
+#define ROLLS 0x63
+#define NOISE 0x64          // ADC readings summed
+#define BENCH_ARG 0x70
+#define BENCH_SINK 0x71
+
+#define VECTORS 17
+
+static const uint8_t faces[] = { 0x08, 0x41, 0x2A, 0x63, 0x6B, 0x77 };
+
+enum {
+	L_VECTORS, L_INIT, L_EXIT, L_STOP, L_MAIN, L_FACES, L_BAD, L_PCINT1, L_TIM1_OVF, L_TIM0_OVF, L_SHOW, L_DELAY_MS,
+	L_LOOP, L_WAIT, L_PRESSED, L_SPIN, L_SHOW_WRAP, L_ROLL, L_STEP, L_EEPROM, L_ADC,
+	L_MS_LOOP, L_DELAY_LOOP, L_DELAY_US,
+	L_NOTHING, L_DIVIDE, L_DIVIDE_LOOP, L_DIVIDED, L_BENCH_DIVIDE, L_BENCH_EEPROM, L_EEPROM_WAIT,
+	L_RUN, L_RUN_LOOP, L_END,
+	LABELS
+};
+
+struct symbol {
+	const char *name;
+	int label;
+	bool object;        // Data in flash rather than a function
+};
+
+static const struct symbol dice_symbols[] = {
+	{ "__vectors", L_VECTORS },
+	{ "__ctors_end", L_INIT },
+	{ "_exit", L_EXIT },
+	{ "__bad_interrupt", L_BAD },
+	{ "__vector_3", L_PCINT1 },
+	{ "__vector_8", L_TIM1_OVF },
+	{ "__vector_11", L_TIM0_OVF },
+	{ "show", L_SHOW },
+	{ "delay_ms", L_DELAY_MS },
+	{ "main", L_MAIN },
+	{ "faces", L_FACES, true },
+	{ NULL }
+};
+
+static const struct symbol bench_symbols[] = {
+	{ "__vectors", L_VECTORS },
+	{ "__ctors_end", L_INIT },
+	{ "_exit", L_EXIT },
+	{ "__bad_interrupt", L_BAD },
+	{ "bench_nothing", L_NOTHING },
+	{ "divide", L_DIVIDE },
+	{ "bench_divide", L_BENCH_DIVIDE },
+	{ "bench_eeprom", L_BENCH_EEPROM },
+	{ "run", L_RUN },
+	{ "main", L_MAIN },
+	{ NULL }
+};
+
+struct assembler {
+	uint8_t flash[4096];
+	uint16_t pc;
+	uint16_t labels[LABELS];
+	const struct symbol *symbols;
+};
+
+static void word(struct assembler *a, uint16_t w) {
+	if ((size_t)a->pc + 2 > sizeof(a->flash)) {
+		fprintf(stderr, "testimage: program doesn't fit\n");
+		exit(1);
+	}
+	a->flash[a->pc++] = w;
+	a->flash[a->pc++] = w >> 8;
+}
+
+static void label(struct assembler *a, int l) {
+	a->labels[l] = a->pc;
+}
+
+/* Words from the next instruction to the label */
+static int relative(const struct assembler *a, int l) {
+	return (a->labels[l] - (a->pc + 2)) / 2;
+}
+
+static void immediate(struct assembler *a, uint16_t op, uint8_t d, uint8_t k) {
+	word(a, op | (k & 0xF0) << 4 | (d - 16) << 4 | (k & 0x0F));
+}
+
+static void registers(struct assembler *a, uint16_t op, uint8_t d, uint8_t r) {
+	word(a, op | (r & 0x10) << 5 | d << 4 | (r & 0x0F));
+}
+
+static void ldi(struct assembler *a, uint8_t d, uint8_t k) { immediate(a, 0xE000, d, k); }
+static void cpi(struct assembler *a, uint8_t d, uint8_t k) { immediate(a, 0x3000, d, k); }
+static void subi(struct assembler *a, uint8_t d, uint8_t k) { immediate(a, 0x5000, d, k); }
+static void sbci(struct assembler *a, uint8_t d, uint8_t k) { immediate(a, 0x4000, d, k); }
+static void add(struct assembler *a, uint8_t d, uint8_t r) { registers(a, 0x0C00, d, r); }
+static void eor(struct assembler *a, uint8_t d, uint8_t r) { registers(a, 0x2400, d, r); }
+static void adc(struct assembler *a, uint8_t d, uint8_t r) { registers(a, 0x1C00, d, r); }
+static void mov(struct assembler *a, uint8_t d, uint8_t r) { registers(a, 0x2C00, d, r); }
+static void tst(struct assembler *a, uint8_t d) { registers(a, 0x2000, d, d); }
+static void inc(struct assembler *a, uint8_t d) { word(a, 0x9403 | d << 4); }
+static void dec(struct assembler *a, uint8_t d) { word(a, 0x940A | d << 4); }
+static void push(struct assembler *a, uint8_t d) { word(a, 0x920F | d << 4); }
+static void pop(struct assembler *a, uint8_t d) { word(a, 0x900F | d << 4); }
+static void lpm(struct assembler *a, uint8_t d) { word(a, 0x9004 | d << 4); }
+
+static void in(struct assembler *a, uint8_t d, uint8_t io) {
+	word(a, 0xB000 | (io & 0x30) << 5 | d << 4 | (io & 0x0F));
+}
+
+static void out(struct assembler *a, uint8_t io, uint8_t r) {
+	word(a, 0xB800 | (io & 0x30) << 5 | r << 4 | (io & 0x0F));
+}
+
+static void out_value(struct assembler *a, uint8_t io, uint8_t value) {
+	ldi(a, 16, value);
+	out(a, io, 16);
+}
+
+static void lds(struct assembler *a, uint8_t d, uint16_t k) {
+	word(a, 0x9000 | d << 4);
+	word(a, k);
+}
+
+static void sts(struct assembler *a, uint16_t k, uint8_t r) {
+	word(a, 0x9200 | r << 4);
+	word(a, k);
+}
+
+static void sbi(struct assembler *a, uint8_t io, uint8_t bit) { word(a, 0x9A00 | io << 3 | bit); }
+static void sbic(struct assembler *a, uint8_t io, uint8_t bit) { word(a, 0x9900 | io << 3 | bit); }
+static void sbiw(struct assembler *a, uint8_t d, uint8_t k) { word(a, 0x9700 | (k & 0x30) << 2 | (d - 24) / 2 << 4 | (k & 0x0F)); }
+static void rjmp(struct assembler *a, int l) { word(a, 0xC000 | (relative(a, l) & 0xFFF)); }
+static void rcall(struct assembler *a, int l) { word(a, 0xD000 | (relative(a, l) & 0xFFF)); }
+static void brne(struct assembler *a, int l) { word(a, 0xF401 | (relative(a, l) & 0x7F) << 3); }
+static void brlo(struct assembler *a, int l) { word(a, 0xF000 | (relative(a, l) & 0x7F) << 3); }
+static void ret(struct assembler *a) { word(a, 0x9508); }
+static void reti(struct assembler *a) { word(a, 0x9518); }
+static void sei(struct assembler *a) { word(a, 0x9478); }
+static void cli(struct assembler *a) { word(a, 0x94F8); }
+static void sleep(struct assembler *a) { word(a, 0x9588); }
+static void icall(struct assembler *a) { word(a, 0x9509); }
+static void nop(struct assembler *a) { word(a, 0x0000); }
+
+static void mark(struct assembler *a, uint8_t phase) {
+	out_value(a, GPIOR0, phase);
+}
+
+/*
+ * avr-gcc's startup code: r1 cleared, the stack at the end of RAM, then
+ * main() called and interrupts off for good if it returns
+ */
+static void startup(struct assembler *a) {
+	label(a, L_INIT);
+	eor(a, 1, 1);
+	out(a, SREG, 1);
+	ldi(a, 28, 0x5F);
+	ldi(a, 29, 0x01);
+	out(a, SPH, 29);
+	out(a, SPL, 28);
+	rcall(a, L_MAIN);
+	label(a, L_EXIT);
+	cli(a);
+	label(a, L_STOP);
+	rjmp(a, L_STOP);
+}
+
+/* Z to the word address of a label, for icall */
+static void load_z(struct assembler *a, int l) {
+	ldi(a, 30, a->labels[l] / 2 & 0xFF);
+	ldi(a, 31, a->labels[l] / 2 >> 8);
+}
+
+/* Increments a byte of SRAM in an interrupt handler */
+static void isr_count(struct assembler *a, uint16_t address) {
+	push(a, 24);
+	in(a, 24, SREG);
+	push(a, 24);
+	lds(a, 24, address);
+	inc(a, 24);
+	sts(a, address, 24);
+}
+
+static void isr_return(struct assembler *a) {
+	pop(a, 24);
+	out(a, SREG, 24);
+	pop(a, 24);
+	reti(a);
+}
+
+static void dice_program(struct assembler *a) {
+	a->pc = 0;
+	a->symbols = dice_symbols;
+	label(a, L_VECTORS);
+	for (int v = 0; v < VECTORS; v++) {
+		int target = v == 0 ? L_INIT : v == 3 ? L_PCINT1 : v == 8 ? L_TIM1_OVF : v == 11 ? L_TIM0_OVF : L_BAD;
+		rjmp(a, target);
+	}
+	startup(a);
+
+	label(a, L_BAD);
+	reti(a);
+
+	// Wakes the CPU and disarms itself, like dice.c's
+	label(a, L_PCINT1);
+	isr_count(a, WAKES);
+	ldi(a, 24, 0);
+	out(a, PCMSK1, 24);
+	isr_return(a);
+
+	label(a, L_TIM1_OVF);
+	isr_count(a, TICKS);
+	isr_return(a);
+
+	// Steps the floor light's duty every frame
+	label(a, L_TIM0_OVF);
+	isr_count(a, DUTY);
+	out(a, OCR0A, 24);
+	isr_return(a);
+
+	// Shows face r20 from the table in flash
+	label(a, L_SHOW);
+	ldi(a, 30, a->labels[L_FACES] & 0xFF);
+	ldi(a, 31, a->labels[L_FACES] >> 8);
+	add(a, 30, 20);
+	adc(a, 31, 1);
+	lpm(a, 24);
+	out(a, PORTA, 24);
+	ret(a);
+
+	// Waits r24 milliseconds, _delay_us(1000) style. Returns early if the button is down, with r24 left over
+	label(a, L_DELAY_MS);
+	label(a, L_MS_LOOP);
+	ldi(a, 18, 249);
+	ldi(a, 19, 0);
+	label(a, L_DELAY_LOOP);
+	subi(a, 18, 1);
+	sbci(a, 19, 0);
+	brne(a, L_DELAY_LOOP);
+	sbic(a, PINB, BUTTON);
+	ret(a);
+	dec(a, 24);
+	brne(a, L_MS_LOOP);
+	ret(a);
+
+	label(a, L_MAIN);
+	out_value(a, DDRA, 0x7F);
+	out_value(a, DDRB, 0x05);
+	out_value(a, TCCR0A, 0x81);         // Phase correct PWM on OC0A
+	out_value(a, TCCR0B, 0x02);         // CLK/8
+	out_value(a, TIMSK0, 0x01);
+	out_value(a, TCCR1B, 0x01);
+	out_value(a, TIMSK1, 0x01);
+	sei(a);
+	ldi(a, 20, 0);
+
+	label(a, L_LOOP);
+	mark(a, MARK_WAIT);
+	ldi(a, 26, 0xB8);                   // 3000 ms
+	ldi(a, 27, 0x0B);
+	label(a, L_WAIT);
+	sbic(a, PINB, BUTTON);
+	rjmp(a, L_PRESSED);
+	ldi(a, 24, 1);
+	rcall(a, L_DELAY_MS);
+	sbiw(a, 26, 1);
+	brne(a, L_WAIT);
+
+	// Power down until the button is pressed
+	mark(a, MARK_SLEEP);
+	out_value(a, PORTA, 0);
+	cli(a);
+	out_value(a, PCMSK1, 1 << BUTTON);
+	out_value(a, GIMSK, 0x20);
+	out_value(a, MCUCR, 0x30);          // SE, power down
+	sei(a);
+	sleep(a);
+	out_value(a, MCUCR, 0);
+	rjmp(a, L_LOOP);
+
+	// Counts through the faces while the button is down
+	label(a, L_PRESSED);
+	mark(a, MARK_SPIN);
+	label(a, L_SPIN);
+	inc(a, 20);
+	cpi(a, 20, sizeof(faces));
+	brlo(a, L_SHOW_WRAP);
+	ldi(a, 20, 0);
+	label(a, L_SHOW_WRAP);
+	rcall(a, L_SHOW);
+	ldi(a, 22, 200);                    // _delay_us(800)
+	label(a, L_DELAY_US);
+	dec(a, 22);
+	nop(a);
+	brne(a, L_DELAY_US);
+	sbic(a, PINB, BUTTON);
+	rjmp(a, L_SPIN);
+
+	// Rolls on for ten steps of 20 ms and 15 ms longer each. A press goes back to spinning
+	mark(a, MARK_THROW);
+	ldi(a, 21, 10);
+	ldi(a, 23, 20);
+	label(a, L_ROLL);
+	inc(a, 20);
+	cpi(a, 20, sizeof(faces));
+	brlo(a, L_STEP);
+	ldi(a, 20, 0);
+	label(a, L_STEP);
+	rcall(a, L_SHOW);
+	mov(a, 24, 23);
+	rcall(a, L_DELAY_MS);
+	tst(a, 24);
+	brne(a, L_PRESSED);
+	subi(a, 23, -15);
+	dec(a, 21);
+	brne(a, L_ROLL);
+
+	// Save the result
+	label(a, L_EEPROM);
+	sbic(a, EECR, 1);
+	rjmp(a, L_EEPROM);
+	out_value(a, EEARL, 0);
+	out(a, EEDR, 20);
+	sbi(a, EECR, 2);
+	sbi(a, EECR, 1);
+	lds(a, 24, ROLLS);
+	inc(a, 24);
+	sts(a, ROLLS, 24);
+
+	// A conversion, summed into NOISE
+	out_value(a, ADMUX, 0x21);
+	out_value(a, ADCSRA, 0xC3);
+	label(a, L_ADC);
+	sbic(a, ADCSRA, 6);
+	rjmp(a, L_ADC);
+	in(a, 24, ADCL);
+	in(a, 25, ADCH);
+	lds(a, 18, NOISE);
+	add(a, 18, 24);
+	adc(a, 18, 25);
+	sts(a, NOISE, 18);
+	out_value(a, ADCSRA, 0);
+
+	mark(a, MARK_FADE);
+	rjmp(a, L_LOOP);
+
+	label(a, L_FACES);
+	for (unsigned i = 0; i < sizeof(faces); i += 2) {
+		word(a, faces[i] | (i + 1 < sizeof(faces) ? faces[i + 1] : 0) << 8);
+	}
+}
+
+/*
+ * Calls each wrapper BENCH_CALLS times between markers, as bench.c's run()
+ * does. An EEPROM write takes 3.4 ms, as far as the simulation is concerned.
+ */
+static void bench_program(struct assembler *a) {
+	a->pc = 0;
+	a->symbols = bench_symbols;
+	label(a, L_VECTORS);
+	for (int v = 0; v < VECTORS; v++) {
+		rjmp(a, v == 0 ? L_INIT : L_BAD);
+	}
+	startup(a);
+
+	label(a, L_BAD);
+	reti(a);
+
+	label(a, L_NOTHING);
+	lds(a, 24, BENCH_ARG);
+	sts(a, BENCH_SINK, 24);
+	ret(a);
+
+	// r25 = r24 / 6
+	label(a, L_DIVIDE);
+	label(a, L_DIVIDE_LOOP);
+	subi(a, 24, 6);
+	brlo(a, L_DIVIDED);
+	inc(a, 25);
+	rjmp(a, L_DIVIDE_LOOP);
+	label(a, L_DIVIDED);
+	ret(a);
+
+	label(a, L_BENCH_DIVIDE);
+	lds(a, 24, BENCH_ARG);
+	ldi(a, 25, 0);
+	rcall(a, L_DIVIDE);
+	sts(a, BENCH_SINK, 25);
+	ret(a);
+
+	label(a, L_BENCH_EEPROM);
+	lds(a, 24, BENCH_ARG);
+	out(a, EEDR, 24);
+	out_value(a, EEARL, 5);
+	sbi(a, EECR, 2);
+	sbi(a, EECR, 1);
+	label(a, L_EEPROM_WAIT);
+	sbic(a, EECR, 1);
+	rjmp(a, L_EEPROM_WAIT);
+	ret(a);
+
+	// Calls the wrapper in Z with arguments 0, 37, 74 and so on
+	label(a, L_RUN);
+	ldi(a, 20, 0);
+	ldi(a, 21, BENCH_CALLS);
+	label(a, L_RUN_LOOP);
+	sts(a, BENCH_ARG, 20);
+	cli(a);
+	out(a, GPIOR1, 30);
+	out(a, GPIOR2, 31);
+	mark(a, BENCH_BEGIN);
+	icall(a);
+	mark(a, BENCH_END);
+	subi(a, 20, -37);
+	dec(a, 21);
+	brne(a, L_RUN_LOOP);
+	ret(a);
+
+	label(a, L_MAIN);
+	load_z(a, L_NOTHING);
+	rcall(a, L_RUN);
+	load_z(a, L_BENCH_DIVIDE);
+	rcall(a, L_RUN);
+	load_z(a, L_BENCH_EEPROM);
+	rcall(a, L_RUN);
+	mark(a, BENCH_DONE);
+	label(a, L_END);
+	rjmp(a, L_END);
+}
+
+static void put16(uint8_t *p, uint16_t v) {
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+	put16(p, v);
+	put16(p + 2, v >> 16);
+}
+
+/* Each symbol ends where the next one up starts */
+static uint16_t symbol_size(const struct assembler *a, unsigned i) {
+	uint16_t start = a->labels[a->symbols[i].label], end = a->pc;
+	for (unsigned j = 0; a->symbols[j].name; j++) {
+		uint16_t other = a->labels[a->symbols[j].label];
+		if (other > start && other < end) {
+			end = other;
+		}
+	}
+	return end - start;
+}
+
+#define SECTIONS 5
+
+/*
+ * Writes flash as the one loaded segment, and the symbols, the way avr-gcc
+ * lays out an ELF file as far as avr_load_elf() cares
+ */
+static void write_elf(const struct assembler *a, FILE *file) {
+	static const char section_names[] = "\0.text\0.symtab\0.strtab\0.shstrtab";
+	static uint8_t data[8192];
+	const struct symbol *symbols = a->symbols;
+	unsigned count = 0;
+	while (symbols[count].name) {
+		count++;
+	}
+
+	uint32_t text = 52 + 32;
+	uint32_t symtab = text + a->pc;
+	uint32_t strtab = symtab + (count + 1) * 16;
+	uint32_t at = strtab + 1;
+	for (unsigned i = 0; i < count; i++) {
+		at += strlen(symbols[i].name) + 1;
+	}
+	uint32_t strtab_size = at - strtab;
+	uint32_t shstrtab = at;
+	uint32_t sections = (shstrtab + sizeof(section_names) + 3) & ~3u;
+	uint32_t size = sections + SECTIONS * 40;
+	if (size > sizeof(data)) {
+		fprintf(stderr, "testimage: image too large\n");
+		exit(1);
+	}
+	memset(data, 0, size);
+
+	// Header: 32 bit, little endian, executable for EM_AVR
+	memcpy(data, "\177ELF\1\1\1", 7);
+	put16(data + 16, 2);
+	put16(data + 18, 83);
+	put32(data + 20, 1);
+	put32(data + 28, 52);
+	put32(data + 32, sections);
+	put16(data + 40, 52);
+	put16(data + 42, 32);
+	put16(data + 44, 1);
+	put16(data + 46, 40);
+	put16(data + 48, SECTIONS);
+	put16(data + 50, SECTIONS - 1);
+
+	// Flash at address 0
+	uint8_t *segment = data + 52;
+	put32(segment, 1);
+	put32(segment + 4, text);
+	put32(segment + 16, a->pc);
+	put32(segment + 20, a->pc);
+	put32(segment + 24, 5);
+	put32(segment + 28, 2);
+	memcpy(data + text, a->flash, a->pc);
+
+	// Global functions and objects in .text
+	uint32_t name = 1;
+	for (unsigned i = 0; i < count; i++) {
+		uint8_t *symbol = data + symtab + (i + 1) * 16;
+		put32(symbol, name);
+		put32(symbol + 4, a->labels[symbols[i].label]);
+		put32(symbol + 8, symbol_size(a, i));
+		symbol[12] = symbols[i].object ? 0x11 : 0x12;
+		put16(symbol + 14, 1);
+		strcpy((char *)data + strtab + name, symbols[i].name);
+		name += strlen(symbols[i].name) + 1;
+	}
+	memcpy(data + shstrtab, section_names, sizeof(section_names));
+
+	// Name, type, flags, address, offset, size, link, info, alignment, entry size
+	const uint32_t table[SECTIONS][10] = {
+		{ 0 },
+		{ 1, 1, 6, 0, text, a->pc, 0, 0, 2, 0 },
+		{ 7, 2, 0, 0, symtab, (count + 1) * 16, 3, 1, 4, 16 },
+		{ 15, 3, 0, 0, strtab, strtab_size, 0, 0, 1, 0 },
+		{ 23, 3, 0, 0, shstrtab, sizeof(section_names), 0, 0, 1, 0 },
+	};
+	for (unsigned i = 0; i < SECTIONS; i++) {
+		for (unsigned j = 0; j < 10; j++) {
+			put32(data + sections + i * 40 + j * 4, table[i][j]);
+		}
+	}
+
+	if (fwrite(data, 1, size, file) != size) {
+		perror("testimage");
+		exit(1);
+	}
+}
+
+int main(int argc, char **argv) {
+	static struct assembler a;
+	bool bench = argc == 3 && strcmp(argv[1], "-b") == 0;
+
+	if (argc != 2 && !bench) {
+		fprintf(stderr, "Usage: testimage [-b] test.elf\n");
+		return 2;
+	}
+	const char *path = argv[argc - 1];
+
+	// The first pass places the labels, the second uses them
+	for (int pass = 0; pass < 2; pass++) {
+		if (bench) {
+			bench_program(&a);
+		} else {
+			dice_program(&a);
+		}
+	}
+
+	FILE *file = fopen(path, "wb");
+	if (!file) {
+		perror(path);
+		return 1;
+	}
+	write_elf(&a, file);
+	if (fclose(file) != 0) {
+		perror(path);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,35 @@
+/*
+ * Host stand-in for <util/atomic.h>
+ *
+ * Same shape as the avr-libc macros, with host_interrupts_enabled standing
+ * in for the I bit of SREG. Leaving the block by return restores it too.
+ */
+
+#ifndef HOST_UTIL_ATOMIC_H
+#define HOST_UTIL_ATOMIC_H
+
+#include <avr/interrupt.h>
+
+static inline uint8_t host_atomic_enter(void) {
+	cli();
+	return 1;
+}
+
+static inline void host_atomic_restore(const uint8_t *saved) {
+	host_interrupts_enabled = *saved;
+}
+
+static inline void host_atomic_force_on(const uint8_t *saved) {
+	(void)saved;
+	sei();
+}
+
+#define ATOMIC_RESTORESTATE \
+	uint8_t host_atomic_saved __attribute__((__cleanup__(host_atomic_restore))) = host_interrupts_enabled
+#define ATOMIC_FORCEON \
+	uint8_t host_atomic_saved __attribute__((__cleanup__(host_atomic_force_on))) = 0
+
+#define ATOMIC_BLOCK(type) \
+	for (type, host_atomic_once = host_atomic_enter(); host_atomic_once; host_atomic_once = 0)
+
+#endif
@@ -0,0 +1,15 @@
+/*
+ * Host stand-in for <util/delay.h>
+ *
+ * Busy waits advance the harness' virtual clock instead of burning time.
+ */
+
+#ifndef HOST_UTIL_DELAY_H
+#define HOST_UTIL_DELAY_H
+
+void host_delay_us(double us);
+
+#define _delay_us(us) host_delay_us(us)
+#define _delay_ms(ms) host_delay_us((ms) * 1000.0)
+
+#endif
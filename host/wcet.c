@@ -0,0 +1,1152 @@
+/*
+ * Worst-case execution time and stack depth of dice.elf
+ *
+ * Splits each function into basic blocks, finds the natural loops and
+ * takes the longest path through them with the ATtiny44's instruction
+ * timings. Taken branches and skips cost their extra cycles on their own
+ * edge. Loops run at most their bound: the countdown loops of _delay_us()
+ * are bounded by the values loaded before them, others by the
+ * configuration. Calls add the callee's worst case. Interrupt handlers
+ * also count the response (four cycles) and the rjmp in the vector table.
+ *
+ * The stack depth follows pushes, pops, return addresses and frames set
+ * through SPL. Interrupts nest only when a handler enables them again.
+ *
+ * Configuration, one setting per line:
+ *
+ *   max <function> <cycles>       Fail if the function can take longer
+ *   loop <function>[:n] <bound>   Header executions per entry of the loops
+ *                                 in a function, or of its n-th loop
+ *   calls <function> <target>...  Targets of its indirect calls
+ *   stack <bytes>                 Fail if the stack can grow deeper
+ *
+ * Functions are symbol names or vector names like TIM0_OVF_vect. Settings
+ * for functions that aren't in the image (compiled out or inlined) are
+ * skipped.
+ *
+ * Usage: wcet [-v] [-e] wcet.cfg dice.elf
+ *
+ *   -v             Print loop bounds, skipped settings and stack per handler
+ *   -e             The budgets are the known answers: fail unless each
+ *                  function and the stack come out at exactly their budget
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "avr_decode.h"
+
+#define SPL 0x3D
+#define SREG_I 7
+#define SREG_Z 1
+
+// Interrupt response and the rjmp in the vector table
+#define INTERRUPT_ENTRY (4 + 2)
+
+// The startup code calls main
+#define MAIN_RETURN_ADDRESS 2
+
+#define MAX_FUNCTIONS 256
+#define MAX_BOUNDS 16
+#define MAX_TARGETS 8
+#define UNBOUNDED ((uint64_t)-1)
+
+// Exit target of the paths that return from the function
+#define RETURN ((unsigned)-1)
+
+struct loop {
+	unsigned header;
+	uint8_t *body;          // One flag per block
+	unsigned size;
+	int parent;
+	uint64_t bound;
+	bool automatic;
+	int state;              // 0 new, 1 summarizing, 2 done
+	uint64_t iteration;     // Longest way around
+	unsigned exit_count;
+	unsigned *exit_target;
+	uint64_t *exit_cost;    // From entering the loop to leaving through the exit
+};
+
+struct block {
+	uint16_t start;
+	unsigned first;         // Instruction index
+	unsigned count;
+	unsigned successor_count;
+	unsigned successor[2];
+	uint8_t extra[2];       // Cycles for taking the edge
+	bool returns;
+	struct function *tail;  // Jumped to, returning for us
+	int loop;               // Innermost, -1 for none
+	bool reachable;
+	unsigned *predecessor;
+	unsigned predecessor_count;
+	int depth_in;           // Stack bytes on entry, -1 until known
+	int frame_in;           // Depth that Y points at, -1 if unknown
+};
+
+struct function {
+	char name[64];
+	uint16_t start;
+	uint16_t end;
+	bool vector;
+
+	struct avr_insn *insns;
+	unsigned insn_count;
+	struct block *blocks;
+	unsigned block_count;
+	struct loop *loops;
+	unsigned loop_count;
+	bool built;
+
+	int timing_state;
+	bool returns;
+	uint64_t wcet;
+
+	int stack_state;
+	unsigned stack;
+	bool enables_interrupts;
+
+	// Configuration
+	bool has_budget;
+	uint64_t budget;
+	uint64_t default_bound;
+	uint64_t bounds[MAX_BOUNDS + 1];
+	struct function *targets[MAX_TARGETS];
+	unsigned target_count;
+};
+
+static struct avr_image image;
+static struct function functions[MAX_FUNCTIONS];
+static unsigned function_count;
+static bool verbose;
+static bool exact;
+
+static void fail(const char *format, ...) {
+	va_list args;
+	va_start(args, format);
+	fprintf(stderr, "wcet: ");
+	vfprintf(stderr, format, args);
+	fprintf(stderr, "\n");
+	va_end(args);
+	exit(1);
+}
+
+static void *allocate(size_t count, size_t size) {
+	void *memory = calloc(count ? count : 1, size);
+	if (!memory) {
+		fail("out of memory");
+	}
+	return memory;
+}
+
+/*
+ * Returns the function starting at 'address', creating it on first use.
+ * A function ends where its symbol says, or at the next function.
+ */
+static struct function *function_at(uint16_t address) {
+	for (unsigned i = 0; i < function_count; i++) {
+		if (functions[i].start == address) {
+			return &functions[i];
+		}
+	}
+	if (function_count == MAX_FUNCTIONS) {
+		fail("too many functions");
+	}
+
+	struct function *f = &functions[function_count++];
+	memset(f, 0, sizeof(*f));
+	f->start = address;
+	f->end = image.flash_used;
+
+	const struct avr_symbol *symbol = avr_symbol_at(&image, address);
+	int vector = -1;
+	if (symbol && sscanf(symbol->name, "__vector_%d", &vector) == 1 && vector > 0 && vector < AVR_VECTORS) {
+		snprintf(f->name, sizeof(f->name), "%s_vect", avr_vector_names[vector]);
+		f->vector = true;
+	} else if (symbol) {
+		snprintf(f->name, sizeof(f->name), "%s", symbol->name);
+	} else {
+		snprintf(f->name, sizeof(f->name), "sub_%04x", address);
+	}
+
+	if (symbol && symbol->size) {
+		f->end = address + symbol->size;
+	} else {
+		for (unsigned i = 0; i < image.symbol_count; i++) {
+			if (image.symbols[i].function && image.symbols[i].address > address) {
+				f->end = image.symbols[i].address;
+				break;
+			}
+		}
+	}
+	return f;
+}
+
+/*
+ * Dominators and natural loops
+ */
+
+static bool dominates(const uint64_t *dom, unsigned words, unsigned a, unsigned b) {
+	return dom[b * words + a / 64] >> (a % 64) & 1;
+}
+
+static void find_loops(struct function *f) {
+	unsigned n = f->block_count;
+	unsigned words = (n + 63) / 64;
+	uint64_t *dom = allocate((size_t)n * words, sizeof(uint64_t));
+
+	for (unsigned b = 0; b < n; b++) {
+		for (unsigned w = 0; w < words; w++) {
+			dom[b * words + w] = b == 0 ? 0 : ~0ULL;
+		}
+	}
+	dom[0] = 1;
+
+	bool changed = true;
+	uint64_t *meet = allocate(words, sizeof(uint64_t));
+	while (changed) {
+		changed = false;
+		for (unsigned b = 1; b < n; b++) {
+			if (!f->blocks[b].reachable) {
+				continue;
+			}
+			for (unsigned w = 0; w < words; w++) {
+				meet[w] = ~0ULL;
+			}
+			for (unsigned p = 0; p < f->blocks[b].predecessor_count; p++) {
+				unsigned pred = f->blocks[b].predecessor[p];
+				if (f->blocks[pred].reachable) {
+					for (unsigned w = 0; w < words; w++) {
+						meet[w] &= dom[pred * words + w];
+					}
+				}
+			}
+			meet[b / 64] |= 1ULL << (b % 64);
+			if (memcmp(meet, &dom[b * words], words * sizeof(uint64_t)) != 0) {
+				memcpy(&dom[b * words], meet, words * sizeof(uint64_t));
+				changed = true;
+			}
+		}
+	}
+	free(meet);
+
+	// Every edge into a block on the depth first search path must be a
+	// back edge, or the flow graph is irreducible
+	unsigned *stack = allocate(n, sizeof(unsigned));
+	unsigned *next = allocate(n, sizeof(unsigned));
+	uint8_t *state = allocate(n, 1);
+	unsigned top = 0;
+	stack[top++] = 0;
+	state[0] = 1;
+	while (top) {
+		unsigned b = stack[top - 1];
+		if (next[b] == f->blocks[b].successor_count) {
+			state[b] = 2;
+			top--;
+			continue;
+		}
+		unsigned s = f->blocks[b].successor[next[b]++];
+		if (state[s] == 1 && !dominates(dom, words, s, b)) {
+			fail("%s: irreducible loop at 0x%04x", f->name, f->blocks[s].start);
+		}
+		if (state[s] == 0) {
+			state[s] = 1;
+			stack[top++] = s;
+		}
+	}
+	free(next);
+	free(state);
+
+	// One loop per header, with the bodies of all its back edges
+	f->loops = allocate(n, sizeof(struct loop));
+	for (unsigned h = 0; h < n; h++) {
+		struct loop *loop = NULL;
+		for (unsigned p = 0; p < f->blocks[h].predecessor_count; p++) {
+			unsigned latch = f->blocks[h].predecessor[p];
+			if (!f->blocks[latch].reachable || !dominates(dom, words, h, latch)) {
+				continue;
+			}
+			if (!loop) {
+				loop = &f->loops[f->loop_count++];
+				loop->header = h;
+				loop->body = allocate(n, 1);
+				loop->body[h] = 1;
+				loop->size = 1;
+				loop->parent = -1;
+			}
+
+			top = 0;
+			if (!loop->body[latch]) {
+				loop->body[latch] = 1;
+				loop->size++;
+				stack[top++] = latch;
+			}
+			while (top) {
+				unsigned b = stack[--top];
+				for (unsigned q = 0; q < f->blocks[b].predecessor_count; q++) {
+					unsigned pred = f->blocks[b].predecessor[q];
+					if (f->blocks[pred].reachable && !loop->body[pred]) {
+						loop->body[pred] = 1;
+						loop->size++;
+						stack[top++] = pred;
+					}
+				}
+			}
+		}
+	}
+	free(stack);
+	free(dom);
+
+	// Nesting: the smallest other loop containing the header
+	for (unsigned i = 0; i < f->loop_count; i++) {
+		struct loop *loop = &f->loops[i];
+		for (unsigned j = 0; j < f->loop_count; j++) {
+			struct loop *outer = &f->loops[j];
+			if (i != j && outer->body[loop->header] && outer->size > loop->size &&
+					(loop->parent < 0 || outer->size < f->loops[loop->parent].size)) {
+				loop->parent = j;
+			}
+		}
+	}
+	for (unsigned b = 0; b < n; b++) {
+		f->blocks[b].loop = -1;
+		for (unsigned i = 0; i < f->loop_count; i++) {
+			if (f->loops[i].body[b] && (f->blocks[b].loop < 0 || f->loops[i].size < f->loops[f->blocks[b].loop].size)) {
+				f->blocks[b].loop = i;
+			}
+		}
+	}
+}
+
+/*
+ * Splits the function into basic blocks
+ */
+static void build(struct function *f) {
+	if (f->built) {
+		return;
+	}
+	f->built = true;
+
+	unsigned capacity = (f->end - f->start) / 2 + 1;
+	f->insns = allocate(capacity, sizeof(struct avr_insn));
+	int index[AVR_FLASH_SIZE / 2];
+	bool leader[AVR_FLASH_SIZE / 2];
+	memset(index, -1, sizeof(index));
+	memset(leader, 0, sizeof(leader));
+
+	for (uint16_t address = f->start; address < f->end; ) {
+		struct avr_insn *insn = &f->insns[f->insn_count];
+		if (!avr_decode(image.flash, address, insn)) {
+			fail("%s: unknown instruction %04x at 0x%04x", f->name,
+				image.flash[address] | image.flash[address + 1] << 8, address);
+		}
+		index[address / 2] = f->insn_count++;
+		address += insn->words * 2;
+	}
+
+	// Leaders
+	leader[f->start / 2] = true;
+	for (unsigned i = 0; i < f->insn_count; i++) {
+		struct avr_insn *insn = &f->insns[i];
+		uint16_t next = insn->address + insn->words * 2;
+		bool inside = insn->target >= f->start && insn->target < f->end;
+
+		switch (insn->flow) {
+		case FLOW_BRANCH:
+			if (!inside || index[insn->target / 2] < 0) {
+				fail("%s: branch out of the function at 0x%04x", f->name, insn->address);
+			}
+			leader[insn->target / 2] = true;
+			if (next < f->end) leader[next / 2] = true;
+			break;
+		case FLOW_SKIP:
+			if (i + 2 < f->insn_count) leader[f->insns[i + 2].address / 2] = true;
+			if (next < f->end) leader[next / 2] = true;
+			break;
+		case FLOW_JUMP:
+			if (insn->target == next) {
+				// rjmp .+0, a two cycle nop
+				break;
+			}
+			if (inside) {
+				if (index[insn->target / 2] < 0) {
+					fail("%s: jump into an instruction at 0x%04x", f->name, insn->address);
+				}
+				leader[insn->target / 2] = true;
+			}
+			if (next < f->end) leader[next / 2] = true;
+			break;
+		case FLOW_INDIRECT_JUMP:
+			fail("%s: indirect jump at 0x%04x", f->name, insn->address);
+			break;
+		case FLOW_RETURN:
+			if (next < f->end) leader[next / 2] = true;
+			break;
+		}
+	}
+
+	f->blocks = allocate(f->insn_count, sizeof(struct block));
+	int block_of[AVR_FLASH_SIZE / 2];
+	memset(block_of, -1, sizeof(block_of));
+	for (unsigned i = 0; i < f->insn_count; i++) {
+		if (leader[f->insns[i].address / 2]) {
+			struct block *b = &f->blocks[f->block_count];
+			b->start = f->insns[i].address;
+			b->first = i;
+			block_of[b->start / 2] = f->block_count++;
+		}
+		f->blocks[f->block_count - 1].count++;
+	}
+
+	// Edges
+	for (unsigned n = 0; n < f->block_count; n++) {
+		struct block *b = &f->blocks[n];
+		struct avr_insn *last = &f->insns[b->first + b->count - 1];
+		uint16_t next = last->address + last->words * 2;
+		bool falls = next < f->end;
+
+		switch (last->flow) {
+		case FLOW_BRANCH:
+			b->successor[b->successor_count] = block_of[last->target / 2];
+			b->extra[b->successor_count++] = 1;
+			break;
+		case FLOW_SKIP: {
+			unsigned skipped = b->first + b->count;
+			if (skipped + 1 >= f->insn_count) {
+				fail("%s: skip past the end at 0x%04x", f->name, last->address);
+			}
+			b->successor[b->successor_count] = block_of[f->insns[skipped + 1].address / 2];
+			b->extra[b->successor_count++] = f->insns[skipped].words;
+			break;
+		}
+		case FLOW_JUMP:
+			if (last->target == next) {
+				break;
+			}
+			falls = false;
+			if (last->target >= f->start && last->target < f->end) {
+				b->successor[b->successor_count++] = block_of[last->target / 2];
+			} else {
+				b->returns = true;
+				b->tail = function_at(last->target);
+			}
+			break;
+		case FLOW_RETURN:
+			falls = false;
+			b->returns = true;
+			break;
+		}
+
+		if (falls) {
+			b->successor[b->successor_count++] = block_of[next / 2];
+		} else if (!b->returns && b->successor_count == 0 && last->flow != FLOW_JUMP) {
+			fail("%s: runs off the end at 0x%04x", f->name, last->address);
+		}
+	}
+
+	// Predecessors and reachability
+	for (unsigned n = 0; n < f->block_count; n++) {
+		f->blocks[n].predecessor = allocate(f->block_count, sizeof(unsigned));
+	}
+	for (unsigned n = 0; n < f->block_count; n++) {
+		for (unsigned s = 0; s < f->blocks[n].successor_count; s++) {
+			struct block *to = &f->blocks[f->blocks[n].successor[s]];
+			to->predecessor[to->predecessor_count++] = n;
+		}
+	}
+
+	unsigned *work = allocate(f->block_count, sizeof(unsigned));
+	unsigned count = 0;
+	work[count++] = 0;
+	f->blocks[0].reachable = true;
+	while (count) {
+		struct block *b = &f->blocks[work[--count]];
+		for (unsigned s = 0; s < b->successor_count; s++) {
+			if (!f->blocks[b->successor[s]].reachable) {
+				f->blocks[b->successor[s]].reachable = true;
+				work[count++] = b->successor[s];
+			}
+		}
+	}
+	free(work);
+
+	find_loops(f);
+}
+
+/*
+ * Callees of a call instruction: one, or the configured targets of an
+ * indirect call. Returns their number.
+ */
+static unsigned callees(struct function *f, const struct avr_insn *insn, struct function **out) {
+	if (insn->flow == FLOW_INDIRECT_CALL) {
+		if (!f->target_count) {
+			fail("%s: indirect call at 0x%04x needs \"calls %s <target>...\"", f->name, insn->address, f->name);
+		}
+		memcpy(out, f->targets, f->target_count * sizeof(*out));
+		return f->target_count;
+	}
+	out[0] = function_at(insn->target);
+	return 1;
+}
+
+static bool is_call(const struct avr_insn *insn) {
+	// rcall .+0 only makes room on the stack
+	return insn->flow == FLOW_INDIRECT_CALL ||
+		(insn->flow == FLOW_CALL && insn->target != insn->address + insn->words * 2);
+}
+
+/*
+ * Stack depth
+ */
+
+static unsigned stack_depth(struct function *f);
+
+static unsigned call_depth(struct function *f, const struct avr_insn *insn) {
+	struct function *targets[MAX_TARGETS];
+	unsigned count = callees(f, insn, targets);
+	unsigned deepest = 0;
+	for (unsigned i = 0; i < count; i++) {
+		unsigned depth = 2 + stack_depth(targets[i]);
+		if (depth > deepest) {
+			deepest = depth;
+		}
+		f->enables_interrupts |= targets[i]->enables_interrupts;
+	}
+	return deepest;
+}
+
+static unsigned stack_depth(struct function *f) {
+	if (f->stack_state == 2) {
+		return f->stack;
+	}
+	if (f->stack_state == 1) {
+		fail("%s: recursion, the stack depth has no bound", f->name);
+	}
+	f->stack_state = 1;
+	build(f);
+
+	for (unsigned n = 0; n < f->block_count; n++) {
+		f->blocks[n].depth_in = -1;
+		f->blocks[n].frame_in = -1;
+	}
+	f->blocks[0].depth_in = 0;
+
+	unsigned *work = allocate(f->block_count * 4 + 1, sizeof(unsigned));
+	unsigned count = 0;
+	unsigned deepest = 0;
+	work[count++] = 0;
+
+	while (count) {
+		struct block *b = &f->blocks[work[--count]];
+		int depth = b->depth_in;
+		int frame = b->frame_in;
+
+		for (unsigned i = b->first; i < b->first + b->count; i++) {
+			struct avr_insn *insn = &f->insns[i];
+			switch (insn->op) {
+			case OP_PUSH: depth++; break;
+			case OP_POP: depth--; break;
+			case OP_IN:
+				if (insn->d == SPL && insn->r == 28) frame = depth;
+				break;
+			case OP_SBIW:
+				if (insn->d == 28 && frame >= 0) frame += insn->k;
+				break;
+			case OP_ADIW:
+				if (insn->d == 28 && frame >= 0) frame -= insn->k;
+				break;
+			case OP_SUBI:
+				if (insn->d == 28 && frame >= 0) frame += (int8_t)insn->k;
+				break;
+			case OP_OUT:
+				if (insn->d == SPL) {
+					if (insn->r != 28 || frame < 0) {
+						fail("%s: can't follow the stack pointer at 0x%04x", f->name, insn->address);
+					}
+					depth = frame;
+				}
+				break;
+			case OP_BSET:
+				if (insn->d == SREG_I) f->enables_interrupts = true;
+				break;
+			default:
+				break;
+			}
+
+			if (insn->flow == FLOW_CALL && !is_call(insn)) {
+				depth += 2;
+			} else if (is_call(insn)) {
+				unsigned call = depth + call_depth(f, insn);
+				if (call > deepest) deepest = call;
+			}
+			if (depth < 0) {
+				fail("%s: pops more than it pushed at 0x%04x", f->name, insn->address);
+			}
+			if ((unsigned)depth > deepest) {
+				deepest = depth;
+			}
+		}
+
+		if (b->tail) {
+			unsigned tail = depth + stack_depth(b->tail);
+			if (tail > deepest) deepest = tail;
+			f->enables_interrupts |= b->tail->enables_interrupts;
+		}
+
+		for (unsigned s = 0; s < b->successor_count; s++) {
+			struct block *to = &f->blocks[b->successor[s]];
+			if (to->depth_in < 0) {
+				to->depth_in = depth;
+				to->frame_in = frame;
+				work[count++] = b->successor[s];
+			} else if (to->depth_in != depth) {
+				fail("%s: stack depth %d or %d at 0x%04x", f->name, to->depth_in, depth, to->start);
+			}
+		}
+	}
+	free(work);
+
+	f->stack = deepest;
+	f->stack_state = 2;
+	return deepest;
+}
+
+/*
+ * Execution time
+ */
+
+static uint64_t worst_case(struct function *f);
+
+static uint64_t add(uint64_t a, uint64_t b) {
+	return a == UNBOUNDED || b == UNBOUNDED || a + b < a ? UNBOUNDED : a + b;
+}
+
+static uint64_t block_cost(struct function *f, struct block *b) {
+	uint64_t cost = 0;
+	for (unsigned i = b->first; i < b->first + b->count; i++) {
+		struct avr_insn *insn = &f->insns[i];
+		cost += insn->cycles;
+		if (is_call(insn)) {
+			struct function *targets[MAX_TARGETS];
+			unsigned count = callees(f, insn, targets);
+			uint64_t longest = 0;
+			for (unsigned t = 0; t < count; t++) {
+				uint64_t callee = worst_case(targets[t]);
+				if (callee > longest) longest = callee;
+			}
+			cost = add(cost, longest);
+		}
+	}
+	if (b->tail) {
+		cost = add(cost, worst_case(b->tail));
+	}
+	return cost;
+}
+
+/*
+ * Recognizes the countdown loops of _delay_us() and _delay_ms():
+ * "dec", "sbiw ...,1" or "subi ...,1" with "sbci ...,0" followed by a brne
+ * back to itself, with the count loaded by ldi right before the loop.
+ */
+static uint64_t countdown_bound(struct function *f, struct loop *loop) {
+	struct block *b = &f->blocks[loop->header];
+	struct avr_insn *first = &f->insns[b->first];
+	struct avr_insn *last = &f->insns[b->first + b->count - 1];
+	uint8_t registers[4];
+	unsigned width = 0;
+
+	if (loop->size != 1 || last->op != OP_BRBC || last->d != SREG_Z || last->target != b->start) {
+		return 0;
+	}
+
+	if (b->count == 2 && first->op == OP_DEC) {
+		registers[width++] = first->d;
+	} else if (b->count == 2 && first->op == OP_SBIW && first->k == 1) {
+		registers[width++] = first->d;
+		registers[width++] = first->d + 1;
+	} else if (b->count >= 2 && b->count <= 4 && first->op == OP_SUBI && first->k == 1) {
+		registers[width++] = first->d;
+		for (unsigned i = 1; i < b->count - 1; i++) {
+			struct avr_insn *insn = &f->insns[b->first + i];
+			if (insn->op != OP_SBCI || insn->k != 0) {
+				return 0;
+			}
+			registers[width++] = insn->d;
+		}
+	} else {
+		return 0;
+	}
+
+	// The only way in
+	struct block *entry = NULL;
+	for (unsigned p = 0; p < b->predecessor_count; p++) {
+		struct block *pred = &f->blocks[b->predecessor[p]];
+		if (pred == b) {
+			continue;
+		}
+		if (entry) {
+			return 0;
+		}
+		entry = pred;
+	}
+	if (!entry) {
+		return 0;
+	}
+
+	uint64_t count = 0;
+	for (unsigned r = 0; r < width; r++) {
+		bool found = false;
+		for (unsigned i = entry->first + entry->count; i-- > entry->first && !found; ) {
+			struct avr_insn *insn = &f->insns[i];
+			if (insn->op == OP_LDI && insn->d == registers[r]) {
+				count |= (uint64_t)insn->k << (8 * r);
+				found = true;
+			} else if (insn->d == registers[r] || (insn->op == OP_MOVW && insn->d + 1 == registers[r]) ||
+					insn->flow != FLOW_NEXT) {
+				return 0;
+			}
+		}
+		if (!found) {
+			return 0;
+		}
+	}
+
+	return count ? count : 1ULL << (8 * width);
+}
+
+static uint64_t loop_bound(struct function *f, unsigned index) {
+	struct loop *loop = &f->loops[index];
+	if (loop->bound) {
+		return loop->bound;
+	}
+
+	// Configured bounds count the loops by header address from 1
+	unsigned position = 1;
+	for (unsigned i = 0; i < f->loop_count; i++) {
+		if (f->blocks[f->loops[i].header].start < f->blocks[loop->header].start) {
+			position++;
+		}
+	}
+
+	loop->bound = countdown_bound(f, loop);
+	loop->automatic = loop->bound != 0;
+	if (position <= MAX_BOUNDS && f->bounds[position]) {
+		loop->bound = f->bounds[position];
+		loop->automatic = false;
+	} else if (!loop->bound) {
+		loop->bound = f->default_bound;
+	}
+	if (!loop->bound) {
+		fail("%s: no bound for loop %u at 0x%04x, add \"loop %s:%u <bound>\" to the configuration",
+			f->name, position, f->blocks[loop->header].start, f->name, position);
+	}
+
+	if (verbose) {
+		printf("%s: loop %u at 0x%04x, %llu times%s\n", f->name, position, f->blocks[loop->header].start,
+			(unsigned long long)loop->bound, loop->automatic ? " (countdown)" : "");
+	}
+	return loop->bound;
+}
+
+static void summarize(struct function *f, int region);
+
+/*
+ * The part of 'region' a block belongs to: the block itself, the child
+ * loop containing it, or -1 outside the region. Loops are numbered after
+ * the blocks.
+ */
+static int entity_of(struct function *f, int region, unsigned block) {
+	if (region >= 0 && !f->loops[region].body[block]) {
+		return -1;
+	}
+
+	int loop = f->blocks[block].loop;
+	if (loop == region) {
+		return block;
+	}
+	while (f->loops[loop].parent != region) {
+		loop = f->loops[loop].parent;
+	}
+	if (f->loops[loop].header != block) {
+		fail("%s: jump into the middle of a loop at 0x%04x", f->name, f->blocks[block].start);
+	}
+	return f->block_count + loop;
+}
+
+struct pass {
+	int *order;
+	unsigned order_count;
+	uint64_t *arrive;
+	uint8_t *state;
+	uint64_t back;
+	bool returns;
+	uint64_t longest;
+	unsigned exit_count;
+	unsigned *exit_target;
+	uint64_t *exit_cost;
+};
+
+/* The blocks an entity leaves to. Returns their number. */
+static unsigned next_blocks(struct function *f, int entity, unsigned *blocks) {
+	unsigned count = 0;
+	if ((unsigned)entity < f->block_count) {
+		struct block *b = &f->blocks[entity];
+		for (unsigned s = 0; s < b->successor_count; s++) {
+			blocks[count++] = b->successor[s];
+		}
+	} else {
+		struct loop *loop = &f->loops[entity - f->block_count];
+		for (unsigned e = 0; e < loop->exit_count; e++) {
+			blocks[count++] = loop->exit_target[e];
+		}
+	}
+	return count;
+}
+
+static void topological(struct function *f, int region, int entity, struct pass *pass) {
+	pass->state[entity] = 1;
+
+	unsigned *blocks = allocate(f->block_count + 1, sizeof(unsigned));
+	unsigned count = next_blocks(f, entity, blocks);
+	for (unsigned i = 0; i < count; i++) {
+		if (blocks[i] == RETURN || (region >= 0 && blocks[i] == f->loops[region].header)) {
+			continue;
+		}
+		int next = entity_of(f, region, blocks[i]);
+		if (next < 0) {
+			continue;
+		}
+		if ((unsigned)next >= f->block_count) {
+			summarize(f, next - f->block_count);
+		}
+		if (pass->state[next] == 1) {
+			fail("%s: irreducible loop at 0x%04x", f->name, f->blocks[blocks[i]].start);
+		}
+		if (pass->state[next] == 0) {
+			topological(f, region, next, pass);
+		}
+	}
+	free(blocks);
+
+	pass->state[entity] = 2;
+	pass->order[pass->order_count++] = entity;
+}
+
+static void add_exit(struct pass *pass, unsigned target, uint64_t cost) {
+	for (unsigned e = 0; e < pass->exit_count; e++) {
+		if (pass->exit_target[e] == target) {
+			if (cost > pass->exit_cost[e]) pass->exit_cost[e] = cost;
+			return;
+		}
+	}
+	pass->exit_target[pass->exit_count] = target;
+	pass->exit_cost[pass->exit_count++] = cost;
+}
+
+static void leave(struct function *f, int region, struct pass *pass, unsigned target, uint64_t cost) {
+	if (target == RETURN && region < 0) {
+		pass->returns = true;
+		if (cost > pass->longest) pass->longest = cost;
+		return;
+	}
+	if (target == RETURN) {
+		add_exit(pass, target, cost);
+		return;
+	}
+	if (region >= 0 && target == f->loops[region].header) {
+		if (cost > pass->back) pass->back = cost;
+		return;
+	}
+	int next = entity_of(f, region, target);
+	if (next < 0) {
+		add_exit(pass, target, cost);
+	} else if (cost > pass->arrive[next] || pass->arrive[next] == UNBOUNDED) {
+		pass->arrive[next] = cost;
+	}
+}
+
+/*
+ * Longest paths through a loop (or the whole function for region -1) with
+ * its child loops summarized
+ */
+static void summarize(struct function *f, int region) {
+	if (region >= 0 && f->loops[region].state == 2) {
+		return;
+	}
+
+	unsigned entities = f->block_count + f->loop_count;
+	struct pass pass = { 0 };
+	pass.order = allocate(entities, sizeof(int));
+	pass.arrive = allocate(entities, sizeof(uint64_t));
+	pass.state = allocate(entities, 1);
+	pass.exit_target = allocate(f->block_count + 1, sizeof(unsigned));
+	pass.exit_cost = allocate(f->block_count + 1, sizeof(uint64_t));
+	unsigned *blocks = allocate(f->block_count + 1, sizeof(unsigned));
+
+	// Costs start where the region is entered; UNBOUNDED marks unreached
+	for (unsigned e = 0; e < entities; e++) {
+		pass.arrive[e] = UNBOUNDED;
+	}
+	int entry = region >= 0 ? (int)f->loops[region].header : entity_of(f, region, 0);
+	if ((unsigned)entry >= f->block_count) {
+		summarize(f, entry - f->block_count);
+	}
+	pass.arrive[entry] = 0;
+	topological(f, region, entry, &pass);
+
+	for (unsigned i = pass.order_count; i-- > 0; ) {
+		int entity = pass.order[i];
+		uint64_t arrive = pass.arrive[entity];
+		if (arrive == UNBOUNDED) {
+			continue;
+		}
+
+		if ((unsigned)entity < f->block_count) {
+			struct block *b = &f->blocks[entity];
+			uint64_t done = add(arrive, block_cost(f, b));
+			if (done == UNBOUNDED) {
+				fail("%s: no bound through 0x%04x", f->name, b->start);
+			}
+			if (b->returns) {
+				leave(f, region, &pass, RETURN, done);
+			}
+			for (unsigned s = 0; s < b->successor_count; s++) {
+				leave(f, region, &pass, b->successor[s], done + b->extra[s]);
+			}
+		} else {
+			struct loop *loop = &f->loops[entity - f->block_count];
+			unsigned count = next_blocks(f, entity, blocks);
+			for (unsigned e = 0; e < count; e++) {
+				leave(f, region, &pass, blocks[e], add(arrive, loop->exit_cost[e]));
+			}
+		}
+	}
+	free(blocks);
+
+	if (region < 0) {
+		f->returns = pass.returns;
+		f->wcet = pass.longest;
+	} else {
+		struct loop *loop = &f->loops[region];
+		uint64_t bound = loop_bound(f, region);
+		loop->iteration = pass.back;
+		loop->exit_count = pass.exit_count;
+		loop->exit_target = pass.exit_target;
+		loop->exit_cost = pass.exit_cost;
+		for (unsigned e = 0; e < pass.exit_count; e++) {
+			uint64_t repeat = pass.back * (bound - 1);
+			if (bound > 1 && repeat / (bound - 1) != pass.back) {
+				fail("%s: loop at 0x%04x takes too long", f->name, f->blocks[loop->header].start);
+			}
+			loop->exit_cost[e] = add(loop->exit_cost[e], repeat);
+		}
+		loop->state = 2;
+	}
+
+	free(pass.order);
+	free(pass.arrive);
+	free(pass.state);
+}
+
+static uint64_t worst_case(struct function *f) {
+	if (f->timing_state == 2) {
+		return f->wcet;
+	}
+	if (f->timing_state == 1) {
+		fail("%s: recursion, the execution time has no bound", f->name);
+	}
+	f->timing_state = 1;
+	build(f);
+	summarize(f, -1);
+	if (!f->returns) {
+		f->wcet = UNBOUNDED;
+	}
+	f->timing_state = 2;
+	return f->wcet;
+}
+
+/*
+ * Configuration
+ */
+
+static struct function *configured(const char *name, const char *path, unsigned line) {
+	const struct avr_symbol *symbol = avr_find_symbol(&image, name);
+	if (!symbol) {
+		if (verbose) {
+			printf("%s:%u: %s isn't in the image, skipped\n", path, line, name);
+		}
+		return NULL;
+	}
+	return function_at(symbol->address);
+}
+
+static void configure(const char *path, unsigned *stack_budget) {
+	FILE *file = fopen(path, "r");
+	if (!file) {
+		fail("%s: can't open", path);
+	}
+
+	char text[256];
+	unsigned line = 0;
+	while (fgets(text, sizeof(text), file)) {
+		line++;
+		char *hash = strchr(text, '#');
+		if (hash) {
+			*hash = 0;
+		}
+
+		char *keyword = strtok(text, " \t\r\n");
+		if (!keyword) {
+			continue;
+		}
+		char *name = strtok(NULL, " \t\r\n");
+		char *value = strtok(NULL, " \t\r\n");
+
+		if (strcmp(keyword, "stack") == 0 && name) {
+			*stack_budget = strtoul(name, NULL, 0);
+		} else if (strcmp(keyword, "max") == 0 && name && value) {
+			struct function *f = configured(name, path, line);
+			if (f) {
+				f->has_budget = true;
+				f->budget = strtoull(value, NULL, 0);
+			}
+		} else if (strcmp(keyword, "loop") == 0 && name && value) {
+			unsigned position = 0;
+			char *colon = strchr(name, ':');
+			if (colon) {
+				*colon = 0;
+				position = strtoul(colon + 1, NULL, 0);
+				if (position < 1 || position > MAX_BOUNDS) {
+					fail("%s:%u: loops are numbered from 1 to %u", path, line, MAX_BOUNDS);
+				}
+			}
+			struct function *f = configured(name, path, line);
+			if (f && position) {
+				f->bounds[position] = strtoull(value, NULL, 0);
+			} else if (f) {
+				f->default_bound = strtoull(value, NULL, 0);
+			}
+		} else if (strcmp(keyword, "calls") == 0 && name && value) {
+			struct function *f = configured(name, path, line);
+			for (; f && value; value = strtok(NULL, " \t\r\n")) {
+				const struct avr_symbol *symbol = avr_find_symbol(&image, value);
+				if (!symbol) {
+					fail("%s:%u: no function %s", path, line, value);
+				}
+				if (f->target_count == MAX_TARGETS) {
+					fail("%s:%u: too many targets", path, line);
+				}
+				f->targets[f->target_count++] = function_at(symbol->address);
+			}
+		} else {
+			fail("%s:%u: syntax error", path, line);
+		}
+	}
+	fclose(file);
+}
+
+int main(int argc, char **argv) {
+	int arg = 1;
+	for (; arg < argc && argv[arg][0] == '-'; arg++) {
+		if (strcmp(argv[arg], "-v") == 0) {
+			verbose = true;
+		} else if (strcmp(argv[arg], "-e") == 0) {
+			exact = true;
+		} else {
+			break;
+		}
+	}
+	if (argc - arg != 2) {
+		fprintf(stderr, "usage: wcet [-v] [-e] wcet.cfg dice.elf\n");
+		return 2;
+	}
+
+	char error[256];
+	if (!avr_load_elf(argv[arg + 1], &image, error, sizeof(error))) {
+		fail("%s", error);
+	}
+
+	unsigned stack_budget = 0;
+	configure(argv[arg], &stack_budget);
+
+	bool ok = true;
+
+	// Execution time of the budgeted functions
+	printf("%-24s %10s %10s\n", "function", "cycles", "budget");
+	for (unsigned i = 0; i < function_count; i++) {
+		struct function *f = &functions[i];
+		if (!f->has_budget) {
+			continue;
+		}
+		uint64_t cycles = worst_case(f);
+		if (cycles == UNBOUNDED) {
+			printf("%-24s %10s %10llu  never returns\n", f->name, "-", (unsigned long long)f->budget);
+			ok = false;
+			continue;
+		}
+		if (f->vector) {
+			cycles += INTERRUPT_ENTRY;
+		}
+		bool over = cycles > f->budget;
+		bool off = exact && cycles != f->budget;
+		printf("%-24s %10llu %10llu%s\n", f->name, (unsigned long long)cycles,
+			(unsigned long long)f->budget, over ? "  OVER BUDGET" : off ? "  NOT AS EXPECTED" : "");
+		ok &= !over && !off;
+	}
+
+	// Stack: main, plus the deepest interrupt, plus every handler that
+	// enables interrupts again
+	const struct avr_symbol *main_symbol = avr_find_symbol(&image, "main");
+	if (!main_symbol) {
+		fail("no main in %s", argv[arg + 1]);
+	}
+	unsigned main_depth = MAIN_RETURN_ADDRESS + stack_depth(function_at(main_symbol->address));
+	unsigned deepest = 0;
+	unsigned nesting = 0;
+	const char *deepest_name = "none";
+
+	for (int vector = 1; vector < AVR_VECTORS; vector++) {
+		char name[24];
+		snprintf(name, sizeof(name), "__vector_%d", vector);
+		const struct avr_symbol *symbol = avr_find_symbol(&image, name);
+		if (!symbol) {
+			continue;
+		}
+		struct function *f = function_at(symbol->address);
+		unsigned depth = 2 + stack_depth(f);
+		if (verbose) {
+			printf("%s: %u bytes of stack%s\n", f->name, depth, f->enables_interrupts ? ", nests" : "");
+		}
+		if (f->enables_interrupts) {
+			nesting += depth;
+		} else if (depth > deepest) {
+			deepest = depth;
+			deepest_name = f->name;
+		}
+	}
+
+	unsigned total = main_depth + deepest + nesting;
+	unsigned ram = AVR_RAM_END - AVR_RAM_START + 1 - image.data_size - image.bss_size;
+	printf("\nstack: main %u + %s %u", main_depth, deepest_name, deepest);
+	if (nesting) {
+		printf(" + nesting handlers %u", nesting);
+	}
+	printf(" = %u bytes, %u bytes of RAM left after data\n", total, ram);
+
+	if (total > ram) {
+		printf("stack overflows into data\n");
+		ok = false;
+	}
+	if (stack_budget && total > stack_budget) {
+		printf("stack over budget of %u bytes\n", stack_budget);
+		ok = false;
+	} else if (exact && total != stack_budget) {
+		printf("stack not the expected %u bytes\n", stack_budget);
+		ok = false;
+	}
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,299 @@
+/*
+ * Synthetic button workload, see workload.h
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "workload.h"
+
+/*
+ * Assumed defaults, not fitted to logged presses: a handful of rolls per
+ * session, a few seconds spent looking at each result and sometimes long
+ * enough for the dice to fall asleep. Real hold times and gaps can be
+ * resampled instead, see workload_gen -H and -G.
+ */
+void workload_defaults(struct workload_model *model) {
+	memset(model, 0, sizeof(*model));
+	model->rolls_per_session = 8;
+	model->session_gap_median = 3600;
+	model->session_gap_sigma = 1.5;
+	model->roll_gap_median = 3;
+	model->roll_gap_sigma = 0.8;
+	model->hold_median = 300;
+	model->hold_sigma = 0.7;
+	model->tap_probability = 0.03;
+	model->tap_min = 5;
+	model->tap_max = 40;
+	model->repress_probability = 0.05;
+	model->repress_min = 100;
+	model->repress_max = 1500;
+	model->bounce_max = 1;
+	model->bounce_max_pairs = 3;
+}
+
+static double *resize(double *samples, unsigned count) {
+	samples = realloc(samples, count * sizeof(double));
+	if (!samples) {
+		fprintf(stderr, "workload: out of memory for %u samples\n", count);
+		exit(2);
+	}
+	return samples;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * Reads one positive sample per line. Lines starting with # are skipped.
+ */
+bool workload_load_samples(struct empirical *empirical, const char *path) {
+	FILE *file = fopen(path, "r");
+	if (!file) {
+		return false;
+	}
+
+	unsigned capacity = 1024;
+	empirical->samples = resize(NULL, capacity);
+	empirical->count = 0;
+
+	char line[128];
+	while (fgets(line, sizeof(line), file)) {
+		double sample;
+		if (line[0] == '#' || sscanf(line, "%lf", &sample) != 1 || !(sample > 0)) {
+			continue;
+		}
+		if (empirical->count == capacity) {
+			capacity *= 2;
+			empirical->samples = resize(empirical->samples, capacity);
+		}
+		empirical->samples[empirical->count++] = sample;
+	}
+	fclose(file);
+
+	qsort(empirical->samples, empirical->count, sizeof(double), compare_doubles);
+	return empirical->count > 0;
+}
+
+/*
+ * Fits a lognormal distribution to the samples
+ */
+void workload_fit(const struct empirical *empirical, double *median, double *sigma) {
+	double sum = 0;
+	double squares = 0;
+	for (unsigned i = 0; i < empirical->count; i++) {
+		double x = log(empirical->samples[i]);
+		sum += x;
+		squares += x * x;
+	}
+
+	double mean = sum / empirical->count;
+	*median = exp(mean);
+	*sigma = sqrt(fmax(squares / empirical->count - mean * mean, 0));
+}
+
+/* xoshiro256** */
+static uint64_t rotl(uint64_t x, int k) {
+	return x << k | x >> (64 - k);
+}
+
+static uint64_t next_random(struct workload *workload) {
+	uint64_t *s = workload->rng;
+	uint64_t result = rotl(s[1] * 5, 7) * 9;
+	uint64_t t = s[1] << 17;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3], 45);
+	return result;
+}
+
+/*
+ * Returns a number in (0, 1]
+ */
+double workload_uniform(struct workload *workload) {
+	return ((next_random(workload) >> 11) + 1) * 0x1.0p-53;
+}
+
+static double uniform_between(struct workload *workload, double min, double max) {
+	return min + (max - min) * workload_uniform(workload);
+}
+
+static double lognormal(struct workload *workload, double median, double sigma) {
+	double u = workload_uniform(workload);
+	double v = workload_uniform(workload);
+	double normal = sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+	return median * exp(sigma * normal);
+}
+
+static double resample(struct workload *workload, const struct empirical *empirical) {
+	double position = (workload_uniform(workload) - 0x1.0p-53) * (empirical->count - 1);
+	unsigned i = (unsigned)position;
+	if (i + 1 >= empirical->count) {
+		return empirical->samples[empirical->count - 1];
+	}
+	double fraction = position - i;
+	return empirical->samples[i] + (empirical->samples[i + 1] - empirical->samples[i]) * fraction;
+}
+
+void workload_init(struct workload *workload, const struct workload_model *model, uint64_t seed) {
+	memset(workload, 0, sizeof(*workload));
+	workload->model = *model;
+	if (workload->model.bounce_max_pairs > (WORKLOAD_QUEUE / 2 - 1) / 2) {
+		workload->model.bounce_max_pairs = (WORKLOAD_QUEUE / 2 - 1) / 2;
+	}
+
+	// splitmix64
+	for (int i = 0; i < 4; i++) {
+		uint64_t z = (seed += 0x9E3779B97F4A7C15u);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9u;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBu;
+		workload->rng[i] = z ^ (z >> 31);
+	}
+}
+
+static void push(struct workload *workload, uint64_t time, bool pressed) {
+	unsigned tail = (workload->queue_head + workload->queue_length++) % WORKLOAD_QUEUE;
+	workload->queue[tail].time = time;
+	workload->queue[tail].pressed = pressed;
+}
+
+/*
+ * Queues an edge and the bounce after it. The contacts settle within
+ * bounce_max milliseconds.
+ */
+static void push_bouncing(struct workload *workload, uint64_t time, bool pressed) {
+	const struct workload_model *model = &workload->model;
+
+	push(workload, time, pressed);
+
+	unsigned pairs = next_random(workload) % (model->bounce_max_pairs + 1);
+	if (model->bounce_max <= 0 || pairs == 0) {
+		return;
+	}
+
+	uint64_t offsets[2 * WORKLOAD_QUEUE];
+	for (unsigned i = 0; i < 2 * pairs; i++) {
+		uint64_t offset = (uint64_t)uniform_between(workload, 1, model->bounce_max * 1000);
+		unsigned j = i;
+		for (; j > 0 && offsets[j - 1] > offset; j--) {
+			offsets[j] = offsets[j - 1];
+		}
+		offsets[j] = offset;
+	}
+
+	uint64_t previous = time;
+	for (unsigned i = 0; i < 2 * pairs; i++) {
+		previous = time + offsets[i] > previous ? time + offsets[i] : previous + 1;
+		push(workload, previous, i & 1 ? pressed : !pressed);
+	}
+}
+
+static uint64_t microseconds(double seconds) {
+	return (uint64_t)(seconds * 1e6 + 0.5);
+}
+
+/*
+ * Plans the next press and its release
+ */
+static void plan(struct workload *workload) {
+	const struct workload_model *model = &workload->model;
+	uint64_t settle = microseconds(model->bounce_max / 1000) + 1;
+	uint64_t gap;
+
+	if (workload->rolls_left == 0) {
+		// A new session
+		workload->rolls_left = 1;
+		if (model->rolls_per_session > 1) {
+			double p = 1 / model->rolls_per_session;
+			workload->rolls_left += (unsigned)floor(log(workload_uniform(workload)) / log(1 - p));
+		}
+
+		// The first session starts a second after the battery goes in
+		gap = workload->now ? microseconds(lognormal(workload, model->session_gap_median, model->session_gap_sigma))
+			: microseconds(1);
+	} else if (workload_uniform(workload) < model->repress_probability) {
+		// Pressed again while the dice is still rolling
+		gap = microseconds(uniform_between(workload, model->repress_min, model->repress_max) / 1000);
+	} else if (model->roll_gaps.count) {
+		gap = microseconds(resample(workload, &model->roll_gaps));
+	} else {
+		gap = microseconds(lognormal(workload, model->roll_gap_median, model->roll_gap_sigma));
+	}
+
+	double hold;
+	if (workload_uniform(workload) < model->tap_probability) {
+		// Accidental taps don't use up a roll of the session
+		hold = uniform_between(workload, model->tap_min, model->tap_max);
+	} else {
+		hold = model->holds.count ? resample(workload, &model->holds)
+			: lognormal(workload, model->hold_median, model->hold_sigma);
+		workload->rolls_left--;
+	}
+
+	uint64_t press = workload->now + (gap > settle ? gap : settle);
+	uint64_t held = microseconds(hold / 1000);
+	uint64_t release = press + (held > settle ? held : settle);
+
+	push_bouncing(workload, press, true);
+	push_bouncing(workload, release, false);
+	workload->now = workload->queue[(workload->queue_head + workload->queue_length - 1) % WORKLOAD_QUEUE].time;
+}
+
+void workload_next(struct workload *workload, struct edge *edge) {
+	if (workload->queue_length == 0) {
+		plan(workload);
+	}
+
+	*edge = workload->queue[workload->queue_head];
+	workload->queue_head = (workload->queue_head + 1) % WORKLOAD_QUEUE;
+	workload->queue_length--;
+}
+
+void workload_write_header(FILE *file) {
+	fwrite(WORKLOAD_MAGIC, 1, 4, file);
+}
+
+void workload_write(FILE *file, const struct edge *edge, uint64_t previous) {
+	uint64_t delta = edge->time - previous;
+	do {
+		uint8_t byte = delta & 0x7F;
+		delta >>= 7;
+		putc(delta ? byte | 0x80 : byte, file);
+	} while (delta);
+}
+
+bool workload_open(struct workload_reader *reader, FILE *file) {
+	char magic[4];
+	reader->file = file;
+	reader->now = 0;
+	reader->pressed = false;
+	return fread(magic, 1, 4, file) == 4 && memcmp(magic, WORKLOAD_MAGIC, 4) == 0;
+}
+
+bool workload_read(struct workload_reader *reader, struct edge *edge) {
+	uint64_t delta = 0;
+	int shift = 0;
+	int c;
+
+	do {
+		c = getc(reader->file);
+		if (c == EOF || shift > 63) {
+			return false;
+		}
+		delta |= (uint64_t)(c & 0x7F) << shift;
+		shift += 7;
+	} while (c & 0x80);
+
+	reader->now += delta;
+	reader->pressed = !reader->pressed;
+	edge->time = reader->now;
+	edge->pressed = reader->pressed;
+	return true;
+}
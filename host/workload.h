@@ -0,0 +1,91 @@
+/*
+ * Synthetic button workload
+ *
+ * Generates how people actually press the button: sessions of rolls,
+ * hold times, pauses to look at the result, accidental taps, presses in
+ * the middle of a roll and contact bounce. Edges are produced one at a
+ * time, so a stream can be as long as wanted without storing it.
+ *
+ * Edges alternate between press and release, starting with a press.
+ *
+ * Stream format: the magic "DWL1" followed by the time since the previous
+ * edge (since zero for the first one) of every edge in microseconds,
+ * unsigned LEB128 encoded. Typical rolls take four or five bytes.
+ */
+
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#define WORKLOAD_MAGIC "DWL1"
+
+struct edge {
+	uint64_t time;      // Microseconds
+	bool pressed;
+};
+
+/* Observed samples, resampled with linear interpolation */
+struct empirical {
+	double *samples;    // Sorted
+	unsigned count;
+};
+
+/* Lognormal durations are given as median and shape (sigma of the log) */
+struct workload_model {
+	double rolls_per_session;       // Mean, geometric distribution
+	double session_gap_median;      // Seconds between sessions
+	double session_gap_sigma;
+	double roll_gap_median;         // Seconds from release to the next press
+	double roll_gap_sigma;
+	double hold_median;             // Milliseconds the button is held
+	double hold_sigma;
+	double tap_probability;         // Presses that are accidental taps
+	double tap_min;                 // Milliseconds
+	double tap_max;
+	double repress_probability;     // Rolls interrupted by another press
+	double repress_min;             // Milliseconds after release
+	double repress_max;
+	double bounce_max;              // Milliseconds of contact bounce per edge, 0 for clean edges
+	unsigned bounce_max_pairs;      // Extra release/press pairs per edge
+
+	struct empirical holds;         // Replace the lognormal models when not empty
+	struct empirical roll_gaps;
+};
+
+#define WORKLOAD_QUEUE 16
+
+struct workload {
+	struct workload_model model;
+	uint64_t rng[4];
+	uint64_t now;
+	unsigned rolls_left;
+
+	// Pending edges of the current press or release, with bounce
+	struct edge queue[WORKLOAD_QUEUE];
+	unsigned queue_head;
+	unsigned queue_length;
+};
+
+struct workload_reader {
+	FILE *file;
+	uint64_t now;
+	bool pressed;
+};
+
+void workload_defaults(struct workload_model *model);
+bool workload_load_samples(struct empirical *empirical, const char *path);
+void workload_fit(const struct empirical *empirical, double *median, double *sigma);
+
+void workload_init(struct workload *workload, const struct workload_model *model, uint64_t seed);
+void workload_next(struct workload *workload, struct edge *edge);
+double workload_uniform(struct workload *workload);
+
+void workload_write_header(FILE *file);
+void workload_write(FILE *file, const struct edge *edge, uint64_t previous);
+bool workload_open(struct workload_reader *reader, FILE *file);
+bool workload_read(struct workload_reader *reader, struct edge *edge);
+
+#endif
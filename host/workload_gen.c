@@ -0,0 +1,247 @@
+/*
+ * Button workload generator
+ *
+ * Writes a timeline of button edges in the stream format of workload.h,
+ * or as text. Streams are generated as they are written, so an endless
+ * one can be piped straight into a simulation.
+ *
+ * Usage: workload_gen [options] > stream
+ *        workload_gen -d < stream
+ *        workload_gen [options] -c < stream
+ *
+ *   -s seed        Random seed (1)
+ *   -n edges       Stop after this many edges, 0 for endless (1000)
+ *   -t             Text output: microseconds and 1 for press, 0 for release
+ *   -d             Decode a stream from stdin to text
+ *   -c             Check a stream from stdin: it must decode to the edges
+ *                  the same options generate, and its presses must have
+ *                  the bounce, taps and hold times of the model
+ *   -p             Print the model and stop
+ *   -r rolls       Mean rolls per session
+ *   -S seconds     Median gap between sessions
+ *   -g seconds     Median gap from release to the next press
+ *   -h ms          Median hold time
+ *   -T p           Probability of an accidental tap
+ *   -R p           Probability of pressing again during a roll
+ *   -b ms          Maximum contact bounce, 0 for clean edges
+ *   -H file        Hold times in milliseconds to resample, one per line
+ *   -G file        Gaps in seconds to resample, one per line
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "workload.h"
+
+static void usage(void) {
+	fprintf(stderr, "usage: workload_gen [-tpc] [-s seed] [-n edges] [-r rolls] [-S seconds] [-g seconds]\n"
+		"                    [-h ms] [-T p] [-R p] [-b ms] [-H file] [-G file]\n"
+		"       workload_gen -d < stream\n");
+	exit(2);
+}
+
+static void load(struct empirical *empirical, const char *path) {
+	if (!workload_load_samples(empirical, path)) {
+		fprintf(stderr, "workload_gen: no samples in %s\n", path);
+		exit(1);
+	}
+}
+
+static int decode(void) {
+	struct workload_reader reader;
+	struct edge edge;
+
+	if (!workload_open(&reader, stdin)) {
+		fprintf(stderr, "workload_gen: not a workload stream\n");
+		return 1;
+	}
+	while (workload_read(&reader, &edge)) {
+		printf("%llu %d\n", (unsigned long long)edge.time, edge.pressed);
+	}
+	return 0;
+}
+
+static bool expect(bool ok, const char *what) {
+	if (!ok) {
+		printf("FAIL: %s\n", what);
+	}
+	return ok;
+}
+
+/*
+ * Decodes the stream on stdin beside a fresh generation from 'seed'.
+ * Edges within the bounce time of a press or release are its bounce.
+ */
+static int check(const struct workload_model *model, uint64_t seed) {
+	struct workload_reader reader;
+	struct workload workload;
+	struct edge edge, expected;
+
+	if (!workload_open(&reader, stdin)) {
+		fprintf(stderr, "workload_gen: not a workload stream\n");
+		return 1;
+	}
+	workload_init(&workload, model, seed);
+
+	uint64_t bounce = (uint64_t)(model->bounce_max * 1000 + 0.5);
+	unsigned long long edges = 0, presses = 0, taps = 0, mismatches = 0;
+	unsigned long long unsettled = 0;
+	unsigned burst_edges = 0, most_edges = 0;
+	bool burst_pressed = false;
+	uint64_t burst_start = 0, pressed_at = 0;
+	unsigned long long holds = 0, under_median = 0;
+
+	while (workload_read(&reader, &edge)) {
+		workload_next(&workload, &expected);
+		mismatches += edge.time != expected.time || edge.pressed != expected.pressed;
+
+		if (edges == 0 || edge.time - burst_start > bounce) {
+			// A new press or release. The last one must have settled
+			// where its edge took the contact, pairs of bounce after it
+			unsettled += edges && edge.pressed == burst_pressed;
+			most_edges = burst_edges > most_edges ? burst_edges : most_edges;
+			burst_edges = 0;
+			burst_start = edge.time;
+			burst_pressed = edge.pressed;
+			if (edge.pressed) {
+				presses++;
+				pressed_at = edge.time;
+			} else {
+				double hold = (edge.time - pressed_at) / 1000.0;
+				if (hold <= model->tap_max) {
+					taps++;
+				} else {
+					holds++;
+					under_median += hold < model->hold_median;
+				}
+			}
+		}
+		burst_edges++;
+		edges++;
+	}
+
+	// Holds no longer than tap_max pass for taps too
+	double short_holds = model->holds.count ? 0
+		: erfc(-log(model->tap_max / model->hold_median) / (model->hold_sigma * sqrt(2))) / 2;
+	double expected_taps = model->tap_probability + (1 - model->tap_probability) * short_holds;
+	double tap_share = presses ? (double)taps / presses : 0;
+	double tolerance = 5 * sqrt(expected_taps * (1 - expected_taps) / (presses + 1)) + 0.005;
+
+	// Of the rest, those under the median
+	double expected_under = (0.5 - short_holds) / (1 - short_holds);
+	double under_share = holds ? (double)under_median / holds : 0;
+	double under_tolerance = 5 * sqrt(expected_under * (1 - expected_under) / (holds + 1)) + 0.005;
+
+	unsigned most_pairs = (most_edges - 1) / 2;
+	printf("%llu edges, %llu presses, %llu taps (%.2f %%), %.2f %% of holds under %g ms, up to %u pairs of bounce\n",
+		edges, presses, taps, 100 * tap_share, 100 * under_share, model->hold_median, most_pairs);
+	bool ok = expect(edges > 0 && mismatches == 0, "the stream decodes to the generated edges");
+	ok &= expect(unsettled == 0, "contacts settle within the bounce time");
+	ok &= expect(most_pairs <= workload.model.bounce_max_pairs, "no more bounce pairs than the model allows");
+	ok &= expect(fabs(tap_share - expected_taps) <= tolerance, "taps come at the model's rate");
+	if (!model->holds.count) {
+		ok &= expect(fabs(under_share - expected_under) <= under_tolerance, "holds have the model's median");
+	}
+	if (!ok) {
+		return 1;
+	}
+	printf("ok\n");
+	return 0;
+}
+
+static void print_model(const struct workload_model *model) {
+	double median, sigma;
+
+	printf("rolls per session     %g\n", model->rolls_per_session);
+	printf("session gap           lognormal %g s, sigma %g\n", model->session_gap_median, model->session_gap_sigma);
+	if (model->roll_gaps.count) {
+		workload_fit(&model->roll_gaps, &median, &sigma);
+		printf("roll gap              %u samples, fits lognormal %g s, sigma %g\n",
+			model->roll_gaps.count, median, sigma);
+	} else {
+		printf("roll gap              lognormal %g s, sigma %g\n", model->roll_gap_median, model->roll_gap_sigma);
+	}
+	if (model->holds.count) {
+		workload_fit(&model->holds, &median, &sigma);
+		printf("hold                  %u samples, fits lognormal %g ms, sigma %g\n",
+			model->holds.count, median, sigma);
+	} else {
+		printf("hold                  lognormal %g ms, sigma %g\n", model->hold_median, model->hold_sigma);
+	}
+	printf("accidental tap        %g, %g - %g ms\n", model->tap_probability, model->tap_min, model->tap_max);
+	printf("press during a roll   %g, %g - %g ms after release\n",
+		model->repress_probability, model->repress_min, model->repress_max);
+	printf("bounce                up to %g ms, %u pairs\n", model->bounce_max, model->bounce_max_pairs);
+}
+
+int main(int argc, char **argv) {
+	struct workload_model model;
+	uint64_t seed = 1;
+	unsigned long long edges = 1000;
+	int text = 0;
+	int show_model = 0;
+	int check_stream = 0;
+	int c;
+
+	workload_defaults(&model);
+
+	while ((c = getopt(argc, argv, "s:n:tdcpr:S:g:h:T:R:b:H:G:")) != -1) {
+		switch (c) {
+		case 's': seed = strtoull(optarg, NULL, 0); break;
+		case 'n': edges = strtoull(optarg, NULL, 0); break;
+		case 't': text = 1; break;
+		case 'd': return decode();
+		case 'c': check_stream = 1; break;
+		case 'p': show_model = 1; break;
+		case 'r': model.rolls_per_session = atof(optarg); break;
+		case 'S': model.session_gap_median = atof(optarg); break;
+		case 'g': model.roll_gap_median = atof(optarg); break;
+		case 'h': model.hold_median = atof(optarg); break;
+		case 'T': model.tap_probability = atof(optarg); break;
+		case 'R': model.repress_probability = atof(optarg); break;
+		case 'b': model.bounce_max = atof(optarg); break;
+		case 'H': load(&model.holds, optarg); break;
+		case 'G': load(&model.roll_gaps, optarg); break;
+		default: usage();
+		}
+	}
+	if (optind != argc) {
+		usage();
+	}
+
+	if (show_model) {
+		print_model(&model);
+		return 0;
+	}
+	if (check_stream) {
+		return check(&model, seed);
+	}
+
+	struct workload workload;
+	struct edge edge;
+	uint64_t previous = 0;
+
+	workload_init(&workload, &model, seed);
+	if (!text) {
+		workload_write_header(stdout);
+	}
+
+	for (unsigned long long i = 0; edges == 0 || i < edges; i++) {
+		workload_next(&workload, &edge);
+		if (text) {
+			printf("%llu %d\n", (unsigned long long)edge.time, edge.pressed);
+		} else {
+			workload_write(stdout, &edge, previous);
+		}
+		previous = edge.time;
+
+		if (ferror(stdout)) {
+			// The reader has had enough
+			break;
+		}
+	}
+
+	return 0;
+}
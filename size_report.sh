@@ -0,0 +1,28 @@
+#!/bin/sh
+#
+# Flash and SRAM cost of each enabled feature
+#
+# Builds the image once as configured and once without each feature (and
+# whatever needs it), and prints the differences. Run with "make size-report",
+# which passes CC, SIZE, FEATURES, SRC, CFLAGS and LDFLAGS.
+
+set -e
+
+measure() {
+	$CC $CFLAGS "$@" $SRC -o size_report.elf $LDFLAGS
+	# Flash is text + data, SRAM is data + bss
+	$SIZE size_report.elf | awk 'NR == 2 { print $1 + $2, $2 + $3 }'
+}
+
+set -- $(measure)
+full_flash=$1
+full_sram=$2
+
+printf '%-16s %6s %6s\n' feature flash sram
+awk -v mode=costs -f config.awk "$FEATURES" | while read feature flags; do
+	set -- $(measure $flags)
+	printf '%-16s %6d %6d\n' "$feature" $((full_flash - $1)) $((full_sram - $2))
+done
+printf '%-16s %6d %6d\n' image "$full_flash" "$full_sram"
+
+rm -f size_report.elf
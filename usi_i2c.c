@@ -0,0 +1,256 @@
+/*
+ * Interrupt-driven I2C master on the USI
+ *
+ * MIT license, see LICENSE.txt.
+ *
+ * The USI can't generate a bus clock by itself. Timer1's compare B interrupt
+ * toggles SCL every half bit and the USI counter overflow interrupt moves the
+ * transfer forward one byte or one acknowledge bit at a time. Both handlers
+ * are short, so the main loop keeps animating while a transfer is running.
+ *
+ * Timer1 is expected to free-run at CLK/1.
+ */
+
+#ifndef F_CPU
+#define F_CPU 1000000UL
+#endif
+
+#include "config.h"
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+#include "usi_i2c.h"
+
+#if ACCELEROMETER
+
+#define SDA PA6
+#define SCL PA4
+
+// Two-wire mode, counter clocked by USITC strobes, data sampled on SCL rising edge
+#define USI_TWI (_BV(USIOIE) | _BV(USIWM1) | _BV(USICS1) | _BV(USICLK))
+
+// Clear flags and preload the counter to overflow after 16 edges (a byte) or 2 edges (a bit)
+#define USI_FLAGS (_BV(USISIF) | _BV(USIOIF) | _BV(USIPF) | _BV(USIDC))
+#define USI_BYTE (USI_FLAGS | 0x0)
+#define USI_BIT (USI_FLAGS | 0xE)
+
+// Timer1 cycles per half bit. The clock interrupt takes about 30 cycles, giving ~10 kHz SCL at 1 MHz
+#define HALF_BIT 50
+
+enum state {
+	IDLE,
+	SEND_ADDRESS,
+	SEND_REGISTER,
+	SEND_VALUE,
+	SEND_READ_ADDRESS,
+	RECEIVE
+};
+
+static volatile uint8_t state = IDLE;
+static volatile bool failed;
+
+// True while an acknowledge bit is being clocked
+static bool acknowledge;
+
+static uint8_t device;
+static uint8_t target;
+static uint8_t value;
+static uint8_t *buffer;
+static uint8_t remaining;
+static bool reading;
+
+
+static void clock_start(void) {
+	OCR1B = TCNT1 + HALF_BIT;
+	TIFR1 = _BV(OCF1B);
+	TIMSK1 |= _BV(OCIE1B);
+}
+
+static void clock_stop(void) {
+	TIMSK1 &= ~_BV(OCIE1B);
+}
+
+/*
+ * SDA falls while SCL is high. Also used for repeated starts.
+ */
+static void start_condition(void) {
+	DDRA |= _BV(SDA);
+	USIDR = 0xFF;
+	PORTA |= _BV(SDA);
+	PORTA |= _BV(SCL);
+	_delay_us(5);
+	PORTA &= ~_BV(SDA);
+	_delay_us(5);
+	PORTA &= ~_BV(SCL);
+	PORTA |= _BV(SDA);
+}
+
+/*
+ * SDA rises while SCL is high
+ */
+static void stop_condition(void) {
+	DDRA |= _BV(SDA);
+	USIDR = 0xFF;
+	PORTA &= ~_BV(SDA);
+	PORTA |= _BV(SCL);
+	_delay_us(5);
+	PORTA |= _BV(SDA);
+	_delay_us(5);
+}
+
+static void send_byte(uint8_t byte) {
+	DDRA |= _BV(SDA);
+	USIDR = byte;
+	USISR = USI_BYTE;
+}
+
+static void receive_byte(void) {
+	DDRA &= ~_BV(SDA);
+	USISR = USI_BYTE;
+}
+
+static void finish(void) {
+	stop_condition();
+	USISR = USI_FLAGS;
+	state = IDLE;
+}
+
+static void begin(void) {
+	failed = false;
+	acknowledge = false;
+	start_condition();
+	state = SEND_ADDRESS;
+	send_byte(device << 1);
+	clock_start();
+}
+
+/*
+ * Bit clock
+ */
+ISR(TIM1_COMPB_vect) {
+	OCR1B += HALF_BIT;
+	USICR = USI_TWI | _BV(USITC);
+
+	// Hold the clock until the overflow handler has set up the next step
+	if (USISR & _BV(USIOIF)) {
+		clock_stop();
+	}
+}
+
+/*
+ * A byte or an acknowledge bit has been clocked
+ */
+ISR(USI_OVF_vect) {
+	uint8_t data = USIDR;
+	clock_stop();
+
+	if (!acknowledge) {
+		acknowledge = true;
+
+		if (state == RECEIVE) {
+			*buffer++ = data;
+			remaining--;
+
+			// Acknowledge all but the last byte
+			DDRA |= _BV(SDA);
+			USIDR = remaining ? 0x00 : 0xFF;
+		} else {
+			DDRA &= ~_BV(SDA);
+		}
+
+		USISR = USI_BIT;
+		clock_start();
+		return;
+	}
+
+	acknowledge = false;
+
+	if (state == RECEIVE) {
+		if (remaining) {
+			receive_byte();
+			clock_start();
+		} else {
+			finish();
+		}
+		return;
+	}
+
+	if (data & 1) {
+		// Not acknowledged
+		failed = true;
+		finish();
+		return;
+	}
+
+	switch (state) {
+	case SEND_ADDRESS:
+		state = SEND_REGISTER;
+		send_byte(target);
+		break;
+
+	case SEND_REGISTER:
+		if (reading) {
+			start_condition();
+			state = SEND_READ_ADDRESS;
+			send_byte(device << 1 | 1);
+		} else {
+			state = SEND_VALUE;
+			send_byte(value);
+		}
+		break;
+
+	case SEND_READ_ADDRESS:
+		state = RECEIVE;
+		receive_byte();
+		break;
+
+	default:
+		finish();
+		return;
+	}
+
+	clock_start();
+}
+
+void i2c_init(void) {
+	PORTA |= _BV(SDA) | _BV(SCL);
+	DDRA |= _BV(SDA) | _BV(SCL);
+	USIDR = 0xFF;
+	USICR = USI_TWI;
+	USISR = USI_FLAGS;
+	TCCR1B = _BV(CS10);
+}
+
+void i2c_read(uint8_t address, uint8_t reg, uint8_t *destination, uint8_t length) {
+	i2c_wait();
+	device = address;
+	target = reg;
+	buffer = destination;
+	remaining = length;
+	reading = true;
+	begin();
+}
+
+void i2c_write(uint8_t address, uint8_t reg, uint8_t byte) {
+	i2c_wait();
+	device = address;
+	target = reg;
+	value = byte;
+	reading = false;
+	begin();
+}
+
+bool i2c_busy(void) {
+	return state != IDLE;
+}
+
+bool i2c_wait(void) {
+	while (i2c_busy()) {
+		_delay_us(HALF_BIT);
+	}
+
+	return !failed;
+}
+
+#endif /* ACCELEROMETER */
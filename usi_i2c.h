@@ -0,0 +1,34 @@
+/*
+ * Interrupt-driven I2C master on the USI
+ *
+ * MIT license, see LICENSE.txt.
+ */
+
+#ifndef USI_I2C_H
+#define USI_I2C_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+void i2c_init(void);
+
+/*
+ * Starts reading 'length' bytes from register 'reg' of the device at
+ * 'address'. Returns immediately; the buffer is filled in the background.
+ */
+void i2c_read(uint8_t address, uint8_t reg, uint8_t *buffer, uint8_t length);
+
+/*
+ * Starts writing a single register. Returns immediately.
+ */
+void i2c_write(uint8_t address, uint8_t reg, uint8_t value);
+
+bool i2c_busy(void);
+
+/*
+ * Waits until the current transfer has finished. Returns false if the
+ * device did not acknowledge.
+ */
+bool i2c_wait(void);
+
+#endif